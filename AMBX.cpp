@@ -20,7 +20,13 @@
 
 AMBX::AMBX(USB *p) :
 pUsb(p), // pointer to USB class instance - mandatory
-bAddress(0) // device address - mandatory
+bAddress(0), // device address - mandatory
+sentMask(0),
+stagedMask(0),
+fadingMask(0),
+fadeTicks(0),
+fadePos(0),
+qNextFadeTime(0)
 {
         for(uint8_t i = 0; i < AMBX_MAX_ENDPOINTS; i++) {
                 epInfo[i].epAddr = 0;
@@ -152,8 +158,6 @@ uint8_t AMBX::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         if(rcode)
                 goto FailSetDevTblEntry;
 
-        delay(200); //Give time for address change
-
         //For some reason this is need to make it work
         rcode = pUsb->setConf(bAddress, epInfo[ AMBX_CONTROL_PIPE ].epAddr, 1);
         if(rcode)
@@ -204,23 +208,70 @@ Fail:
 /* Performs a cleanup after failed Init() attempt */
 uint8_t AMBX::Release() {
         AMBXConnected = false;
+        sentMask = 0; // The colors are unknown when the controller is plugged in again
+        fadingMask = 0;
         pUsb->GetAddressPool().FreeAddress(bAddress);
         bAddress = 0;
         return 0;
 }
 
 uint8_t AMBX::Poll() {
+        if(!AMBXConnected || !fadingMask)
+                return 0;
+        if((int32_t)((uint32_t)millis() - qNextFadeTime) < 0L)
+                return 0;
+        qNextFadeTime = (uint32_t)millis() + AMBX_FADE_TICK;
+
+        if(fadePos < fadeTicks)
+                fadePos++;
+        for(uint8_t i = 0; i < AMBX_NUM_LIGHTS; i++) {
+                if(!(fadingMask & (1 << i)))
+                        continue;
+                LightState &l = lights[i];
+                uint8_t rgb[3];
+                for(uint8_t c = 0; c < 3; c++)
+                        rgb[c] = l.from[c] + (int16_t)(((int32_t)l.to[c] - l.from[c]) * fadePos / fadeTicks);
+                updateLight(i, rgb);
+        }
+        if(fadePos >= fadeTicks)
+                fadingMask &= ~sentMask; // Lights whose last update failed are retried on the next tick
         return 0;
 }
 
-void AMBX::Light_Command(uint8_t *data, uint16_t nbytes) {
+uint8_t AMBX::Light_Command(uint8_t *data, uint16_t nbytes) {
         #ifdef DEBUG_USB_HOST
         Notify(PSTR("\r\nLight command "), 0x80);
         #endif
-        pUsb->outTransfer(bAddress, epInfo[ AMBX_OUTPUT_PIPE ].epAddr, nbytes, data);
+        return pUsb->outTransfer(bAddress, epInfo[ AMBX_OUTPUT_PIPE ].epAddr, nbytes, data);
+}
+
+/* Sends the color of a light, unless the controller shows it already */
+void AMBX::updateLight(uint8_t index, const uint8_t *rgb) {
+        LightState &l = lights[index];
+        if((sentMask & (1 << index)) && !memcmp(l.sent, rgb, 3))
+                return;
+
+        writeBuf[0] = AMBX_PREFIX_COMMAND;
+        writeBuf[1] = AMBX_LIGHT_CODE(index);
+        writeBuf[2] = AMBX_SET_COLOR_COMMAND;
+        memcpy(&writeBuf[3], rgb, 3);
+        if(Light_Command(writeBuf, AMBX_LIGHT_COMMAND_BUFFER_SIZE)) {
+                sentMask &= ~(1 << index); // Sent again on the next update
+                return;
+        }
+        memcpy(l.sent, rgb, 3);
+        sentMask |= 1 << index;
 }
 
 void AMBX::setLight(uint8_t ambx_light, uint8_t r, uint8_t g, uint8_t b) {
+        uint8_t index = AMBX_LIGHT_INDEX(ambx_light);
+        if(index < AMBX_NUM_LIGHTS && AMBX_LIGHT_CODE(index) == ambx_light) {
+                fadingMask &= ~(1 << index);
+                sentMask &= ~(1 << index); // Always sent, as before
+                const uint8_t rgb[3] = { r, g, b };
+                updateLight(index, rgb);
+                return;
+        }
         writeBuf[0] = AMBX_PREFIX_COMMAND;
         writeBuf[1] = ambx_light;
         writeBuf[2] = AMBX_SET_COLOR_COMMAND;
@@ -235,11 +286,54 @@ void AMBX::setLight(AmbxLightsEnum ambx_light, AmbxColorsEnum color) { // Use th
 }
 
 void AMBX::setAllLights(AmbxColorsEnum color) { // Use this to set the Color using the predefined colors in "AMBXEnums.h"
-        setLight(Sidelight_left, (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)(color));
-        setLight(Sidelight_right, (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)(color));
-        setLight(Wallwasher_center, (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)(color));
-        setLight(Wallwasher_left, (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)(color));
-        setLight(Wallwasher_right, (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)(color));
+        stageAllLights(color);
+        commitFrame(); // Lights which show the color already are skipped
+}
+
+void AMBX::stageLight(uint8_t ambx_light, uint8_t r, uint8_t g, uint8_t b) {
+        uint8_t index = AMBX_LIGHT_INDEX(ambx_light);
+        if(index >= AMBX_NUM_LIGHTS || AMBX_LIGHT_CODE(index) != ambx_light)
+                return;
+        lights[index].staged[0] = r;
+        lights[index].staged[1] = g;
+        lights[index].staged[2] = b;
+        stagedMask |= 1 << index;
+}
+
+void AMBX::stageLight(AmbxLightsEnum ambx_light, AmbxColorsEnum color) {
+        stageLight(ambx_light, (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)(color));
+}
+
+void AMBX::stageAllLights(AmbxColorsEnum color) {
+        for(uint8_t i = 0; i < AMBX_NUM_LIGHTS; i++)
+                stageLight(AMBX_LIGHT_CODE(i), (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)(color));
+}
+
+void AMBX::commitFrame(uint16_t fadeTime) {
+        // A running fade of a light which is not staged is finished first
+        for(uint8_t i = 0; i < AMBX_NUM_LIGHTS; i++) {
+                if((fadingMask & ~stagedMask) & (1 << i))
+                        updateLight(i, lights[i].to);
+        }
+        fadingMask = 0;
+
+        fadeTicks = (fadeTime + AMBX_FADE_TICK - 1) / AMBX_FADE_TICK;
+        for(uint8_t i = 0; i < AMBX_NUM_LIGHTS; i++) {
+                if(!(stagedMask & (1 << i)))
+                        continue;
+                LightState &l = lights[i];
+                if(fadeTicks == 0 || !(sentMask & (1 << i))) {
+                        updateLight(i, l.staged); // Nothing to fade from
+                        continue;
+                }
+                memcpy(l.from, l.sent, 3);
+                memcpy(l.to, l.staged, 3);
+                if(memcmp(l.from, l.to, 3))
+                        fadingMask |= 1 << i;
+        }
+        stagedMask = 0;
+        fadePos = 0;
+        qNextFadeTime = (uint32_t)millis() + AMBX_FADE_TICK;
 }
 
 void AMBX::onInit() {
@@ -52,6 +52,16 @@
 
 #define AMBX_LIGHT_COMMAND_BUFFER_SIZE 6
 
+/* The light codes are 0x0B, 0x1B, ... 0x4B, so the upper nibble is used as index */
+#define AMBX_NUM_LIGHTS         5
+#define AMBX_LIGHT_INDEX(light) ((light) >> 4)
+#define AMBX_LIGHT_CODE(index)  (((index) << 4) | 0x0B)
+
+/* Interval in ms at which Poll() updates lights which are fading */
+#ifndef AMBX_FADE_TICK
+#define AMBX_FADE_TICK           20
+#endif
+
 
 #define AMBX_MAX_ENDPOINTS       3
 
@@ -96,6 +106,8 @@ public:
                 return bAddress;
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         /**
          * Used by the USB core to check what this driver support.
          * @param  vid The device's VID.
@@ -124,6 +136,41 @@ public:
          */
         void setAllLights(AmbxColorsEnum color);
 
+        /** @name Frame API
+         * The colors of several lights are staged and then shown at once with commitFrame(), optionally fading from the current colors.
+         * Only lights whose color actually changes are sent to the controller.
+         */
+        /**
+         * Stage the color of a light for the next call to commitFrame().
+         * @param ambx_light The light.
+         * @param r,g,b      RGB value.
+         */
+        void stageLight(uint8_t ambx_light, uint8_t r, uint8_t g, uint8_t b);
+        /**
+         * Stage the color of a light using the predefined colors in ::ColorsEnum.
+         * @param ambx_light The light.
+         * @param color      The desired color.
+         */
+        void stageLight(AmbxLightsEnum ambx_light, AmbxColorsEnum color);
+        /**
+         * Stage the same color for all lights.
+         * @param color The desired color.
+         */
+        void stageAllLights(AmbxColorsEnum color);
+        /**
+         * Show the staged colors.
+         * @param fadeTime Time in ms to fade from the current colors, which is done from Poll(). 0 sends the colors right away.
+         */
+        void commitFrame(uint16_t fadeTime = 0);
+        /**
+         * Check if a fade started by commitFrame() is still running.
+         * @return True while at least one light is fading.
+         */
+        bool isFading() {
+                return fadingMask != 0;
+        };
+        /**@}*/
+
         /**
          * Used to call your own function when the controller is successfully initialized.
          * @param funcOnInit Function to call.
@@ -152,8 +199,23 @@ private:
 
         uint8_t writeBuf[AMBX_EP_MAXPKTSIZE]; // General purpose buffer for output data
 
+        struct LightState {
+                uint8_t sent[3]; // Color last sent to the controller
+                uint8_t staged[3]; // Color set by stageLight()
+                uint8_t from[3]; // Color at the start of the fade
+                uint8_t to[3]; // Color at the end of the fade
+        };
+        LightState lights[AMBX_NUM_LIGHTS];
+        uint8_t sentMask; // Bit set for every light whose sent color is known
+        uint8_t stagedMask; // Bit set for every light staged since the last commitFrame()
+        uint8_t fadingMask; // Bit set for every light which is fading
+        uint16_t fadeTicks; // Length of the fade in ticks
+        uint16_t fadePos; // Ticks done
+        uint32_t qNextFadeTime; // Time of the next tick
+
         /* Private commands */
-        void Light_Command(uint8_t *data, uint16_t nbytes);
+        uint8_t Light_Command(uint8_t *data, uint16_t nbytes);
+        void updateLight(uint8_t index, const uint8_t *rgb);
 };
 
 #endif
@@ -151,8 +151,6 @@ uint8_t BTD::Init(uint8_t parent __attribute__((unused)), uint8_t port __attribu
                 return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
         }
 
-        delay(300); // Assign new address to the device
-
         rcode = pUsb->setAddr(0, 0, bAddress); // Assign new address to the device
         if(rcode) {
 #ifdef DEBUG_USB_HOST
@@ -184,7 +182,7 @@ uint8_t BTD::Init(uint8_t parent __attribute__((unused)), uint8_t port __attribu
                 goto FailSetDevTblEntry;
 
         if(VID == PS3_VID && (PID == PS3_PID || PID == PS3NAVIGATION_PID || PID == PS3MOVE_PID)) {
-                delay(100);
+                // The quirks table in Usb.cpp makes setAddr() wait long enough for these
                 rcode = pUsb->setConf(bAddress, epInfo[ BTD_CONTROL_PIPE ].epAddr, 1); // We only need the Control endpoint, so we don't have to initialize the other endpoints of device
                 if(rcode)
                         goto FailSetConfDescr;
@@ -759,7 +757,7 @@ void BTD::HCI_event_task() {
                 } // Switch
         }
 #ifdef EXTRADEBUG
-        else {
+        else if(rcode != USB_ERROR_TRANSFER_IN_PROGRESS) {
                 Notify(PSTR("\r\nHCI event error: "), 0x80);
                 D_PrintHex<uint8_t > (rcode, 0x80);
         }
@@ -1096,7 +1094,7 @@ void BTD::ACL_event_task() {
                 }
         }
 #ifdef EXTRADEBUG
-        else if(rcode != hrNAK) {
+        else if(rcode != hrNAK && rcode != USB_ERROR_TRANSFER_IN_PROGRESS) {
                 Notify(PSTR("\r\nACL data in error: "), 0x80);
                 D_PrintHex<uint8_t > (rcode, 0x80);
         }
@@ -1116,158 +1114,197 @@ void BTD::HCI_Command(uint8_t* data, uint16_t nbytes) {
 }
 
 void BTD::hci_reset() {
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 3);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_event_flag = 0; // Clear all the flags
-        hcibuf[0] = 0x03; // HCI OCF = 3
-        hcibuf[1] = 0x03 << 2; // HCI OGF = 3
-        hcibuf[2] = 0x00;
+        hcicmdbuf[0] = 0x03; // HCI OCF = 3
+        hcicmdbuf[1] = 0x03 << 2; // HCI OGF = 3
+        hcicmdbuf[2] = 0x00;
 
-        HCI_Command(hcibuf, 3);
+        HCI_Command(hcicmdbuf, 3);
 }
 
 void BTD::hci_write_scan_enable() {
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 4);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_clear_flag(HCI_FLAG_INCOMING_REQUEST);
-        hcibuf[0] = 0x1A; // HCI OCF = 1A
-        hcibuf[1] = 0x03 << 2; // HCI OGF = 3
-        hcibuf[2] = 0x01; // parameter length = 1
+        hcicmdbuf[0] = 0x1A; // HCI OCF = 1A
+        hcicmdbuf[1] = 0x03 << 2; // HCI OGF = 3
+        hcicmdbuf[2] = 0x01; // parameter length = 1
         if(btdName != NULL)
-                hcibuf[3] = 0x03; // Inquiry Scan enabled. Page Scan enabled.
+                hcicmdbuf[3] = 0x03; // Inquiry Scan enabled. Page Scan enabled.
         else
-                hcibuf[3] = 0x02; // Inquiry Scan disabled. Page Scan enabled.
+                hcicmdbuf[3] = 0x02; // Inquiry Scan disabled. Page Scan enabled.
 
-        HCI_Command(hcibuf, 4);
+        HCI_Command(hcicmdbuf, 4);
 }
 
 void BTD::hci_write_scan_disable() {
-        hcibuf[0] = 0x1A; // HCI OCF = 1A
-        hcibuf[1] = 0x03 << 2; // HCI OGF = 3
-        hcibuf[2] = 0x01; // parameter length = 1
-        hcibuf[3] = 0x00; // Inquiry Scan disabled. Page Scan disabled.
-
-        HCI_Command(hcibuf, 4);
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 4);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x1A; // HCI OCF = 1A
+        hcicmdbuf[1] = 0x03 << 2; // HCI OGF = 3
+        hcicmdbuf[2] = 0x01; // parameter length = 1
+        hcicmdbuf[3] = 0x00; // Inquiry Scan disabled. Page Scan disabled.
+
+        HCI_Command(hcicmdbuf, 4);
 }
 
 void BTD::hci_read_bdaddr() {
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 3);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_clear_flag(HCI_FLAG_READ_BDADDR);
-        hcibuf[0] = 0x09; // HCI OCF = 9
-        hcibuf[1] = 0x04 << 2; // HCI OGF = 4
-        hcibuf[2] = 0x00;
+        hcicmdbuf[0] = 0x09; // HCI OCF = 9
+        hcicmdbuf[1] = 0x04 << 2; // HCI OGF = 4
+        hcicmdbuf[2] = 0x00;
 
-        HCI_Command(hcibuf, 3);
+        HCI_Command(hcicmdbuf, 3);
 }
 
 void BTD::hci_read_local_version_information() {
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 3);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_clear_flag(HCI_FLAG_READ_VERSION);
-        hcibuf[0] = 0x01; // HCI OCF = 1
-        hcibuf[1] = 0x04 << 2; // HCI OGF = 4
-        hcibuf[2] = 0x00;
+        hcicmdbuf[0] = 0x01; // HCI OCF = 1
+        hcicmdbuf[1] = 0x04 << 2; // HCI OGF = 4
+        hcicmdbuf[2] = 0x00;
 
-        HCI_Command(hcibuf, 3);
+        HCI_Command(hcicmdbuf, 3);
 }
 
 void BTD::hci_read_local_extended_features(uint8_t page_number) {
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 4);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_clear_flag(HCI_FLAG_LOCAL_EXTENDED_FEATURES);
-        hcibuf[0] = 0x04; // HCI OCF = 4
-        hcibuf[1] = 0x04 << 2; // HCI OGF = 4
-        hcibuf[2] = 0x01; // parameter length = 1
-        hcibuf[3] = page_number;
+        hcicmdbuf[0] = 0x04; // HCI OCF = 4
+        hcicmdbuf[1] = 0x04 << 2; // HCI OGF = 4
+        hcicmdbuf[2] = 0x01; // parameter length = 1
+        hcicmdbuf[3] = page_number;
 
-        HCI_Command(hcibuf, 4);
+        HCI_Command(hcicmdbuf, 4);
 }
 
 void BTD::hci_accept_connection() {
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 10);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_clear_flag(HCI_FLAG_CONNECT_COMPLETE);
-        hcibuf[0] = 0x09; // HCI OCF = 9
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x07; // parameter length 7
-        hcibuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
-        hcibuf[4] = disc_bdaddr[1];
-        hcibuf[5] = disc_bdaddr[2];
-        hcibuf[6] = disc_bdaddr[3];
-        hcibuf[7] = disc_bdaddr[4];
-        hcibuf[8] = disc_bdaddr[5];
-        hcibuf[9] = 0x00; // Switch role to master
-
-        HCI_Command(hcibuf, 10);
+        hcicmdbuf[0] = 0x09; // HCI OCF = 9
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x07; // parameter length 7
+        hcicmdbuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
+        hcicmdbuf[4] = disc_bdaddr[1];
+        hcicmdbuf[5] = disc_bdaddr[2];
+        hcicmdbuf[6] = disc_bdaddr[3];
+        hcicmdbuf[7] = disc_bdaddr[4];
+        hcicmdbuf[8] = disc_bdaddr[5];
+        hcicmdbuf[9] = 0x00; // Switch role to master
+
+        HCI_Command(hcicmdbuf, 10);
 }
 
 void BTD::hci_remote_name() {
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 13);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_clear_flag(HCI_FLAG_REMOTE_NAME_COMPLETE);
-        hcibuf[0] = 0x19; // HCI OCF = 19
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x0A; // parameter length = 10
-        hcibuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
-        hcibuf[4] = disc_bdaddr[1];
-        hcibuf[5] = disc_bdaddr[2];
-        hcibuf[6] = disc_bdaddr[3];
-        hcibuf[7] = disc_bdaddr[4];
-        hcibuf[8] = disc_bdaddr[5];
-        hcibuf[9] = 0x01; // Page Scan Repetition Mode
-        hcibuf[10] = 0x00; // Reserved
-        hcibuf[11] = 0x00; // Clock offset - low byte
-        hcibuf[12] = 0x00; // Clock offset - high byte
-
-        HCI_Command(hcibuf, 13);
+        hcicmdbuf[0] = 0x19; // HCI OCF = 19
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x0A; // parameter length = 10
+        hcicmdbuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
+        hcicmdbuf[4] = disc_bdaddr[1];
+        hcicmdbuf[5] = disc_bdaddr[2];
+        hcicmdbuf[6] = disc_bdaddr[3];
+        hcicmdbuf[7] = disc_bdaddr[4];
+        hcicmdbuf[8] = disc_bdaddr[5];
+        hcicmdbuf[9] = 0x01; // Page Scan Repetition Mode
+        hcicmdbuf[10] = 0x00; // Reserved
+        hcicmdbuf[11] = 0x00; // Clock offset - low byte
+        hcicmdbuf[12] = 0x00; // Clock offset - high byte
+
+        HCI_Command(hcicmdbuf, 13);
 }
 
 void BTD::hci_write_local_name(const char* name) {
-        hcibuf[0] = 0x13; // HCI OCF = 13
-        hcibuf[1] = 0x03 << 2; // HCI OGF = 3
-        hcibuf[2] = strlen(name) + 1; // parameter length = the length of the string + end byte
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 4 + strlen(name));
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x13; // HCI OCF = 13
+        hcicmdbuf[1] = 0x03 << 2; // HCI OGF = 3
+        hcicmdbuf[2] = strlen(name) + 1; // parameter length = the length of the string + end byte
         uint8_t i;
         for(i = 0; i < strlen(name); i++)
-                hcibuf[i + 3] = name[i];
-        hcibuf[i + 3] = 0x00; // End of string
+                hcicmdbuf[i + 3] = name[i];
+        hcicmdbuf[i + 3] = 0x00; // End of string
 
-        HCI_Command(hcibuf, 4 + strlen(name));
+        HCI_Command(hcicmdbuf, 4 + strlen(name));
 }
 
 void BTD::hci_set_event_mask() {
-        hcibuf[0] = 0x01; // HCI OCF = 01
-        hcibuf[1] = 0x03 << 2; // HCI OGF = 3
-        hcibuf[2] = 0x08;
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 11);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x01; // HCI OCF = 01
+        hcicmdbuf[1] = 0x03 << 2; // HCI OGF = 3
+        hcicmdbuf[2] = 0x08;
         // The first 6 bytes are the default of 1FFF FFFF FFFF
         // However we need to set bits 48-55 for simple pairing to work
-        hcibuf[3] = 0xFF;
-        hcibuf[4] = 0xFF;
-        hcibuf[5] = 0xFF;
-        hcibuf[6] = 0xFF;
-        hcibuf[7] = 0xFF;
-        hcibuf[8] = 0x1F;
-        hcibuf[9] = 0xFF; // Enable bits 48-55 used for simple pairing
-        hcibuf[10] = 0x00;
-
-        HCI_Command(hcibuf, 11);
+        hcicmdbuf[3] = 0xFF;
+        hcicmdbuf[4] = 0xFF;
+        hcicmdbuf[5] = 0xFF;
+        hcicmdbuf[6] = 0xFF;
+        hcicmdbuf[7] = 0xFF;
+        hcicmdbuf[8] = 0x1F;
+        hcicmdbuf[9] = 0xFF; // Enable bits 48-55 used for simple pairing
+        hcicmdbuf[10] = 0x00;
+
+        HCI_Command(hcicmdbuf, 11);
 }
 
 void BTD::hci_write_simple_pairing_mode(bool enable) {
-        hcibuf[0] = 0x56; // HCI OCF = 56
-        hcibuf[1] = 0x03 << 2; // HCI OGF = 3
-        hcibuf[2] = 1; // parameter length = 1
-        hcibuf[3] = enable ? 1 : 0;
-
-        HCI_Command(hcibuf, 4);
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 4);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x56; // HCI OCF = 56
+        hcicmdbuf[1] = 0x03 << 2; // HCI OGF = 3
+        hcicmdbuf[2] = 1; // parameter length = 1
+        hcicmdbuf[3] = enable ? 1 : 0;
+
+        HCI_Command(hcicmdbuf, 4);
 }
 
 void BTD::hci_inquiry() {
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 8);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_clear_flag(HCI_FLAG_DEVICE_FOUND);
-        hcibuf[0] = 0x01;
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x05; // Parameter Total Length = 5
-        hcibuf[3] = 0x33; // LAP: Genera/Unlimited Inquiry Access Code (GIAC = 0x9E8B33) - see https://www.bluetooth.org/Technical/AssignedNumbers/baseband.htm
-        hcibuf[4] = 0x8B;
-        hcibuf[5] = 0x9E;
-        hcibuf[6] = 0x30; // Inquiry time = 61.44 sec (maximum)
-        hcibuf[7] = 0x0A; // 10 number of responses
-
-        HCI_Command(hcibuf, 8);
+        hcicmdbuf[0] = 0x01;
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x05; // Parameter Total Length = 5
+        hcicmdbuf[3] = 0x33; // LAP: Genera/Unlimited Inquiry Access Code (GIAC = 0x9E8B33) - see https://www.bluetooth.org/Technical/AssignedNumbers/baseband.htm
+        hcicmdbuf[4] = 0x8B;
+        hcicmdbuf[5] = 0x9E;
+        hcicmdbuf[6] = 0x30; // Inquiry time = 61.44 sec (maximum)
+        hcicmdbuf[7] = 0x0A; // 10 number of responses
+
+        HCI_Command(hcicmdbuf, 8);
 }
 
 void BTD::hci_inquiry_cancel() {
-        hcibuf[0] = 0x02;
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x00; // Parameter Total Length = 0
-
-        HCI_Command(hcibuf, 3);
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 3);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x02;
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x00; // Parameter Total Length = 0
+
+        HCI_Command(hcicmdbuf, 3);
 }
 
 void BTD::hci_connect() {
@@ -1275,153 +1312,180 @@ void BTD::hci_connect() {
 }
 
 void BTD::hci_connect(uint8_t *bdaddr) {
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 16);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_clear_flag(HCI_FLAG_CONNECT_COMPLETE | HCI_FLAG_CONNECT_EVENT);
-        hcibuf[0] = 0x05; // HCI OCF = 5
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x0D; // parameter Total Length = 13
-        hcibuf[3] = bdaddr[0]; // 6 octet bdaddr (LSB)
-        hcibuf[4] = bdaddr[1];
-        hcibuf[5] = bdaddr[2];
-        hcibuf[6] = bdaddr[3];
-        hcibuf[7] = bdaddr[4];
-        hcibuf[8] = bdaddr[5];
-        hcibuf[9] = 0x18; // DM1 or DH1 may be used
-        hcibuf[10] = 0xCC; // DM3, DH3, DM5, DH5 may be used
-        hcibuf[11] = 0x01; // Page repetition mode R1
-        hcibuf[12] = 0x00; // Reserved
-        hcibuf[13] = 0x00; // Clock offset
-        hcibuf[14] = 0x00; // Invalid clock offset
-        hcibuf[15] = 0x00; // Do not allow role switch
-
-        HCI_Command(hcibuf, 16);
+        hcicmdbuf[0] = 0x05; // HCI OCF = 5
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x0D; // parameter Total Length = 13
+        hcicmdbuf[3] = bdaddr[0]; // 6 octet bdaddr (LSB)
+        hcicmdbuf[4] = bdaddr[1];
+        hcicmdbuf[5] = bdaddr[2];
+        hcicmdbuf[6] = bdaddr[3];
+        hcicmdbuf[7] = bdaddr[4];
+        hcicmdbuf[8] = bdaddr[5];
+        hcicmdbuf[9] = 0x18; // DM1 or DH1 may be used
+        hcicmdbuf[10] = 0xCC; // DM3, DH3, DM5, DH5 may be used
+        hcicmdbuf[11] = 0x01; // Page repetition mode R1
+        hcicmdbuf[12] = 0x00; // Reserved
+        hcicmdbuf[13] = 0x00; // Clock offset
+        hcicmdbuf[14] = 0x00; // Invalid clock offset
+        hcicmdbuf[15] = 0x00; // Do not allow role switch
+
+        HCI_Command(hcicmdbuf, 16);
 }
 
 void BTD::hci_pin_code_request_reply() {
-        hcibuf[0] = 0x0D; // HCI OCF = 0D
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x17; // parameter length 23
-        hcibuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
-        hcibuf[4] = disc_bdaddr[1];
-        hcibuf[5] = disc_bdaddr[2];
-        hcibuf[6] = disc_bdaddr[3];
-        hcibuf[7] = disc_bdaddr[4];
-        hcibuf[8] = disc_bdaddr[5];
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 26);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x0D; // HCI OCF = 0D
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x17; // parameter length 23
+        hcicmdbuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
+        hcicmdbuf[4] = disc_bdaddr[1];
+        hcicmdbuf[5] = disc_bdaddr[2];
+        hcicmdbuf[6] = disc_bdaddr[3];
+        hcicmdbuf[7] = disc_bdaddr[4];
+        hcicmdbuf[8] = disc_bdaddr[5];
         if(pairWithWii) {
-                hcibuf[9] = 6; // Pin length is the length of the Bluetooth address
+                hcicmdbuf[9] = 6; // Pin length is the length of the Bluetooth address
                 if(pairWiiUsingSync) {
 #ifdef DEBUG_USB_HOST
                         Notify(PSTR("\r\nPairing with Wii controller via SYNC"), 0x80);
 #endif
                         for(uint8_t i = 0; i < 6; i++)
-                                hcibuf[10 + i] = my_bdaddr[i]; // The pin is the Bluetooth dongles Bluetooth address backwards
+                                hcicmdbuf[10 + i] = my_bdaddr[i]; // The pin is the Bluetooth dongles Bluetooth address backwards
                 } else {
                         for(uint8_t i = 0; i < 6; i++)
-                                hcibuf[10 + i] = disc_bdaddr[i]; // The pin is the Wiimote's Bluetooth address backwards
+                                hcicmdbuf[10 + i] = disc_bdaddr[i]; // The pin is the Wiimote's Bluetooth address backwards
                 }
                 for(uint8_t i = 16; i < 26; i++)
-                        hcibuf[i] = 0x00; // The rest should be 0
+                        hcicmdbuf[i] = 0x00; // The rest should be 0
         } else {
-                hcibuf[9] = strlen(btdPin); // Length of pin
+                hcicmdbuf[9] = strlen(btdPin); // Length of pin
                 uint8_t i;
                 for(i = 0; i < strlen(btdPin); i++) // The maximum size of the pin is 16
-                        hcibuf[i + 10] = btdPin[i];
+                        hcicmdbuf[i + 10] = btdPin[i];
                 for(; i < 16; i++)
-                        hcibuf[i + 10] = 0x00; // The rest should be 0
+                        hcicmdbuf[i + 10] = 0x00; // The rest should be 0
         }
 
-        HCI_Command(hcibuf, 26);
+        HCI_Command(hcicmdbuf, 26);
 }
 
 void BTD::hci_pin_code_negative_request_reply() {
-        hcibuf[0] = 0x0E; // HCI OCF = 0E
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x06; // parameter length 6
-        hcibuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
-        hcibuf[4] = disc_bdaddr[1];
-        hcibuf[5] = disc_bdaddr[2];
-        hcibuf[6] = disc_bdaddr[3];
-        hcibuf[7] = disc_bdaddr[4];
-        hcibuf[8] = disc_bdaddr[5];
-
-        HCI_Command(hcibuf, 9);
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 9);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x0E; // HCI OCF = 0E
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x06; // parameter length 6
+        hcicmdbuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
+        hcicmdbuf[4] = disc_bdaddr[1];
+        hcicmdbuf[5] = disc_bdaddr[2];
+        hcicmdbuf[6] = disc_bdaddr[3];
+        hcicmdbuf[7] = disc_bdaddr[4];
+        hcicmdbuf[8] = disc_bdaddr[5];
+
+        HCI_Command(hcicmdbuf, 9);
 }
 
 void BTD::hci_link_key_request_negative_reply() {
-        hcibuf[0] = 0x0C; // HCI OCF = 0C
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x06; // parameter length 6
-        hcibuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
-        hcibuf[4] = disc_bdaddr[1];
-        hcibuf[5] = disc_bdaddr[2];
-        hcibuf[6] = disc_bdaddr[3];
-        hcibuf[7] = disc_bdaddr[4];
-        hcibuf[8] = disc_bdaddr[5];
-
-        HCI_Command(hcibuf, 9);
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 9);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x0C; // HCI OCF = 0C
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x06; // parameter length 6
+        hcicmdbuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
+        hcicmdbuf[4] = disc_bdaddr[1];
+        hcicmdbuf[5] = disc_bdaddr[2];
+        hcicmdbuf[6] = disc_bdaddr[3];
+        hcicmdbuf[7] = disc_bdaddr[4];
+        hcicmdbuf[8] = disc_bdaddr[5];
+
+        HCI_Command(hcicmdbuf, 9);
 }
 
 void BTD::hci_io_capability_request_reply() {
-        hcibuf[0] = 0x2B; // HCI OCF = 2B
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x09;
-        hcibuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
-        hcibuf[4] = disc_bdaddr[1];
-        hcibuf[5] = disc_bdaddr[2];
-        hcibuf[6] = disc_bdaddr[3];
-        hcibuf[7] = disc_bdaddr[4];
-        hcibuf[8] = disc_bdaddr[5];
-        hcibuf[9] = 0x03; // NoInputNoOutput
-        hcibuf[10] = 0x00; // OOB authentication data not present
-        hcibuf[11] = 0x00; // MITM Protection Not Required – No Bonding. Numeric comparison with automatic accept allowed
-
-        HCI_Command(hcibuf, 12);
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 12);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x2B; // HCI OCF = 2B
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x09;
+        hcicmdbuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
+        hcicmdbuf[4] = disc_bdaddr[1];
+        hcicmdbuf[5] = disc_bdaddr[2];
+        hcicmdbuf[6] = disc_bdaddr[3];
+        hcicmdbuf[7] = disc_bdaddr[4];
+        hcicmdbuf[8] = disc_bdaddr[5];
+        hcicmdbuf[9] = 0x03; // NoInputNoOutput
+        hcicmdbuf[10] = 0x00; // OOB authentication data not present
+        hcicmdbuf[11] = 0x00; // MITM Protection Not Required – No Bonding. Numeric comparison with automatic accept allowed
+
+        HCI_Command(hcicmdbuf, 12);
 }
 
 void BTD::hci_user_confirmation_request_reply() {
-        hcibuf[0] = 0x2C; // HCI OCF = 2C
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x06; // parameter length 6
-        hcibuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
-        hcibuf[4] = disc_bdaddr[1];
-        hcibuf[5] = disc_bdaddr[2];
-        hcibuf[6] = disc_bdaddr[3];
-        hcibuf[7] = disc_bdaddr[4];
-        hcibuf[8] = disc_bdaddr[5];
-
-        HCI_Command(hcibuf, 9);
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 9);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x2C; // HCI OCF = 2C
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x06; // parameter length 6
+        hcicmdbuf[3] = disc_bdaddr[0]; // 6 octet bdaddr
+        hcicmdbuf[4] = disc_bdaddr[1];
+        hcicmdbuf[5] = disc_bdaddr[2];
+        hcicmdbuf[6] = disc_bdaddr[3];
+        hcicmdbuf[7] = disc_bdaddr[4];
+        hcicmdbuf[8] = disc_bdaddr[5];
+
+        HCI_Command(hcicmdbuf, 9);
 }
 
 void BTD::hci_authentication_request() {
-        hcibuf[0] = 0x11; // HCI OCF = 11
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x02; // parameter length = 2
-        hcibuf[3] = (uint8_t)(hci_handle & 0xFF); //connection handle - low byte
-        hcibuf[4] = (uint8_t)((hci_handle >> 8) & 0x0F); //connection handle - high byte
-
-        HCI_Command(hcibuf, 5);
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 5);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x11; // HCI OCF = 11
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x02; // parameter length = 2
+        hcicmdbuf[3] = (uint8_t)(hci_handle & 0xFF); //connection handle - low byte
+        hcicmdbuf[4] = (uint8_t)((hci_handle >> 8) & 0x0F); //connection handle - high byte
+
+        HCI_Command(hcicmdbuf, 5);
 }
 
 void BTD::hci_disconnect(uint16_t handle) { // This is called by the different services
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 6);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         hci_clear_flag(HCI_FLAG_DISCONNECT_COMPLETE);
-        hcibuf[0] = 0x06; // HCI OCF = 6
-        hcibuf[1] = 0x01 << 2; // HCI OGF = 1
-        hcibuf[2] = 0x03; // parameter length = 3
-        hcibuf[3] = (uint8_t)(handle & 0xFF); //connection handle - low byte
-        hcibuf[4] = (uint8_t)((handle >> 8) & 0x0F); //connection handle - high byte
-        hcibuf[5] = 0x13; // reason
-
-        HCI_Command(hcibuf, 6);
+        hcicmdbuf[0] = 0x06; // HCI OCF = 6
+        hcicmdbuf[1] = 0x01 << 2; // HCI OGF = 1
+        hcicmdbuf[2] = 0x03; // parameter length = 3
+        hcicmdbuf[3] = (uint8_t)(handle & 0xFF); //connection handle - low byte
+        hcicmdbuf[4] = (uint8_t)((handle >> 8) & 0x0F); //connection handle - high byte
+        hcicmdbuf[5] = 0x13; // reason
+
+        HCI_Command(hcicmdbuf, 6);
 }
 
 void BTD::hci_write_class_of_device() { // See http://bluetooth-pentest.narod.ru/software/bluetooth_class_of_device-service_generator.html
-        hcibuf[0] = 0x24; // HCI OCF = 24
-        hcibuf[1] = 0x03 << 2; // HCI OGF = 3
-        hcibuf[2] = 0x03; // parameter length = 3
-        hcibuf[3] = 0x04; // Robot
-        hcibuf[4] = 0x08; // Toy
-        hcibuf[5] = 0x00;
-
-        HCI_Command(hcibuf, 6);
+        USB_SCRATCH_BUFFER(hcicmdbuf, pUsb, 6);
+        if(!hcicmdbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
+        hcicmdbuf[0] = 0x24; // HCI OCF = 24
+        hcicmdbuf[1] = 0x03 << 2; // HCI OGF = 3
+        hcicmdbuf[2] = 0x03; // parameter length = 3
+        hcicmdbuf[3] = 0x04; // Robot
+        hcicmdbuf[4] = 0x08; // Toy
+        hcicmdbuf[5] = 0x00;
+
+        HCI_Command(hcicmdbuf, 6);
 }
 /*******************************************************************
  *                                                                 *
@@ -1450,7 +1514,11 @@ void BTD::hci_write_class_of_device() { // See http://bluetooth-pentest.narod.ru
 
 /************************************************************/
 void BTD::L2CAP_Command(uint16_t handle, uint8_t* data, uint8_t nbytes, uint8_t channelLow, uint8_t channelHigh) {
-        uint8_t buf[8 + nbytes];
+        USB_SCRATCH_BUFFER(buf, pUsb, 8 + nbytes);
+        if(!buf) {
+                ErrorMessage<uint8_t > (PSTR("No room for L2CAP message"), USB_ERROR_SCRATCH_EXHAUSTED);
+                return;
+        }
         buf[0] = (uint8_t)(handle & 0xff); // HCI handle with PB,BC flag
         buf[1] = (uint8_t)(((handle >> 8) & 0x0f) | 0x20);
         buf[2] = (uint8_t)((4 + nbytes) & 0xff); // HCI ACL total data length
@@ -1478,6 +1546,9 @@ void BTD::L2CAP_Command(uint16_t handle, uint8_t* data, uint8_t nbytes, uint8_t
 }
 
 void BTD::l2cap_connection_request(uint16_t handle, uint8_t rxid, uint8_t* scid, uint16_t psm) {
+        USB_SCRATCH_BUFFER(l2capoutbuf, pUsb, 8);
+        if(!l2capoutbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         l2capoutbuf[0] = L2CAP_CMD_CONNECTION_REQUEST; // Code
         l2capoutbuf[1] = rxid; // Identifier
         l2capoutbuf[2] = 0x04; // Length
@@ -1491,6 +1562,9 @@ void BTD::l2cap_connection_request(uint16_t handle, uint8_t rxid, uint8_t* scid,
 }
 
 void BTD::l2cap_connection_response(uint16_t handle, uint8_t rxid, uint8_t* dcid, uint8_t* scid, uint8_t result) {
+        USB_SCRATCH_BUFFER(l2capoutbuf, pUsb, 12);
+        if(!l2capoutbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         l2capoutbuf[0] = L2CAP_CMD_CONNECTION_RESPONSE; // Code
         l2capoutbuf[1] = rxid; // Identifier
         l2capoutbuf[2] = 0x08; // Length
@@ -1508,6 +1582,9 @@ void BTD::l2cap_connection_response(uint16_t handle, uint8_t rxid, uint8_t* dcid
 }
 
 void BTD::l2cap_config_request(uint16_t handle, uint8_t rxid, uint8_t* dcid) {
+        USB_SCRATCH_BUFFER(l2capoutbuf, pUsb, 12);
+        if(!l2capoutbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         l2capoutbuf[0] = L2CAP_CMD_CONFIG_REQUEST; // Code
         l2capoutbuf[1] = rxid; // Identifier
         l2capoutbuf[2] = 0x08; // Length
@@ -1525,6 +1602,9 @@ void BTD::l2cap_config_request(uint16_t handle, uint8_t rxid, uint8_t* dcid) {
 }
 
 void BTD::l2cap_config_response(uint16_t handle, uint8_t rxid, uint8_t* scid) {
+        USB_SCRATCH_BUFFER(l2capoutbuf, pUsb, 14);
+        if(!l2capoutbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         l2capoutbuf[0] = L2CAP_CMD_CONFIG_RESPONSE; // Code
         l2capoutbuf[1] = rxid; // Identifier
         l2capoutbuf[2] = 0x0A; // Length
@@ -1544,6 +1624,9 @@ void BTD::l2cap_config_response(uint16_t handle, uint8_t rxid, uint8_t* scid) {
 }
 
 void BTD::l2cap_disconnection_request(uint16_t handle, uint8_t rxid, uint8_t* dcid, uint8_t* scid) {
+        USB_SCRATCH_BUFFER(l2capoutbuf, pUsb, 8);
+        if(!l2capoutbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         l2capoutbuf[0] = L2CAP_CMD_DISCONNECT_REQUEST; // Code
         l2capoutbuf[1] = rxid; // Identifier
         l2capoutbuf[2] = 0x04; // Length
@@ -1557,6 +1640,9 @@ void BTD::l2cap_disconnection_request(uint16_t handle, uint8_t rxid, uint8_t* dc
 }
 
 void BTD::l2cap_disconnection_response(uint16_t handle, uint8_t rxid, uint8_t* dcid, uint8_t* scid) {
+        USB_SCRATCH_BUFFER(l2capoutbuf, pUsb, 8);
+        if(!l2capoutbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         l2capoutbuf[0] = L2CAP_CMD_DISCONNECT_RESPONSE; // Code
         l2capoutbuf[1] = rxid; // Identifier
         l2capoutbuf[2] = 0x04; // Length
@@ -1570,6 +1656,9 @@ void BTD::l2cap_disconnection_response(uint16_t handle, uint8_t rxid, uint8_t* d
 }
 
 void BTD::l2cap_information_response(uint16_t handle, uint8_t rxid, uint8_t infoTypeLow, uint8_t infoTypeHigh) {
+        USB_SCRATCH_BUFFER(l2capoutbuf, pUsb, 12);
+        if(!l2capoutbuf)
+                return; // No room in the scratch arena, see USB::getScratchPeak()
         l2capoutbuf[0] = L2CAP_CMD_INFORMATION_RESPONSE; // Code
         l2capoutbuf[1] = rxid; // Identifier
         l2capoutbuf[2] = 0x08; // Length
@@ -263,6 +263,8 @@ public:
                 return bAddress;
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         /**
          * Used to check if the dongle has been initialized.
          * @return True if it's ready.
@@ -586,9 +588,9 @@ private:
         uint16_t hci_event_flag; // HCI flags of received Bluetooth events
         uint8_t inquiry_counter;
 
-        uint8_t hcibuf[BULK_MAXPKTSIZE]; // General purpose buffer for HCI data
+        uint8_t hcibuf[BULK_MAXPKTSIZE]; // Buffer for HCI events, which may hold a partly received event between polls
         uint8_t l2capinbuf[BULK_MAXPKTSIZE]; // General purpose buffer for L2CAP in data
-        uint8_t l2capoutbuf[14]; // General purpose buffer for L2CAP out data
+        // Outgoing HCI commands and L2CAP signalling are built in USB_SCRATCH_BUFFER() buffers
 
         /* State machines */
         void HCI_event_task(); // Poll the HCI event pipe
@@ -192,6 +192,8 @@ void MiniDSP::parseFloatReadResponse(const uint8_t * buf) {
                                 break;
                 }
         }
+        if (newOutputLevels) outputCount++;
+        if (newInputLevels) inputCount++;
         if (pFuncOnNewOutputLevels != nullptr && newOutputLevels) pFuncOnNewOutputLevels(outputLevels);
         if (pFuncOnNewInputLevels != nullptr && newInputLevels) pFuncOnNewInputLevels(inputLevels);
 }
@@ -211,13 +213,19 @@ void MiniDSP::ParseHIDData(USBHID *hid __attribute__ ((unused)), bool is_rpt_id
 
         // Check if this is a response to a direct set command
         // This is the only case in which buf[0] isn't the length of the whole message
-        if (buf[0] == 0x01) parseDirectSetResponse(buf);
+        if (buf[0] == 0x01) {
+                matchResponse(buf[1], 0);
+                parseDirectSetResponse(buf);
+        }
         
         // ... or a byte read.
         else if ((buf[1] == readByteCommand) && (buf[2] == readByteHighAddr)) parseByteReadResponse(buf);
 
         // ...or a floating point read
-        else if ((buf[1] == readFloatCommand) && (buf[2] == readFloatHighAddr)) parseFloatReadResponse(buf);
+        else if ((buf[1] == readFloatCommand) && (buf[2] == readFloatHighAddr)) {
+                matchResponse(readFloatCommand, buf[3]);
+                parseFloatReadResponse(buf);
+        }
 }; 
 
 float MiniDSP::getFloatLE(const uint8_t * buf) {
@@ -234,6 +242,12 @@ uint8_t MiniDSP::OnInitSuccessful() {
         // Request current status so we can initialize the values.
         //RequestStatus();
 
+        // Requests sent to a previous device will never be answered
+        numInFlight = 0;
+        pendingVolume = -1;
+        pendingMute = -1;
+        pendingSource = -1;
+
         if(pFuncOnInit != nullptr)
                 pFuncOnInit();
 
@@ -248,10 +262,10 @@ uint8_t MiniDSP::Checksum(const uint8_t *data, uint8_t data_length) const {
         return sum & 0xFF;
 }
 
-void MiniDSP::SendCommand(const uint8_t *command, uint8_t command_length) const {
+uint8_t MiniDSP::SendCommand(const uint8_t *command, uint8_t command_length) const {
         // Sanity check on command length.
         if(command_length > 63)
-                return;
+                return USB_ERROR_INVALID_ARGUMENT;
 
         // Message is padded to 64 bytes with 0xFF and is of format:
         // [ length (command + checksum byte) ] [ command ] [ checksum ] [ OxFF... ]
@@ -273,7 +287,110 @@ void MiniDSP::SendCommand(const uint8_t *command, uint8_t command_length) const
         // Pad the rest.
         memset(&buf[checksumOffset + 1], 0xFF, sizeof (buf) - checksumOffset - 1);
 
-        pUsb->outTransfer(bAddress, epInfo[epInterruptOutIndex].epAddr, sizeof (buf), buf);
+        return pUsb->outTransfer(bAddress, epInfo[epInterruptOutIndex].epAddr, sizeof (buf), buf);
+}
+
+bool MiniDSP::sendTracked(const uint8_t *command, uint8_t command_length) {
+        if(numInFlight >= MINIDSP_MAX_IN_FLIGHT)
+                return false;
+        if(SendCommand(command, command_length))
+                return false;
+
+        InFlight &r = inFlight[numInFlight++];
+        r.opcode = command[0];
+        r.addr = (command_length > 2) ? command[2] : 0;
+        r.time = (uint32_t)millis();
+        stats.requests++;
+        return true;
+}
+
+void MiniDSP::matchResponse(uint8_t opcode, uint8_t addr) {
+        for(uint8_t i = 0; i < numInFlight; i++) {
+                if(inFlight[i].opcode != opcode || inFlight[i].addr != addr)
+                        continue;
+                // The MiniDSP answers in order, so this is the oldest matching request
+                for(numInFlight--; i < numInFlight; i++)
+                        inFlight[i] = inFlight[i + 1];
+                stats.responses++;
+                return;
+        }
+        // Not requested by the pipeline, e.g. a report caused by the remote or a direct request
+}
+
+uint8_t MiniDSP::Poll() {
+        uint8_t rcode = HIDUniversal::Poll();
+        runPipeline();
+        return rcode;
+}
+
+void MiniDSP::runPipeline() {
+        if(!connected()) {
+                numInFlight = 0;
+                return;
+        }
+
+        uint32_t now = (uint32_t)millis();
+
+        // Requests are sent in order, so only the oldest one can have expired first
+        while(numInFlight && (int32_t)(now - inFlight[0].time) >= MINIDSP_REQUEST_TIMEOUT) {
+                for(uint8_t i = 1; i < numInFlight; i++)
+                        inFlight[i - 1] = inFlight[i];
+                numInFlight--;
+                stats.timeouts++;
+        }
+
+        if(now - qRateWindowStart >= 1000) {
+                stats.inputRate = inputCount;
+                stats.outputRate = outputCount;
+                inputCount = outputCount = 0;
+                qRateWindowStart = now;
+        }
+
+        // Set commands go before metering, so the user does not notice the pipeline
+        if(pendingVolume >= 0) {
+                const uint8_t command[] = {0x42, (uint8_t)pendingVolume};
+                if(sendTracked(command, sizeof (command)))
+                        pendingVolume = -1;
+        }
+        if(pendingMute >= 0) {
+                const uint8_t command[] = {0x17, (uint8_t)pendingMute};
+                if(sendTracked(command, sizeof (command)))
+                        pendingMute = -1;
+        }
+        if(pendingSource >= 0) {
+                const uint8_t command[] = {0x34, (uint8_t)pendingSource};
+                if(sendTracked(command, sizeof (command)))
+                        pendingSource = -1;
+        }
+
+        if(!meterInterval || (int32_t)(now - qNextMeterTime) < 0L)
+                return;
+
+        bool output = (meterLevels & MINIDSP_METER_OUTPUTS) && (meterNextOutput || !(meterLevels & MINIDSP_METER_INPUTS));
+        constexpr uint8_t RequestInputLevelsCommand[] = {0x14, 0x00, 0x44, 0x02};
+        constexpr uint8_t RequestOutputLevelsCommand[] = {0x14, 0x00, 0x4a, 0x04};
+        if(!sendTracked(output ? RequestOutputLevelsCommand : RequestInputLevelsCommand, 4))
+                return; // Try again on the next poll
+
+        meterNextOutput = !output;
+        qNextMeterTime += meterInterval;
+        if((int32_t)(now - qNextMeterTime) >= 0L)
+                qNextMeterTime = now + meterInterval; // Fell behind, do not send a burst to catch up
+}
+
+void MiniDSP::startMetering(uint8_t rate, uint8_t levels) {
+        meterLevels = levels & (MINIDSP_METER_INPUTS | MINIDSP_METER_OUTPUTS);
+        if(!rate || !meterLevels) {
+                meterInterval = 0;
+                return;
+        }
+        // Inputs and outputs take a request each
+        uint8_t requests = (meterLevels == (MINIDSP_METER_INPUTS | MINIDSP_METER_OUTPUTS)) ? 2 : 1;
+        meterInterval = 1000 / ((uint16_t)rate * requests);
+        if(!meterInterval)
+                meterInterval = 1;
+        meterNextOutput = false;
+        qNextMeterTime = (uint32_t)millis();
 }
 
 void MiniDSP::RequestStatus() const {
@@ -327,25 +444,19 @@ void MiniDSP::setVolume(float volume)
 
 void MiniDSP::setVolume(uint8_t volume)
 {
-        uint8_t buf[2];
-        buf[0] = 0x42;
-        buf[1] = volume;
-        SendCommand(buf, 2);
+        if (pendingVolume >= 0) stats.coalesced++;
+        pendingVolume = volume;
 }
 
 void MiniDSP::setMute(bool muteOn)
 {
-        uint8_t buf[2];
-        buf[0] = 0x17;
-        buf[1] = muteOn ? 0x01 : 0x00;
-        SendCommand(buf, 2);
+        if (pendingMute >= 0) stats.coalesced++;
+        pendingMute = muteOn ? 0x01 : 0x00;
 }
 
 void MiniDSP::setSource(uint8_t source)
 {
         if (source > 1) return;
-        uint8_t buf[2];
-        buf[0] = 0x34;
-        buf[1] = source;
-        SendCommand(buf, 2);
+        if (pendingSource >= 0) stats.coalesced++;
+        pendingSource = source;
 }
\ No newline at end of file
@@ -31,6 +31,30 @@
 #define MINIDSP_VID 0x2752 // MiniDSP
 #define MINIDSP_PID 0x0011 // MiniDSP 2x4HD
 
+// Number of requests which may wait for a response at the same time
+#ifndef MINIDSP_MAX_IN_FLIGHT
+#define MINIDSP_MAX_IN_FLIGHT 2
+#endif
+
+// Time in ms after which a request without a response is given up
+#ifndef MINIDSP_REQUEST_TIMEOUT
+#define MINIDSP_REQUEST_TIMEOUT 100
+#endif
+
+// Levels to query with startMetering()
+#define MINIDSP_METER_INPUTS  0x01
+#define MINIDSP_METER_OUTPUTS 0x02
+
+/** Statistics of the request pipeline. */
+struct MiniDSPStats {
+        uint32_t requests;   // Requests sent by the pipeline
+        uint32_t responses;  // Responses matched to a request
+        uint32_t timeouts;   // Requests which got no response within MINIDSP_REQUEST_TIMEOUT
+        uint32_t coalesced;  // Set commands replaced by a newer one before they were sent
+        uint16_t inputRate;  // Input level updates received during the last second
+        uint16_t outputRate; // Output level updates received during the last second
+};
+
 /**
  * Arduino MiniDSP 2x4HD USB Host Driver by Dennis Frett.
  *
@@ -51,6 +75,8 @@ public:
         MiniDSP(USB *p) : HIDUniversal(p) {
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         /**
          * Used to check if a MiniDSP 2x4HD is connected.
          * @return Returns true if it is connected.
@@ -182,6 +208,7 @@ public:
 
         /**
          * @brief Set master volume
+         * The set commands are sent from Usb.Task(). If the volume is set again before that, only the last value is sent
          * @param volume Volume in dB
          */
         void setVolume(float volume);
@@ -204,6 +231,39 @@ public:
          */
         void setSource(uint8_t source);
 
+        /**
+         * @brief Query the levels automatically from Usb.Task()
+         * Input and output levels are requested alternately, and a new request is sent while the previous one
+         * is still in flight, up to MINIDSP_MAX_IN_FLIGHT requests. The results are reported through the level callbacks.
+         * @param rate Number of times per second all selected levels are updated, 0 stops metering
+         * @param levels MINIDSP_METER_INPUTS and/or MINIDSP_METER_OUTPUTS
+         */
+        void startMetering(uint8_t rate, uint8_t levels = MINIDSP_METER_INPUTS | MINIDSP_METER_OUTPUTS);
+
+        /**
+         * @brief Stop querying the levels
+         */
+        void stopMetering() {
+                meterInterval = 0;
+        }
+
+        /**
+         * @brief Get the statistics of the request pipeline, including the effective metering rate
+         */
+        const MiniDSPStats &getStats() const {
+                return stats;
+        }
+
+        void resetStats() {
+                stats = MiniDSPStats();
+        }
+
+        /**
+         * Poll the device and run the request pipeline.
+         * Set commands and metering requests are sent from here.
+         */
+        uint8_t Poll() override;
+
         /**
          * @brief Invoke the received data callbacks only when the corresponding values have changed
          */
@@ -287,7 +347,20 @@ private:
          * @param command Buffer of the command to send.
          * @param command_length Length of the buffer.
          */
-        void SendCommand(const uint8_t *command, uint8_t command_length) const;
+        uint8_t SendCommand(const uint8_t *command, uint8_t command_length) const;
+
+        /**
+         * Send a command from the request pipeline and remember that a response is expected.
+         * @return false if the in-flight limit is reached or the transfer failed.
+         */
+        bool sendTracked(const uint8_t *command, uint8_t command_length);
+
+        /**
+         * Remove the request a response belongs to from the in-flight list.
+         */
+        void matchResponse(uint8_t opcode, uint8_t addr);
+
+        void runPipeline();
 
 
         /** 
@@ -364,4 +437,31 @@ private:
         float outputLevels[4] = { 0.0, 0.0, 0.0, 0.0 };
 
         float inputLevels[2] = { 0.0, 0.0 };
+
+        // -----------------------------------------------------------------------------
+
+        // Request pipeline.
+
+        struct InFlight {
+                uint8_t opcode;
+                uint8_t addr; // Low byte of the address for read requests, 0 for set commands
+                uint32_t time;
+        };
+        InFlight inFlight[MINIDSP_MAX_IN_FLIGHT];
+        uint8_t numInFlight = 0;
+
+        // Set commands waiting to be sent, -1 if none
+        int16_t pendingVolume = -1;
+        int8_t pendingMute = -1;
+        int8_t pendingSource = -1;
+
+        uint16_t meterInterval = 0; // Time in ms between two level requests, 0 if metering is off
+        uint8_t meterLevels = 0;
+        bool meterNextOutput = false;
+        uint32_t qNextMeterTime = 0;
+
+        uint32_t qRateWindowStart = 0;
+        uint16_t inputCount = 0;
+        uint16_t outputCount = 0;
+        MiniDSPStats stats = MiniDSPStats();
 };
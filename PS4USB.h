@@ -40,6 +40,8 @@ public:
                 PS4Parser::Reset();
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         /**
          * Used to check if a PS4 controller is connected.
          * @return Returns true if it is connected.
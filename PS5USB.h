@@ -42,6 +42,8 @@ public:
                 PS5Parser::Reset();
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         /**
          * Used to check if a PS5 controller is connected.
          * @return Returns true if it is connected.
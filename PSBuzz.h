@@ -51,6 +51,8 @@ public:
                 Reset();
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         /**
          * Used to check if a PS Buzz controller is connected.
          * @return Returns true if it is connected.
@@ -54,6 +54,8 @@ BluetoothService(p) // Pointer to BTD class instance - mandatory
         rfcomm_dcid[0] = 0x51; // 0x0051
         rfcomm_dcid[1] = 0x00;
 
+        rfcommPeak = 0;
+        sppPeak = 0;
         Reset();
 }
 
@@ -280,6 +282,8 @@ void SPP::ACLData(uint8_t* l2capinbuf) {
                                                         rfcommDataBuffer[rfcommAvailable + i] = l2capinbuf[11 + i + offset];
                                                 }
                                                 rfcommAvailable += i;
+                                                if(rfcommAvailable > rfcommPeak)
+                                                        rfcommPeak = rfcommAvailable;
 #ifdef EXTRADEBUG
                                                 Notify(PSTR("\r\nRFCOMM Data Available: "), 0x80);
                                                 Notify(rfcommAvailable, 0x80);
@@ -757,10 +761,14 @@ size_t SPP::write(const uint8_t *data, size_t size) {
 void SPP::write(const uint8_t *data, size_t size) {
 #endif
         for(uint8_t i = 0; i < size; i++) {
-                if(sppIndex >= sizeof (sppOutputBuffer) / sizeof (sppOutputBuffer[0]))
+                if(sppIndex >= sizeof (sppOutputBuffer) / sizeof (sppOutputBuffer[0])) {
+                        sppPeak = sppIndex;
                         send(); // Send the current data in the buffer
+                }
                 sppOutputBuffer[sppIndex++] = data[i]; // All the bytes are put into a buffer and then send using the send() function
         }
+        if(sppIndex > sppPeak)
+                sppPeak = sppIndex;
 #if defined(ARDUINO) && ARDUINO >=100
         return size;
 #endif
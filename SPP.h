@@ -133,6 +133,18 @@ public:
 
         /** Discard all the bytes in the buffer. */
         void discard(void);
+
+        /** @return Capacity, current and peak occupancy of the receive buffer. */
+        USBBufferUsage getRxUsage(void) {
+                USBBufferUsage u = {sizeof (rfcommDataBuffer), rfcommAvailable, rfcommPeak};
+                return u;
+        };
+
+        /** @return Capacity, current and peak occupancy of the buffer written to by print() and write(). */
+        USBBufferUsage getTxUsage(void) {
+                USBBufferUsage u = {sizeof (sppOutputBuffer), sppIndex, sppPeak};
+                return u;
+        };
         /**
          * This will send all the bytes in the buffer.
          * This is called whenever Usb.Task() is called,
@@ -194,6 +206,8 @@ private:
         uint8_t sppOutputBuffer[100]; // Create a 100 sized buffer for outgoing SPP data
         uint8_t sppIndex;
         uint8_t rfcommAvailable;
+        uint8_t rfcommPeak; // Most bytes held in rfcommDataBuffer
+        uint8_t sppPeak; // Most bytes held in sppOutputBuffer
 
         bool firstMessage; // Used to see if it's the first SDP request received
         uint8_t bytesRead; // Counter to see when it's time to send more credit
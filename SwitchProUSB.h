@@ -39,6 +39,8 @@ public:
                 SwitchProParser::Reset();
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         /**
          * Used to check if a Switch Pro controller is connected.
          * @return Returns true if it is connected.
@@ -29,7 +29,7 @@ UHS2_GPIO implements "wiring" style GPIO access. Implemented by Brian Walton bri
 /** @brief  Implement an instance of a UHS2_GPIO object
 *   @param  pUSB Pointer to a UHS2 USB object
 */
-UHS2_GPIO::UHS2_GPIO(USB *pUsb) : m_pUsb(pUsb)
+UHS2_GPIO::UHS2_GPIO(USB *pUsb) : m_pUsb(pUsb), m_nOutput(0), m_bOutputValid(false), m_nChangeMask(0), m_nInput(0), m_pFuncOnChange(NULL)
 {
 }
 
@@ -40,12 +40,7 @@ UHS2_GPIO::UHS2_GPIO(USB *pUsb) : m_pUsb(pUsb)
 void UHS2_GPIO::digitalWrite(uint8_t pin, uint8_t val) {
         if(pin > 7)
                 return;
-        uint8_t nValue = m_pUsb->gpioRdOutput();
-        uint8_t nMask = 1 << pin;
-        nValue &= (~nMask);
-        if(val)
-                nValue |= (nMask);
-        m_pUsb->gpioWr(nValue);
+        portWrite(1 << pin, val ? 0xFF : 0x00);
 }
 
 /** @brief  Read the value from a GPIO input pin
@@ -56,8 +51,7 @@ int UHS2_GPIO::digitalRead(uint8_t pin) {
         if(pin > 7)
                 return -1;
         uint8_t nMask = 1 << pin;
-        uint8_t nValue = m_pUsb->gpioRd();
-        return ((nValue & nMask)?1:0);
+        return ((portRead(nMask) & nMask)?1:0);
 }
 
 /** @brief  Read the value from a GPIO output pin
@@ -69,6 +63,112 @@ int UHS2_GPIO::digitalReadOutput(uint8_t pin) {
         if(pin > 7)
                 return -1;
         uint8_t nMask = 1 << pin;
-        uint8_t nValue = m_pUsb->gpioRdOutput();
-        return ((nValue & nMask)?1:0);
+        return ((portReadOutput() & nMask)?1:0);
+}
+
+/** @brief  Set several GPIO outputs at once
+*   @param  mask  Outputs to change, bit 0 is GPOUT0
+*   @param  value New value of the outputs in mask, other bits are ignored
+*   @note   Outputs 0-3 and 4-7 are in different registers. Only the registers which change are written,
+*           so outputs in the same nibble change at the same time
+*/
+void UHS2_GPIO::portWrite(uint8_t mask, uint8_t value) {
+        loadOutput();
+        uint8_t nValue = (m_nOutput & ~mask) | (value & mask);
+        uint8_t nChanged = nValue ^ m_nOutput;
+        m_nOutput = nValue;
+        if(nChanged & 0x0F)
+                m_pUsb->regWr(rIOPINS1, nValue & 0x0F);
+        if(nChanged & 0xF0)
+                m_pUsb->regWr(rIOPINS2, nValue >> 4);
+}
+
+/** @brief  Invert several GPIO outputs at once
+*   @param  mask Outputs to invert, bit 0 is GPOUT0
+*/
+void UHS2_GPIO::portToggle(uint8_t mask) {
+        loadOutput();
+        portWrite(mask, ~m_nOutput);
+}
+
+/** @brief  Read several GPIO inputs at once
+*   @param  mask    Inputs to read, bit 0 is GPIN0. Only the registers holding these inputs are read
+*   @retval uint8_t Value of the inputs in mask, other bits are zero
+*/
+uint8_t UHS2_GPIO::portRead(uint8_t mask) {
+        uint8_t nValue = 0;
+        if(mask & 0x0F)
+                nValue |= m_pUsb->regRd(rIOPINS1) >> 4; //GPIN0-3 are in the upper nibble
+        if(mask & 0xF0)
+                nValue |= m_pUsb->regRd(rIOPINS2) & 0xF0;
+        return (nValue & mask);
+}
+
+/** @brief  Read all GPIO outputs
+*   @retval uint8_t Value the outputs have been set to
+*   @note   Returned from the shadow copy, so no SPI transfer is needed after the first call
+*/
+uint8_t UHS2_GPIO::portReadOutput() {
+        loadOutput();
+        return m_nOutput;
+}
+
+/** @brief  Reload the shadow copy of the outputs from the MAX3421E
+*   @note   Needed if the outputs are also written with USB::gpioWr(), e.g. by Max_LCD
+*/
+void UHS2_GPIO::syncOutput() {
+        m_bOutputValid = false;
+        loadOutput();
+}
+
+void UHS2_GPIO::loadOutput() {
+        if(m_bOutputValid)
+                return;
+        m_nOutput = m_pUsb->gpioRdOutput();
+        m_bOutputValid = true;
+}
+
+/** @brief  Call a function when GPIO inputs change
+*   @param  funcOnChange Function called from Task() with the inputs which changed or pulsed and the current value of the inputs in mask.
+*                        NULL disables the notification
+*   @param  mask         Inputs to watch, bit 0 is GPIN0
+*   @note   The MAX3421E latches the edges in its GPINIRQ register, so a pulse between two calls to Task() is reported as well
+*/
+void UHS2_GPIO::attachOnChange(void (*funcOnChange)(uint8_t changed, uint8_t value), uint8_t mask) {
+        m_pFuncOnChange = funcOnChange;
+        m_nChangeMask = funcOnChange ? mask : 0;
+        m_pUsb->regWr(rGPINIEN, m_nChangeMask);
+        if(m_nChangeMask)
+                m_nInput = armChange();
+}
+
+/* The GPIN interrupts trigger on a single edge, so set the polarity to catch the opposite of the current level.
+   Returns the value of the inputs, which is stable across the polarity update */
+uint8_t UHS2_GPIO::armChange() {
+        uint8_t nValue = portRead(m_nChangeMask);
+        for(uint8_t i = 0; i < 4; i++) {
+                m_pUsb->regWr(rGPINPOL, ~nValue & m_nChangeMask); //1 = rising edge
+                m_pUsb->regWr(rGPINIRQ, m_nChangeMask); //clear edges from before the update
+                uint8_t nCheck = portRead(m_nChangeMask);
+                if(nCheck == nValue)
+                        break;
+                nValue = nCheck; //changed while the polarity was updated
+        }
+        return nValue;
+}
+
+/** @brief  Check the GPIO inputs for changes
+*   @note   Must be called in the loop when attachOnChange() is used. A single register is read unless an input has changed
+*/
+void UHS2_GPIO::Task() {
+        if(!m_pFuncOnChange)
+                return;
+        uint8_t nEdges = m_pUsb->regRd(rGPINIRQ) & m_nChangeMask;
+        if(!nEdges)
+                return;
+
+        uint8_t nPrev = m_nInput;
+        m_nInput = armChange();
+        //an input with an edge but the same value had a pulse shorter than the time between two calls
+        m_pFuncOnChange(nEdges | (m_nInput ^ nPrev), m_nInput);
 }
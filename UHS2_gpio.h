@@ -37,8 +37,33 @@ public:
         int digitalRead(uint8_t pin);
         int digitalReadOutput(uint8_t pin);
 
+        void portWrite(uint8_t mask, uint8_t value);
+        void portToggle(uint8_t mask);
+        uint8_t portRead(uint8_t mask = 0xFF);
+        uint8_t portReadOutput();
+        void syncOutput();
+
+        void portSet(uint8_t mask) {
+                portWrite(mask, 0xFF);
+        };
+
+        void portClear(uint8_t mask) {
+                portWrite(mask, 0x00);
+        };
+
+        void attachOnChange(void (*funcOnChange)(uint8_t changed, uint8_t value), uint8_t mask = 0xFF);
+        void Task();
+
 private:
+        void loadOutput();
+        uint8_t armChange();
+
         USB* m_pUsb;
+        uint8_t m_nOutput; // Shadow copy of the GPOUT register bits
+        bool m_bOutputValid; // m_nOutput has been read from the MAX3421E
+        uint8_t m_nChangeMask; // Inputs reported to m_pFuncOnChange
+        uint8_t m_nInput; // Inputs as last reported to m_pFuncOnChange
+        void (*m_pFuncOnChange)(uint8_t changed, uint8_t value);
 };
 
 #endif // __USB2_GPIO_H__
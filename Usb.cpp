@@ -21,16 +21,141 @@ e-mail   :  support@circuitsathome.com
 static uint8_t usb_error = 0;
 static uint8_t usb_task_state;
 
+#if defined(__AVR__)
+#define USB_STACK_PAINT 0xC5
+extern uint8_t __heap_start;
+extern char *__brkval;
+static uint8_t *stackPaintStart = NULL; // Lowest painted byte
+#endif
+
+/* Devices needing other workarounds than USB_QUIRKS_DEFAULT while they are configured. The last entry ends the table */
+static const USBQuirk usbQuirks[] PROGMEM = {
+        USB_QUIRKS_USER
+        // PS3 controllers need time after they get their address before they accept SET_CONFIGURATION
+        {0x054C, 0x0268, USB_QUIRK_SETTLE_AFTER_ADDRESS, 100, 0}, // DualShock 3
+        {0x054C, 0x042F, USB_QUIRK_SETTLE_AFTER_ADDRESS, 100, 0}, // Navigation controller
+        {0x054C, 0x03D5, USB_QUIRK_SETTLE_AFTER_ADDRESS, 100, 0}, // Motion controller
+        // Xbox 360 wireless receivers need time before they are reset
+        {0x045E, 0x0719, 0, 20, 0}, // Microsoft
+        {0x045E, 0x02A9, 0, 20, 0},
+        {0x045E, 0x0291, 0, 20, 0},
+        {0x1BAD, 0x0719, 0, 20, 0}, // Mad Catz
+        {0x1BAD, 0x02A9, 0, 20, 0},
+        {0x1BAD, 0x0291, 0, 20, 0},
+        {0x162E, 0x0719, 0, 20, 0}, // Joytech
+        {0x162E, 0x02A9, 0, 20, 0},
+        {0x162E, 0x0291, 0, 20, 0},
+        {0x0000, 0x0000, USB_QUIRKS_DEFAULT, 0, 0}
+};
+
 /* constructor */
-USB::USB() : bmHubPre(0) {
+USB::USB() : bmHubPre(0), bDevDescrCached(false), quirks(USB_QUIRKS_DEFAULT), addrSettle(0), configAddr(0) {
         usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE; //set up state machine
         init();
+#if USB_SCRATCH_SIZE
+        scratchUsed = 0;
+        scratchPeak = 0;
+#endif
+#if ENABLE_USB_PROFILING
+        resetProfile();
+        lastXfer.addr = 0;
+        lastXfer.ep = 0;
+        lastXfer.rcode = 0;
+        initDriver = USB_PROFILE_NO_DRIVER;
+        pFuncOnTaskStall = NULL;
+        stallThreshold = 0;
+#endif
+#if ENABLE_USB_SPI_AUTOTUNE
+        spiCheckTime = 0;
+#endif
 }
 
 /* Initialize data structures */
 void USB::init() {
         //devConfigIndex = 0;
         bmHubPre = 0;
+        for(uint8_t i = 0; i < USB_NUM_RESUMABLE_IN; i++)
+                inResume[i].pep = NULL;
+}
+
+#if ENABLE_USB_PROFILING
+void USB::resetProfile() {
+        memset(pollProfile, 0, sizeof (pollProfile));
+        memset(phaseProfile, 0, sizeof (phaseProfile));
+        for(uint8_t i = 0; i < USB_NUMDEVICES; i++)
+                pollProfile[i].min = 0xFFFFFFFF;
+        for(uint8_t i = 0; i < USB_PROFILE_PHASES; i++)
+                phaseProfile[i].min = 0xFFFFFFFF;
+}
+
+static void addToProfile(USBProfile *prof, uint32_t elapsed) {
+        prof->count++;
+        prof->total += elapsed;
+        if(elapsed < prof->min)
+                prof->min = elapsed;
+        if(elapsed > prof->max)
+                prof->max = elapsed;
+
+        uint8_t bucket = 0;
+        for(uint32_t limit = USB_PROFILE_FIRST_BUCKET; bucket < USB_PROFILE_BUCKETS - 1 && elapsed >= limit; limit <<= 2)
+                bucket++;
+        if(prof->hist[bucket] != 0xFFFF)
+                prof->hist[bucket]++;
+}
+
+/* Account a call which began at 'start' and remember it if it is the slowest of the current Task() */
+void USB::profileEnd(uint32_t start, uint8_t phase, uint8_t driver) {
+        uint32_t elapsed = (uint32_t)micros() - start;
+
+        addToProfile(&phaseProfile[phase], elapsed);
+        if(phase == USB_PROFILE_POLL)
+                addToProfile(&pollProfile[driver], elapsed);
+        else if(phase == USB_PROFILE_INIT) {
+                initDriver = driver;
+                return; // Part of the enumeration, which is accounted as a whole
+        }
+
+        if(elapsed > stall.partTime) {
+                stall.partTime = elapsed;
+                stall.phase = phase;
+                stall.driver = driver;
+                stall.lastXfer = lastXfer;
+        }
+}
+#endif
+
+void USB::paintStack() {
+#if defined(__AVR__)
+        uint8_t *p = __brkval ? (uint8_t *)__brkval : &__heap_start;
+        uint8_t *sp = (uint8_t *)SP - 32; // Keep clear of the frame of this function
+
+        stackPaintStart = p;
+        while(p < sp)
+                *p++ = USB_STACK_PAINT;
+#endif
+}
+
+uint16_t USB::getStackUnused() {
+#if defined(__AVR__)
+        const uint8_t *p = stackPaintStart;
+        uint16_t unused = 0;
+
+        if(!p)
+                return 0;
+        while(p < (uint8_t *)SP && *p++ == USB_STACK_PAINT)
+                unused++;
+        return unused;
+#else
+        return 0;
+#endif
+}
+
+/* Forget the multi-packet transfers in progress on a range of endpoints */
+void USB::clearInResume(EpInfo *first, uint8_t count) {
+        for(uint8_t i = 0; i < USB_NUM_RESUMABLE_IN; i++) {
+                if(inResume[i].pep >= first && inResume[i].pep < first + count)
+                        inResume[i].pep = NULL;
+        }
 }
 
 uint8_t USB::getUsbTaskState(void) {
@@ -123,8 +248,10 @@ uint8_t USB::SetAddress(uint8_t addr, uint8_t ep, EpInfo **ppep, uint16_t *nak_l
 /* 00       =   success         */
 
 /* 01-0f    =   non-zero HRSLT  */
+/* ff       =   time budget of all stages ran out */
 uint8_t USB::ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bRequest, uint8_t wValLo, uint8_t wValHi,
-        uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t* dataptr, USBReadParser *p) {
+        uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t* dataptr, USBReadParser *p, uint16_t timeout) {
+        uint32_t deadline = (uint32_t)millis() + (timeout ? timeout : USB_CTRL_XFER_TIMEOUT);
         bool direction = false; //request direction, IN or OUT
         uint8_t rcode;
         SETUP_PKT setup_pkt;
@@ -143,10 +270,11 @@ uint8_t USB::ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bReque
         EpInfo *pep = NULL;
         uint16_t nak_limit = 0;
 
+        profileXfer(addr, ep);
         rcode = SetAddress(addr, ep, &pep, &nak_limit);
 
         if(rcode)
-                return rcode;
+                return profileXferDone(rcode);
 
         direction = ((bmReqType & 0x80) > 0);
 
@@ -160,10 +288,10 @@ uint8_t USB::ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bReque
 
         bytesWr(rSUDFIFO, 8, (uint8_t*) & setup_pkt); //transfer to setup packet FIFO
 
-        rcode = dispatchPkt(tokSETUP, ep, nak_limit); //dispatch packet
+        rcode = dispatchPkt(tokSETUP, ep, nak_limit, deadline); //dispatch packet
 
         if(rcode) //return HRSLT if not zero
-                return ( rcode);
+                return profileXferDone(rcode);
 
         if(dataptr != NULL) //data stage, if present
         {
@@ -181,7 +309,7 @@ uint8_t USB::ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bReque
                                 uint16_t read = nbytes;
                                 //uint16_t read = (left<nbytes) ? left : nbytes;
 
-                                rcode = InTransfer(pep, nak_limit, &read, dataptr);
+                                rcode = InTransfer(pep, nak_limit, &read, dataptr, 0, deadline);
                                 if(rcode == hrTOGERR) {
                                         // yes, we flip it wrong here so that next time it is actually correct!
                                         pep->bmRcvToggle = (regRd(rHRSL) & bmSNDTOGRD) ? 0 : 1;
@@ -189,7 +317,7 @@ uint8_t USB::ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bReque
                                 }
 
                                 if(rcode)
-                                        return rcode;
+                                        return profileXferDone(rcode);
 
                                 // Invoke callback function if inTransfer completed successfully and callback function pointer is specified
                                 if(!rcode && p)
@@ -203,38 +331,45 @@ uint8_t USB::ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bReque
                 } else //OUT transfer
                 {
                         pep->bmSndToggle = 1; //bmSNDTOG1;
-                        rcode = OutTransfer(pep, nak_limit, nbytes, dataptr);
+                        rcode = OutTransfer(pep, nak_limit, nbytes, dataptr, deadline);
                 }
                 if(rcode) //return error
-                        return ( rcode);
+                        return profileXferDone(rcode);
         }
         // Status stage
-        return dispatchPkt((direction) ? tokOUTHS : tokINHS, ep, nak_limit); //GET if direction
+        return profileXferDone(dispatchPkt((direction) ? tokOUTHS : tokINHS, ep, nak_limit, deadline)); //GET if direction
 }
 
 /* IN transfer to arbitrary endpoint. Assumes PERADDR is set. Handles multiple packets if necessary. Transfers 'nbytes' bytes. */
 /* Keep sending INs and writes data to memory area pointed by 'data'                                                           */
 
 /* rcode 0 if no errors. rcode 01-0f is relayed from dispatchPkt(). Rcode f0 means RCVDAVIRQ error,
-            fe USB xfer timeout */
-uint8_t USB::inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval /*= 0*/) {
+            ff USB xfer timeout */
+uint8_t USB::inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval /*= 0*/, uint16_t timeout /*= 0*/) {
+        uint32_t deadline = (uint32_t)millis() + (timeout ? timeout : (bInterval ? USB_INT_XFER_TIMEOUT : USB_BULK_XFER_TIMEOUT));
         EpInfo *pep = NULL;
         uint16_t nak_limit = 0;
 
+        profileXfer(addr, 0x80 | ep);
         uint8_t rcode = SetAddress(addr, ep, &pep, &nak_limit);
 
         if(rcode) {
                 USBTRACE3("(USB::InTransfer) SetAddress Failed ", rcode, 0x81);
                 USBTRACE3("(USB::InTransfer) addr requested ", addr, 0x81);
                 USBTRACE3("(USB::InTransfer) ep requested ", ep, 0x81);
-                return rcode;
+                return profileXferDone(rcode);
         }
-        return InTransfer(pep, nak_limit, nbytesptr, data, bInterval);
+        return profileXferDone(InTransfer(pep, nak_limit, nbytesptr, data, bInterval, deadline));
 }
 
-uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval /*= 0*/) {
+/* When bInterval is set, a transfer of several packets is not held up until the device has the next packet.
+   If the device NAKs after the first packets, USB_ERROR_TRANSFER_IN_PROGRESS is returned and the bytes received so far are remembered.
+   The next call for the endpoint, normally on its next poll, continues the transfer, so it must pass the same buffer and length
+   and the buffer must not be used for anything else in between. If all USB_NUM_RESUMABLE_IN entries are taken, the partial data is dropped */
+uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval, uint32_t deadline) {
         uint8_t rcode = 0;
         uint8_t pktsize;
+        uint8_t resume = USB_NUM_RESUMABLE_IN; // Entry in inResume[] of this transfer
 
         uint16_t nbytes = *nbytesptr;
         //printf("Requesting %i bytes ", nbytes);
@@ -244,6 +379,17 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
         USBTRACE3("      - Requesting ", nbytes, 0x90);
 
         *nbytesptr = 0;
+        if(bInterval > 0) {
+                for(uint8_t i = 0; i < USB_NUM_RESUMABLE_IN; i++) {
+                        if(inResume[i].pep == pep) {
+                                resume = i;
+                                *nbytesptr = inResume[i].offset;
+                                data += inResume[i].offset;
+                                USBTRACE3("      - Resuming at ", *nbytesptr, 0x90);
+                                break;
+                        }
+                }
+        }
         regWr(rHCTL, (pep->bmRcvToggle) ? bmRCVTOG1 : bmRCVTOG0); //set toggle value
 
         // use a 'break' to exit this loop
@@ -251,13 +397,31 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
 #if defined(ESP8266) || defined(ESP32)
                         yield(); // needed in order to reset the watchdog timer on the ESP8266
 #endif
-                rcode = dispatchPkt(tokIN, pep->epAddr, nak_limit); //IN packet to EP-'endpoint'. Function takes care of NAKS.
+                rcode = dispatchPkt(tokIN, pep->epAddr, nak_limit, deadline); //IN packet to EP-'endpoint'. Function takes care of NAKS.
                 if(rcode == hrTOGERR) {
                         // yes, we flip it wrong here so that next time it is actually correct!
                         pep->bmRcvToggle = (regRd(rHRSL) & bmRCVTOGRD) ? 0 : 1;
                         regWr(rHCTL, (pep->bmRcvToggle) ? bmRCVTOG1 : bmRCVTOG0); //set toggle value
                         continue;
                 }
+                if(rcode == hrNAK && bInterval > 0 && *nbytesptr > 0) {
+                        // The rest of the transfer is sent on a later poll of the endpoint
+                        if(resume == USB_NUM_RESUMABLE_IN) {
+                                for(uint8_t i = 0; i < USB_NUM_RESUMABLE_IN; i++) {
+                                        if(!inResume[i].pep) {
+                                                resume = i;
+                                                inResume[i].pep = pep;
+                                                break;
+                                        }
+                                }
+                        }
+                        pep->bmRcvToggle = ((regRd(rHRSL) & bmRCVTOGRD)) ? 1 : 0;
+                        if(resume < USB_NUM_RESUMABLE_IN)
+                                inResume[resume].offset = *nbytesptr;
+                        else
+                                USBTRACE("      - No free resume entry, increase USB_NUM_RESUMABLE_IN\r\n"); // The next call starts a new transfer, so the partial data is lost
+                        return USB_ERROR_TRANSFER_IN_PROGRESS;
+                }
                 if(rcode) {
                         //printf(">>>>>>>> Problem! dispatchPkt %2.2x\r\n", rcode);
                         break; //should be 0, indicating ACK. Else return error code.
@@ -271,6 +435,7 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
                 if((regRd(rHIRQ) & bmRCVDAVIRQ) == 0) {
                         //printf(">>>>>>>> Problem! NO RCVDAVIRQ!\r\n");
                         rcode = 0xf0; //receive error
+                        spiFault();
                         break;
                 }
                 pktsize = regRd(rRCVBC); //number of received bytes
@@ -289,10 +454,10 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
                 if(mem_left < 0)
                         mem_left = 0;
 
-                data = bytesRd(rRCVFIFO, ((pktsize > mem_left) ? mem_left : pktsize), data);
+                data = bytesRdAsync(rRCVFIFO, ((pktsize > mem_left) ? mem_left : pktsize), data);
+                *nbytesptr += pktsize; // add this packet's byte count to total transfer length, while the FIFO is being read
 
-                regWr(rHIRQ, bmRCVDAVIRQ); // Clear the IRQ & free the buffer
-                *nbytesptr += pktsize; // add this packet's byte count to total transfer length
+                regWr(rHIRQ, bmRCVDAVIRQ); // Clear the IRQ & free the buffer, which waits for the read to finish
 
                 USBTRACE3("      - Got ", pktsize, 0x90);
 
@@ -306,9 +471,11 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
                         //printf("\r\n");
                         rcode = 0;
                         break;
-                } else if(bInterval > 0)
-                        delay(bInterval); // Delay according to polling interval
+                }
         } //while( 1 )
+
+        if(resume < USB_NUM_RESUMABLE_IN)
+                inResume[resume].pep = NULL; // Completed or failed
         
         USBTRACE3("      - Total ", *nbytesptr, 0x90);
 
@@ -316,22 +483,25 @@ uint8_t USB::InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, ui
 }
 
 /* OUT transfer to arbitrary endpoint. Handles multiple packets if necessary. Transfers 'nbytes' bytes. */
+/* A zero length packet is sent if 'nbytes' is 0                                */
 /* Handles NAK bug per Maxim Application Note 4000 for single buffer transfer   */
 
-/* rcode 0 if no errors. rcode 01-0f is relayed from HRSL                       */
-uint8_t USB::outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data) {
+/* rcode 0 if no errors. rcode 01-0f is relayed from HRSL, ff USB xfer timeout  */
+uint8_t USB::outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, uint16_t timeout /*= 0*/) {
+        uint32_t deadline = (uint32_t)millis() + (timeout ? timeout : USB_BULK_XFER_TIMEOUT);
         EpInfo *pep = NULL;
         uint16_t nak_limit = 0;
 
+        profileXfer(addr, ep);
         uint8_t rcode = SetAddress(addr, ep, &pep, &nak_limit);
 
         if(rcode)
-                return rcode;
+                return profileXferDone(rcode);
 
-        return OutTransfer(pep, nak_limit, nbytes, data);
+        return profileXferDone(OutTransfer(pep, nak_limit, nbytes, data, deadline));
 }
 
-uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8_t *data) {
+uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8_t *data, uint32_t deadline) {
         uint8_t rcode = hrSUCCESS, retry_count;
         uint8_t *data_p = data; //local copy of the data pointer
         uint16_t bytes_tosend, nak_count;
@@ -342,18 +512,20 @@ uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8
         if(maxpktsize < 1 || maxpktsize > 64)
                 return USB_ERROR_INVALID_MAX_PKT_SIZE;
 
-        uint32_t timeout = (uint32_t)millis() + USB_XFER_TIMEOUT;
+        bool zlp = (nbytes == 0); // A transfer of zero bytes sends a single zero length packet
 
         regWr(rHCTL, (pep->bmSndToggle) ? bmSNDTOG1 : bmSNDTOG0); //set toggle value
 
-        while(bytes_left) {
+        while(bytes_left || zlp) {
 #if defined(ESP8266) || defined(ESP32)
                         yield(); // needed in order to reset the watchdog timer on the ESP8266
 #endif
+                zlp = false;
                 retry_count = 0;
                 nak_count = 0;
                 bytes_tosend = (bytes_left >= maxpktsize) ? maxpktsize : bytes_left;
-                bytesWr(rSNDFIFO, bytes_tosend, data_p); //filling output FIFO
+                if(bytes_tosend)
+                        bytesWrAsync(rSNDFIFO, bytes_tosend, data_p); //filling output FIFO, the next register write waits for it
                 regWr(rSNDBC, bytes_tosend); //set number of bytes
                 regWr(rHXFR, (tokOUT | pep->epAddr)); //dispatch packet
                 while(!(regRd(rHIRQ) & bmHXFRDNIRQ)){
@@ -364,7 +536,7 @@ uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8
                 regWr(rHIRQ, bmHXFRDNIRQ); //clear IRQ
                 rcode = (regRd(rHRSL) & 0x0f);
 
-                while(rcode && ((int32_t)((uint32_t)millis() - timeout) < 0L)) {
+                while(rcode && ((int32_t)((uint32_t)millis() - deadline) < 0L)) {
 #if defined(ESP8266) || defined(ESP32)
                         yield(); // needed in order to reset the watchdog timer on the ESP8266
 #endif
@@ -392,7 +564,8 @@ uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8
 
                         /* process NAK according to Host out NAK bug */
                         regWr(rSNDBC, 0);
-                        regWr(rSNDFIFO, *data_p);
+                        if(bytes_tosend)
+                                regWr(rSNDFIFO, *data_p);
                         regWr(rSNDBC, bytes_tosend);
                         regWr(rHXFR, (tokOUT | pep->epAddr)); //dispatch packet
                         while(!(regRd(rHIRQ) & bmHXFRDNIRQ)){
@@ -403,6 +576,11 @@ uint8_t USB::OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8
                         regWr(rHIRQ, bmHXFRDNIRQ); //clear IRQ
                         rcode = (regRd(rHRSL) & 0x0f);
                 }//while( rcode && ....
+                if(rcode) {
+                        // Still NAKed when the time budget ran out
+                        rcode = USB_ERROR_TRANSFER_TIMEOUT;
+                        goto breakout;
+                }
                 bytes_left -= bytes_tosend;
                 data_p += bytes_tosend;
         }//while( bytes_left...
@@ -418,12 +596,11 @@ breakout:
 }
 /* dispatch USB packet. Assumes peripheral address is set and relevant buffer is loaded/empty       */
 /* If NAK, tries to re-send up to nak_limit times                                                   */
-/* If nak_limit == 0, do not count NAKs, exit after timeout                                         */
+/* If nak_limit == 0, do not count NAKs, exit at the deadline                                       */
 /* If bus timeout, re-sends up to USB_RETRY_LIMIT times                                             */
 
-/* return codes 0x00-0x0f are HRSLT( 0x00 being success ), 0xff means timeout                       */
-uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
-        uint32_t timeout = (uint32_t)millis() + USB_XFER_TIMEOUT;
+/* return codes 0x00-0x0f are HRSLT( 0x00 being success ), 0xff means the deadline has passed        */
+uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit, uint32_t deadline) {
         uint8_t tmpdata;
         uint8_t rcode = hrSUCCESS;
         uint8_t retry_count = 0;
@@ -434,14 +611,14 @@ uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
         USBTRACE3("   - ep ", ep, 0x90);
         USBTRACE3("   - NAK limit ", nak_limit, 0x90);
 
-        while((int32_t)((uint32_t)millis() - timeout) < 0L) {
+        while((int32_t)((uint32_t)millis() - deadline) < 0L) {
 #if defined(ESP8266) || defined(ESP32)
                         yield(); // needed in order to reset the watchdog timer on the ESP8266
 #endif
                 regWr(rHXFR, (token | ep)); //launch the transfer
                 rcode = USB_ERROR_TRANSFER_TIMEOUT;
 
-                while((int32_t)((uint32_t)millis() - timeout) < 0L) //wait for transfer completion
+                while((int32_t)((uint32_t)millis() - deadline) < 0L) //wait for transfer completion
                 {
 #if defined(ESP8266) || defined(ESP32)
                         yield(); // needed in order to reset the watchdog timer on the ESP8266
@@ -454,10 +631,10 @@ uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
                                 break;
                         }//if( tmpdata & bmHXFRDNIRQ
 
-                }//while ( millis() < timeout
+                }//while ( millis() < deadline
 
-                //if (rcode != 0x00) //exit if timeout
-                //        return ( rcode);
+                if(rcode != 0x00) //exit if timeout
+                        return ( rcode);
 
                 rcode = (regRd(rHRSL) & 0x0f); //analyze transfer result
 
@@ -476,8 +653,8 @@ uint8_t USB::dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
                                 return (rcode);
                 }//switch( rcode
 
-        }//while( timeout > millis()
-        return ( rcode);
+        }//while( deadline > millis()
+        return USB_ERROR_TRANSFER_TIMEOUT; // Retried until the deadline, so this is not reported as hrNAK
 }
 
 /* USB main task. Performs enumeration/cleanup */
@@ -488,6 +665,18 @@ void USB::Task(void) //USB state machine
         static uint32_t delay = 0;
         //USB_DEVICE_DESCRIPTOR buf;
         bool lowspeed = false;
+#if ENABLE_USB_PROFILING
+        uint32_t taskStart = (uint32_t)micros();
+        stall.partTime = 0;
+#endif
+        uint32_t start;
+
+#if ENABLE_USB_SPI_AUTOTUNE
+        if((int32_t)((uint32_t)millis() - spiCheckTime) >= 0L) {
+                spiCheckTime = (uint32_t)millis() + USB_SPI_CHECK_INTERVAL;
+                checkSpi(); // Between transfers, so the peripheral address register may be used
+        }
+#endif
 
         MAX3421E::Task();
 
@@ -517,16 +706,22 @@ void USB::Task(void) //USB state machine
         }// switch( tmpdata
 
         for(uint8_t i = 0; i < USB_NUMDEVICES; i++)
-                if(devConfig[i])
+                if(devConfig[i]) {
+                        start = profileStart();
                         rcode = devConfig[i]->Poll();
+                        profileEnd(start, USB_PROFILE_POLL, i);
+                }
 
         switch(usb_task_state) {
                 case USB_DETACHED_SUBSTATE_INITIALIZE:
                         init();
 
                         for(uint8_t i = 0; i < USB_NUMDEVICES; i++)
-                                if(devConfig[i])
+                                if(devConfig[i]) {
+                                        start = profileStart();
                                         rcode = devConfig[i]->Release();
+                                        profileEnd(start, USB_PROFILE_RELEASE, i);
+                                }
 
                         usb_task_state = USB_DETACHED_SUBSTATE_WAIT_FOR_DEVICE;
                         break;
@@ -571,7 +766,14 @@ void USB::Task(void) //USB state machine
                         //Serial.print("\r\nConf.LS: ");
                         //Serial.println(lowspeed, HEX);
 
+#if ENABLE_USB_PROFILING
+                        initDriver = USB_PROFILE_NO_DRIVER;
+#endif
+                        start = profileStart();
                         rcode = Configuring(0, 0, lowspeed);
+#if ENABLE_USB_PROFILING
+                        profileEnd(start, USB_PROFILE_ENUM, initDriver);
+#endif
 
                         if(rcode) {
                                 if(rcode != USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE) {
@@ -587,10 +789,31 @@ void USB::Task(void) //USB state machine
                         //MAX3421E::Init();
                         break;
         } // switch( usb_task_state )
+
+#if ENABLE_USB_PROFILING
+        stall.taskTime = (uint32_t)micros() - taskStart;
+        if(pFuncOnTaskStall && stall.taskTime >= stallThreshold) {
+                stall.pDriver = (stall.driver < USB_NUMDEVICES) ? devConfig[stall.driver] : NULL;
+                if(!stall.partTime) {
+                        // Nothing was called, the time went into the core itself
+                        stall.phase = USB_PROFILE_POLL;
+                        stall.driver = USB_PROFILE_NO_DRIVER;
+                        stall.pDriver = NULL;
+                        stall.lastXfer = lastXfer;
+                }
+                pFuncOnTaskStall(&stall);
+        }
+#endif
 }
 
 uint8_t USB::DefaultAddressing(uint8_t parent, uint8_t port, bool lowspeed) {
-        //uint8_t                buf[12];
+        uint8_t bAddress;
+
+        return AssignAddress(parent, port, lowspeed, &bAddress);
+};
+
+/* Move the device at address 0 to a newly allocated address. The caller frees it if the device ends up unused */
+uint8_t USB::AssignAddress(uint8_t parent, uint8_t port, bool lowspeed, uint8_t *addr) {
         uint8_t rcode;
         UsbDevice *p0 = NULL, *p = NULL;
 
@@ -620,53 +843,66 @@ uint8_t USB::DefaultAddressing(uint8_t parent, uint8_t port, bool lowspeed) {
 
         // Assign new address to the device
         rcode = setAddr(0, 0, bAddress);
+        p0->lowspeed = false;
 
         if(rcode) {
                 addrPool.FreeAddress(bAddress);
-                bAddress = 0;
                 return rcode;
         }
+        *addr = bAddress;
         return 0;
-};
+}
+
+/* Reset the port of a device, which returns it to address 0 */
+void USB::ResetDevice(uint8_t parent, uint8_t port) {
+        if(parent == 0) {
+                // Send a bus reset on the root interface.
+                regWr(rHCTL, bmBUSRST); //issue bus reset
+                delay(102); // delay 102ms, compensate for clock inaccuracy.
+        } else {
+                // reset parent port
+                devConfig[parent]->ResetHubPort(port);
+        }
+}
 
 uint8_t USB::AttemptConfig(uint8_t driver, uint8_t parent, uint8_t port, bool lowspeed) {
         //printf("AttemptConfig: parent = %i, port = %i\r\n", parent, port);
         uint8_t retries = 0;
 
 again:
+        uint32_t start = profileStart();
         uint8_t rcode = devConfig[driver]->ConfigureDevice(parent, port, lowspeed);
-        if(rcode == USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET) {
-                if(parent == 0) {
-                        // Send a bus reset on the root interface.
-                        regWr(rHCTL, bmBUSRST); //issue bus reset
-                        delay(102); // delay 102ms, compensate for clock inaccuracy.
-                } else {
-                        // reset parent port
-                        devConfig[parent]->ResetHubPort(port);
-                }
-        } else if(rcode == hrJERR && retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
+        if(rcode == USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET || (!rcode && (quirks & USB_QUIRK_RESET_BEFORE_ADDRESS))) {
+                ResetDevice(parent, port);
+        } else if(rcode == hrJERR && (quirks & USB_QUIRK_RETRY_JERR) && retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
                 delay(100);
                 retries++;
                 goto again;
         } else if(rcode)
                 return rcode;
 
+        if(devConfig[driver]->CoreAddressing()) {
+                rcode = AssignAddress(parent, port, lowspeed, &configAddr);
+                if(rcode)
+                        return rcode;
+        }
+
         rcode = devConfig[driver]->Init(parent, port, lowspeed);
-        if(rcode == hrJERR && retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
+        profileEnd(start, USB_PROFILE_INIT, driver);
+        if(rcode && configAddr)
+                addrPool.FreeAddress(configAddr); // Nothing happens if the driver already did so in Release()
+        configAddr = 0;
+        if(rcode == hrJERR && (quirks & USB_QUIRK_RETRY_JERR) && retries < 3) { // Some devices returns this when plugged in - trying to initialize the device again usually works
+                if(devConfig[driver]->CoreAddressing())
+                        ResetDevice(parent, port); // Back to address 0 for the next attempt
                 delay(100);
                 retries++;
                 goto again;
         }
         if(rcode) {
-                // Issue a bus reset, because the device may be in a limbo state
-                if(parent == 0) {
-                        // Send a bus reset on the root interface.
-                        regWr(rHCTL, bmBUSRST); //issue bus reset
-                        delay(102); // delay 102ms, compensate for clock inaccuracy.
-                } else {
-                        // reset parent port
-                        devConfig[parent]->ResetHubPort(port);
-                }
+                // Issue a bus reset, because the device may be in a limbo state.
+                // This is needed after a STALL too, as the driver has released the address the device still answers on
+                ResetDevice(parent, port);
         }
         return rcode;
 }
@@ -747,6 +983,7 @@ uint8_t USB::Configuring(uint8_t parent, uint8_t port, bool lowspeed) {
 
         p->lowspeed = lowspeed;
         // Get device descriptor
+        bDevDescrCached = false;
         rcode = getDevDescr(0, 0, sizeof (USB_DEVICE_DESCRIPTOR), (uint8_t*)buf);
 
         // Restore p->epinfo
@@ -757,6 +994,20 @@ uint8_t USB::Configuring(uint8_t parent, uint8_t port, bool lowspeed) {
                 return rcode;
         }
 
+        USBQuirk quirk;
+        getQuirk(udd->idVendor, udd->idProduct, &quirk);
+        quirks = quirk.flags;
+        if(quirk.maxPktSize0)
+                udd->bMaxPacketSize0 = quirk.maxPktSize0;
+        if(quirk.flags & USB_QUIRK_SETTLE_AFTER_ADDRESS)
+                addrSettle = quirk.settle;
+        else if(quirk.settle)
+                delay(quirk.settle);
+
+        // The drivers get this copy when they read the descriptor at address 0
+        memcpy(&devDescr, buf, sizeof (devDescr));
+        bDevDescrCached = true;
+
         // to-do?
         // Allocate new address according to device class
         //bAddress = addrPool.AllocAddress(parent, false, port);
@@ -782,6 +1033,9 @@ uint8_t USB::Configuring(uint8_t parent, uint8_t port, bool lowspeed) {
         }
 
         if(devConfigIndex < USB_NUMDEVICES) {
+                bDevDescrCached = false;
+                quirks = USB_QUIRKS_DEFAULT;
+                addrSettle = 0;
                 return rcode;
         }
 
@@ -800,23 +1054,47 @@ uint8_t USB::Configuring(uint8_t parent, uint8_t port, bool lowspeed) {
                         //                next time the program gets here
                         //if (rcode != USB_DEV_CONFIG_ERROR_DEVICE_INIT_INCOMPLETE)
                         //        devConfigIndex = 0;
+                        bDevDescrCached = false;
+                        quirks = USB_QUIRKS_DEFAULT;
+                        addrSettle = 0;
                         return rcode;
                 }
         }
+        bDevDescrCached = false;
         // if we get here that means that the device class is not supported by any of registered classes
         rcode = DefaultAddressing(parent, port, lowspeed);
+        quirks = USB_QUIRKS_DEFAULT;
+        addrSettle = 0;
 
         return rcode;
 }
 
+bool USB::getQuirk(uint16_t vid, uint16_t pid, USBQuirk *quirk) {
+        for(const USBQuirk *q = usbQuirks;; q++) {
+                memcpy_P(quirk, q, sizeof (USBQuirk));
+                if(!quirk->vid && !quirk->pid)
+                        return false; // End of the table, which holds the defaults
+                if(quirk->vid == vid && (quirk->pid == pid || quirk->pid == USB_QUIRK_ANY_PID))
+                        return true;
+        }
+}
+
 uint8_t USB::ReleaseDevice(uint8_t addr) {
         if(!addr)
                 return 0;
 
+        UsbDevice *p = addrPool.GetUsbDevicePtr(addr);
+        if(p && p->epinfo)
+                clearInResume(p->epinfo, p->epcount);
+
         for(uint8_t i = 0; i < USB_NUMDEVICES; i++) {
                 if(!devConfig[i]) continue;
-                if(devConfig[i]->GetAddress() == addr)
-                        return devConfig[i]->Release();
+                if(devConfig[i]->GetAddress() == addr) {
+                        uint32_t start = profileStart();
+                        uint8_t rcode = devConfig[i]->Release();
+                        profileEnd(start, USB_PROFILE_RELEASE, i);
+                        return rcode;
+                }
         }
         return 0;
 }
@@ -825,6 +1103,11 @@ uint8_t USB::ReleaseDevice(uint8_t addr) {
 //get device descriptor
 
 uint8_t USB::getDevDescr(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* dataptr) {
+        if(addr == 0 && bDevDescrCached) {
+                // Read by Configuring() already
+                memcpy(dataptr, &devDescr, (nbytes < sizeof (devDescr)) ? nbytes : sizeof (devDescr));
+                return 0;
+        }
         return ( ctrlReq(addr, ep, bmREQ_GET_DESCR, USB_REQUEST_GET_DESCRIPTOR, 0x00, USB_DESCRIPTOR_DEVICE, 0x0000, nbytes, nbytes, dataptr, NULL));
 }
 //get configuration descriptor
@@ -834,14 +1117,17 @@ uint8_t USB::getConfDescr(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t con
 }
 
 /* Requests Configuration Descriptor. Sends two Get Conf Descr requests. The first one gets the total length of all descriptors, then the second one requests this
- total length. The length of the first request can be shorter ( 4 bytes ), however, there are devices which won't work unless this length is set to 9 */
+ total length. The length of the first request can be shorter ( 4 bytes ), however, there are devices which won't work unless this length is set to 9,
+ so 4 bytes are only requested if USB_QUIRK_LONG_CONFIG_READ is not set for the device */
 uint8_t USB::getConfDescr(uint8_t addr, uint8_t ep, uint8_t conf, USBReadParser *p) {
         const uint8_t bufSize = 64;
         //const uint16_t bufSize = 512;
-        uint8_t buf[bufSize];
-        USB_CONFIGURATION_DESCRIPTOR *ucd = reinterpret_cast<USB_CONFIGURATION_DESCRIPTOR *>(buf);
+        USB_SCRATCH_BUFFER(buf, this, bufSize);
+        if(!buf)
+                return USB_ERROR_SCRATCH_EXHAUSTED;
+        USB_CONFIGURATION_DESCRIPTOR *ucd = reinterpret_cast<USB_CONFIGURATION_DESCRIPTOR *>((uint8_t *)buf);
 
-        uint8_t ret = getConfDescr(addr, ep, 9, conf, buf);
+        uint8_t ret = getConfDescr(addr, ep, (quirks & USB_QUIRK_LONG_CONFIG_READ) ? 9 : 4, conf, buf);
 
         if(ret)
                 return ret;
@@ -862,8 +1148,9 @@ uint8_t USB::getStrDescr(uint8_t addr, uint8_t ep, uint16_t ns, uint8_t index, u
 
 uint8_t USB::setAddr(uint8_t oldaddr, uint8_t ep, uint8_t newaddr) {
         uint8_t rcode = ctrlReq(oldaddr, ep, bmREQ_SET, USB_REQUEST_SET_ADDRESS, newaddr, 0x00, 0x0000, 0x0000, 0x0000, NULL, NULL);
-        //delay(2); //per USB 2.0 sect.9.2.6.3
-        delay(300); // Older spec says you should wait at least 200ms
+        delay(USB_SET_ADDRESS_RECOVERY); // The only wait needed before the device answers at the new address
+        if(newaddr && addrSettle)
+                delay(addrSettle); // Devices listed with USB_QUIRK_SETTLE_AFTER_ADDRESS need more
         return rcode;
         //return ( ctrlReq(oldaddr, ep, bmREQ_SET, USB_REQUEST_SET_ADDRESS, newaddr, 0x00, 0x0000, 0x0000, 0x0000, NULL, NULL));
 }
@@ -873,4 +1160,43 @@ uint8_t USB::setConf(uint8_t addr, uint8_t ep, uint8_t conf_value) {
         return ( ctrlReq(addr, ep, bmREQ_SET, USB_REQUEST_SET_CONFIGURATION, conf_value, 0x00, 0x0000, 0x0000, 0x0000, NULL, NULL));
 }
 
+//clear endpoint halt
+
+uint8_t USB::clearEpHalt(uint8_t addr, EpInfo *pep, bool in) {
+        uint8_t rcode;
+        uint8_t retries = 0;
+
+        if(!pep)
+                return USB_ERROR_EPINFO_IS_NULL;
+
+        uint8_t ep = in ? (0x80 | pep->epAddr) : pep->epAddr;
+        while((rcode = ctrlReq(addr, 0, bmREQ_CLEAR_EP, USB_REQUEST_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, 0x00, ep, 0x0000, 0x0000, NULL, NULL)) == hrBUSY && ++retries < USB_RETRY_LIMIT)
+                delay(6);
+        if(rcode)
+                return rcode;
+
+        // The device restarts the endpoint at DATA0. The entry is passed in, as IN and OUT endpoints may share the same number
+        if(in) {
+                pep->bmRcvToggle = 0;
+                clearInResume(pep, 1);
+        } else
+                pep->bmSndToggle = 0;
+        return 0;
+}
+
+bool USB::recoverEp(uint8_t addr, EpInfo *pep, bool in, uint8_t rcode) {
+        switch(rcode) {
+                case hrSUCCESS:
+                case hrNAK:
+                case USB_ERROR_TRANSFER_TIMEOUT: // The device kept NAKing, so it is busy rather than gone
+                case USB_ERROR_TRANSFER_IN_PROGRESS:
+                        return true;
+                case hrSTALL:
+                        USBTRACE2("\r\nClearing halt of EP: ", pep->epAddr);
+                        return (clearEpHalt(addr, pep, in) == 0);
+                default:
+                        return false;
+        }
+}
+
 #endif // defined(USB_METHODS_INLINE)
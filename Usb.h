@@ -40,9 +40,11 @@ e-mail   :  support@circuitsathome.com
 #include "address.h"
 #include "avrpins.h"
 #include "usb_ch9.h"
+#include "usb_spi.h"
 #include "usbhost.h"
 #include "UsbCore.h"
 #include "parsetools.h"
 #include "confdescparser.h"
+#include "usb_ringbuf.h"
 
 #endif //_usb_h_
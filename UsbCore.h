@@ -61,6 +61,7 @@ typedef MAX3421e<P1, P0> MAX3421E;  // As wired for Amp Controller
 #define bmREQ_GET_DESCR     USB_SETUP_DEVICE_TO_HOST|USB_SETUP_TYPE_STANDARD|USB_SETUP_RECIPIENT_DEVICE     //get descriptor request type
 #define bmREQ_SET           USB_SETUP_HOST_TO_DEVICE|USB_SETUP_TYPE_STANDARD|USB_SETUP_RECIPIENT_DEVICE     //set request type for all but 'set feature' and 'set interface'
 #define bmREQ_CL_GET_INTF   USB_SETUP_DEVICE_TO_HOST|USB_SETUP_TYPE_CLASS|USB_SETUP_RECIPIENT_INTERFACE     //get interface request type
+#define bmREQ_CLEAR_EP      USB_SETUP_HOST_TO_DEVICE|USB_SETUP_TYPE_STANDARD|USB_SETUP_RECIPIENT_ENDPOINT   //clear endpoint feature request type
 
 // D7           data transfer direction (0 - host-to-device, 1 - device-to-host)
 // D6-5         Type (0- standard, 1 - class, 2 - vendor, 3 - reserved)
@@ -99,18 +100,73 @@ typedef MAX3421e<P1, P0> MAX3421E;  // As wired for Amp Controller
 #define USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE         0xD9
 #define USB_ERROR_INVALID_MAX_PKT_SIZE                  0xDA
 #define USB_ERROR_EP_NOT_FOUND_IN_TBL                   0xDB
+#define USB_ERROR_TRANSFER_IN_PROGRESS                  0xDC    // Part of a multi-packet interrupt IN transfer was received, call again to resume it
+#define USB_ERROR_SCRATCH_EXHAUSTED                     0xDD    // Not enough room in the scratch arena, increase USB_SCRATCH_SIZE
 #define USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET      0xE0
 #define USB_ERROR_FailGetDevDescr                       0xE1
 #define USB_ERROR_FailSetDevTblEntry                    0xE2
 #define USB_ERROR_FailGetConfDescr                      0xE3
-#define USB_ERROR_TRANSFER_TIMEOUT                      0xFF
+#define USB_ERROR_TRANSFER_TIMEOUT                      0xFF    // The time budget of the transfer ran out, while hrNAK means the NAK limit of the endpoint was reached
 
 #define USB_XFER_TIMEOUT        5000    // (5000) USB transfer timeout in milliseconds, per section 9.2.6.1 of USB 2.0 spec
+
+// Default time budgets in milliseconds of a whole transfer, used when a transfer function is called with a timeout of 0
+#ifndef USB_CTRL_XFER_TIMEOUT
+#define USB_CTRL_XFER_TIMEOUT   USB_XFER_TIMEOUT // Control transfers, all stages included
+#endif
+#ifndef USB_BULK_XFER_TIMEOUT
+#define USB_BULK_XFER_TIMEOUT   USB_XFER_TIMEOUT // inTransfer() without bInterval and outTransfer()
+#endif
+#ifndef USB_POLL_TX_TIMEOUT
+#define USB_POLL_TX_TIMEOUT     2       // Time budget of sending buffered data from Poll(), so a device which stops reading does not hold up Task()
+#endif
+#ifndef USB_INT_XFER_TIMEOUT
+#define USB_INT_XFER_TIMEOUT    100     // inTransfer() with bInterval set, which is used to poll interrupt endpoints
+#endif
 //#define USB_NAK_LIMIT         32000   // NAK limit for a transfer. 0 means NAKs are not counted
 #define USB_RETRY_LIMIT         3       // 3 retry limit for a transfer
 #define USB_SETTLE_DELAY        200     // settle delay in milliseconds
+#ifndef USB_SET_ADDRESS_RECOVERY
+#define USB_SET_ADDRESS_RECOVERY 20     // time in milliseconds the device gets after SET_ADDRESS, at least 2 ms per section 9.2.6.3 of USB 2.0 spec
+#endif
 
 #define USB_NUMDEVICES          16      //number of USB devices
+
+// Size in bytes of the arena the drivers take temporary transfer buffers from, see USBScratch. The largest users need 72 bytes at the same time
+// Set it to 0 to put these buffers on the stack instead. This is the default on AVR, where the arena would permanently take RAM the stack only needs briefly
+#ifndef USB_SCRATCH_SIZE
+#if defined(__AVR__)
+#define USB_SCRATCH_SIZE        0
+#else
+#define USB_SCRATCH_SIZE        128
+#endif
+#endif
+
+/* Workarounds applied while configuring a device, see USBQuirk */
+#define USB_QUIRK_RETRY_JERR            0x01    // Retry the configuration after a 100 ms delay if the device answers with a J-state error when plugged in
+#define USB_QUIRK_LONG_CONFIG_READ      0x02    // Read 9 bytes of the configuration descriptor to get its total length instead of 4, some devices fail otherwise
+#define USB_QUIRK_RESET_BEFORE_ADDRESS  0x04    // Reset the device between USBDeviceConfig::ConfigureDevice() and Init(), as if the driver returned USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET. The device is still at address 0 then, as a reset would undo SET_ADDRESS
+#define USB_QUIRK_SETTLE_AFTER_ADDRESS  0x08    // Wait the settle time of the entry after SET_ADDRESS instead of after reading the device descriptor
+
+#define USB_QUIRK_ANY_PID               0xFFFF  // Matches all products of a vendor
+
+// Workarounds used for devices which are not listed in the quirks table. Devices needing workarounds should be listed instead, so the others enumerate without them
+#ifndef USB_QUIRKS_DEFAULT
+#define USB_QUIRKS_DEFAULT              0
+#endif
+
+// Extra entries for the quirks table, for instance: #define USB_QUIRKS_USER {0x1234, 0x5678, USB_QUIRK_RETRY_JERR, 50, 0},
+#ifndef USB_QUIRKS_USER
+#define USB_QUIRKS_USER
+#endif
+
+#ifndef USB_NUM_RESUMABLE_IN
+#if defined(__AVR__)
+#define USB_NUM_RESUMABLE_IN    4       //number of interrupt IN endpoints which can have a multi-packet transfer in progress at the same time
+#else
+#define USB_NUM_RESUMABLE_IN    8
+#endif
+#endif
 //#define HUB_MAX_HUBS          7       // maximum number of hubs that can be attached to the host controller
 #define HUB_PORT_RESET_DELAY    20      // hub port reset delay 10 ms recomended, can be up to 20 ms
 
@@ -132,6 +188,12 @@ typedef MAX3421e<P1, P0> MAX3421E;  // As wired for Amp Controller
 #define USB_STATE_RUNNING                                   0x90
 #define USB_STATE_ERROR                                     0xa0
 
+/* Implements USBDeviceConfig::GetMemoryUsage() in a driver class. Every class which gets instantiated needs it, as it reports the size of the class it is used in */
+#define USB_DEVICE_MEMORY_USAGE() \
+        virtual uint16_t GetMemoryUsage() { \
+                return sizeof (*this); \
+        }
+
 class USBDeviceConfig {
 public:
 
@@ -147,6 +209,16 @@ public:
                 return 0;
         }
 
+        /**
+         * Drivers which return true leave addressing to the core: after ConfigureDevice() the core assigns the device an address,
+         * so Init() gets it with USB::getConfiguringAddress() and the device descriptor with USB::getConfiguringDevDescr().
+         * If Init() fails, the core frees the address and resets the device.
+         * @return true if the core assigns the address.
+         */
+        virtual bool CoreAddressing() {
+                return false;
+        }
+
         virtual uint8_t Poll() {
                 return 0;
         }
@@ -155,6 +227,15 @@ public:
                 return 0;
         }
 
+        /**
+         * Get the RAM used by the driver, see USB::getDeviceConfig(). Drivers implement it with USB_DEVICE_MEMORY_USAGE().
+         * Drivers derived from one which implements this report the size of that class, unless they implement it as well.
+         * @return Size in bytes or 0 if it is not known.
+         */
+        virtual uint16_t GetMemoryUsage() {
+                return 0;
+        }
+
         virtual void ResetHubPort(uint8_t port __attribute__((unused))) {
                 return;
         } // Note used for hubs only!
@@ -173,6 +254,59 @@ public:
 
 };
 
+#define USB_PROFILE_BUCKETS     6       // Histogram buckets of USBProfile: <64us, <256us, <1ms, <4ms, <16ms and 16ms or more
+#define USB_PROFILE_FIRST_BUCKET 64     // Upper limit of the first bucket in us, every following one is four times larger
+
+// Phases timed by the profiling, see ENABLE_USB_PROFILING in settings.h
+#define USB_PROFILE_POLL        0       // USBDeviceConfig::Poll()
+#define USB_PROFILE_ENUM        1       // Enumeration of a device attached to the root port
+#define USB_PROFILE_INIT        2       // USBDeviceConfig::ConfigureDevice() and Init() of a driver, part of the enumeration
+#define USB_PROFILE_RELEASE     3       // USBDeviceConfig::Release()
+#define USB_PROFILE_PHASES      4
+#define USB_PROFILE_NO_DRIVER   0xFF
+
+/** Durations of one kind of call in us. */
+struct USBProfile {
+        uint32_t count; // Number of calls
+        uint32_t total; // Sum of the durations, divide by count to get the average
+        uint32_t min;
+        uint32_t max;
+        uint16_t hist[USB_PROFILE_BUCKETS]; // Number of calls per duration range, stops counting at 0xFFFF
+};
+
+/** Occupancy of a buffer or queue of a driver. */
+struct USBBufferUsage {
+        uint16_t size; // Capacity in bytes
+        uint16_t used; // Bytes held now
+        uint16_t peak; // Most bytes held at the same time
+};
+
+/** Entry in the quirks table, which is consulted when a device is configured. */
+struct USBQuirk {
+        uint16_t vid;
+        uint16_t pid; // USB_QUIRK_ANY_PID matches all products
+        uint8_t flags; // USB_QUIRK_*, replacing USB_QUIRKS_DEFAULT
+        uint8_t settle; // Extra time in milliseconds to wait after the device descriptor has been read, or after SET_ADDRESS with USB_QUIRK_SETTLE_AFTER_ADDRESS
+        uint8_t maxPktSize0; // Used instead of bMaxPacketSize0 of the device descriptor, 0 to keep it
+};
+
+/** The transfer a driver started last. */
+struct USBXferInfo {
+        uint8_t addr;
+        uint8_t ep; // Endpoint address, bit 7 is set for an IN transfer. Control transfers use endpoint 0
+        uint8_t rcode; // Result of the transfer
+};
+
+/** Passed to the callback set with USB::attachOnTaskStall(). */
+struct USBStallInfo {
+        uint32_t taskTime; // Duration of the Task() call in us
+        uint32_t partTime; // Duration of the slowest call it made in us
+        uint8_t phase; // What the slowest call was, USB_PROFILE_POLL, USB_PROFILE_ENUM or USB_PROFILE_RELEASE
+        uint8_t driver; // Index of the driver in the order they were registered, USB_PROFILE_NO_DRIVER if enumeration did not get to one
+        USBDeviceConfig *pDriver; // The driver itself or NULL
+        USBXferInfo lastXfer; // Last transfer started before the slowest call returned
+};
+
 /* USB Setup Packet Structure   */
 typedef struct {
 
@@ -213,6 +347,40 @@ class USB : public MAX3421E {
         USBDeviceConfig* devConfig[USB_NUMDEVICES];
         uint8_t bmHubPre;
 
+        // Multi-packet interrupt IN transfers waiting for the next packet
+        struct {
+                EpInfo *pep; // NULL if the entry is free
+                uint16_t offset; // Bytes received so far
+        } inResume[USB_NUM_RESUMABLE_IN];
+
+        // Device descriptor of the device being configured at address 0
+        USB_DEVICE_DESCRIPTOR devDescr;
+        bool bDevDescrCached;
+        uint8_t quirks; // USB_QUIRK_* flags of the device being configured, USB_QUIRKS_DEFAULT otherwise
+        uint8_t addrSettle; // Extra wait in milliseconds after the device being configured gets its address
+        uint8_t configAddr; // Address the core assigned to the device being configured, see USBDeviceConfig::CoreAddressing()
+
+#if USB_SCRATCH_SIZE
+        // Temporary buffers, taken and returned in stack order by USBScratch
+        uint8_t scratch[USB_SCRATCH_SIZE];
+        uint16_t scratchUsed;
+        uint16_t scratchPeak; // Most space asked for at the same time, may exceed USB_SCRATCH_SIZE
+#endif
+
+#if ENABLE_USB_SPI_AUTOTUNE
+        uint32_t spiCheckTime; // Next time the SPI bus is checked
+#endif
+
+#if ENABLE_USB_PROFILING
+        USBProfile pollProfile[USB_NUMDEVICES];
+        USBProfile phaseProfile[USB_PROFILE_PHASES];
+        USBXferInfo lastXfer;
+        USBStallInfo stall; // Slowest call of the current Task()
+        uint8_t initDriver; // Driver tried last by AttemptConfig()
+        uint32_t stallThreshold;
+        void (*pFuncOnTaskStall)(const USBStallInfo *info);
+#endif
+
 public:
         USB(void);
 
@@ -241,6 +409,24 @@ public:
         void ForEachUsbDevice(UsbDeviceHandleFunc pfunc) {
                 addrPool.ForEachUsbDevice(pfunc);
         };
+
+        /**
+         * Get a registered driver, for instance to call USBDeviceConfig::GetMemoryUsage() on it.
+         * @param  index Index of the driver in the order they were registered.
+         * @return       Pointer to the driver or NULL if there is none.
+         */
+        USBDeviceConfig *getDeviceConfig(uint8_t index) {
+                return (index < USB_NUMDEVICES) ? devConfig[index] : NULL;
+        };
+
+        /**
+         * Fill the free RAM between the heap and the stack with a pattern, so getStackUnused() can tell how deep the stack has grown.
+         * Call it at the start of setup(). Only supported on AVR.
+         */
+        static void paintStack();
+
+        /** @return The number of bytes below the stack which were never used since paintStack(), 0 if this is not supported. */
+        static uint16_t getStackUnused();
         uint8_t getUsbTaskState(void);
         void setUsbTaskState(uint8_t state);
 
@@ -249,6 +435,34 @@ public:
 
         /* Control requests */
         uint8_t getDevDescr(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* dataptr);
+
+        /**
+         * Get the device descriptor of the device which is being configured.
+         * While Configuring() runs, reading the device descriptor at address 0 with getDevDescr() is served from this copy,
+         * so the drivers which are tried in turn do not each read it again.
+         * @return Pointer to the descriptor or NULL if no device is being configured.
+         */
+        const USB_DEVICE_DESCRIPTOR *getConfiguringDevDescr() {
+                return bDevDescrCached ? &devDescr : NULL;
+        };
+
+        /**
+         * Get the address the core assigned to the device which is being configured, see USBDeviceConfig::CoreAddressing().
+         * The device answers on it with endpoint 0 already, the driver only has to add its endpoints with setEpInfoEntry().
+         * @return Address or 0 if the driver is not given one.
+         */
+        uint8_t getConfiguringAddress() {
+                return configAddr;
+        };
+
+        /**
+         * Look up a device in the quirks table.
+         * @param  vid   Vendor ID.
+         * @param  pid   Product ID.
+         * @param  quirk Filled with the entry or, if the device is not listed, with the default workarounds.
+         * @return       true if the device is listed.
+         */
+        static bool getQuirk(uint16_t vid, uint16_t pid, USBQuirk *quirk);
         uint8_t getConfDescr(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t conf, uint8_t* dataptr);
 
         uint8_t getConfDescr(uint8_t addr, uint8_t ep, uint8_t conf, USBReadParser *p);
@@ -256,30 +470,203 @@ public:
         uint8_t getStrDescr(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t index, uint16_t langid, uint8_t* dataptr);
         uint8_t setAddr(uint8_t oldaddr, uint8_t ep, uint8_t newaddr);
         uint8_t setConf(uint8_t addr, uint8_t ep, uint8_t conf_value);
+
+        /**
+         * Clear the halt of a bulk or interrupt endpoint with CLEAR_FEATURE(ENDPOINT_HALT) and reset its data toggle.
+         * @param  addr Device address.
+         * @param  pep  Entry of the endpoint in the table of the driver.
+         * @param  in   true for an IN endpoint.
+         * @return      0 on success.
+         */
+        uint8_t clearEpHalt(uint8_t addr, EpInfo *pep, bool in);
+
+        /**
+         * Decide if a device can still be used after a transfer to a bulk or interrupt endpoint failed.
+         * A STALL is cleared with clearEpHalt(), so only use this if the class does not define a recovery sequence of its own, as mass storage does.
+         * @param  addr  Device address.
+         * @param  pep   Entry of the endpoint in the table of the driver.
+         * @param  in    true for an IN endpoint.
+         * @param  rcode Result of the transfer.
+         * @return       true if the device is still usable, false if the driver should release it.
+         */
+        bool recoverEp(uint8_t addr, EpInfo *pep, bool in, uint8_t rcode);
         /**/
         uint8_t ctrlData(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* dataptr, bool direction);
         uint8_t ctrlStatus(uint8_t ep, bool direction, uint16_t nak_limit);
-        uint8_t inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval = 0);
-        uint8_t outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data);
-        uint8_t dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit);
+        /**
+         * Read from an endpoint.
+         * @param  addr      Device address.
+         * @param  ep        Endpoint.
+         * @param  nbytesptr Size of the buffer, returns the number of bytes read.
+         * @param  data      Buffer.
+         * @param  bInterval Polling interval of an interrupt endpoint, 0 otherwise.
+         * @param  timeout   Time budget of the transfer in ms, 0 for USB_INT_XFER_TIMEOUT or USB_BULK_XFER_TIMEOUT.
+         * @return           0 on success, hrNAK if the NAK limit was reached and USB_ERROR_TRANSFER_TIMEOUT if the time budget ran out.
+         */
+        uint8_t inTransfer(uint8_t addr, uint8_t ep, uint16_t *nbytesptr, uint8_t* data, uint8_t bInterval = 0, uint16_t timeout = 0);
+        /**
+         * Write to an endpoint.
+         * @param  addr    Device address.
+         * @param  ep      Endpoint.
+         * @param  nbytes  Number of bytes to send, 0 sends a zero length packet.
+         * @param  data    Data to send.
+         * @param  timeout Time budget of the transfer in ms, 0 for USB_BULK_XFER_TIMEOUT.
+         * @return         0 on success, hrNAK if the NAK limit was reached and USB_ERROR_TRANSFER_TIMEOUT if the time budget ran out.
+         */
+        uint8_t outTransfer(uint8_t addr, uint8_t ep, uint16_t nbytes, uint8_t* data, uint16_t timeout = 0);
+
+        uint8_t dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit) {
+                return dispatchPkt(token, ep, nak_limit, (uint32_t)millis() + USB_XFER_TIMEOUT);
+        };
 
         void Task(void);
 
+#if USB_SCRATCH_SIZE
+        /**
+         * Take a buffer from the scratch arena. Use USBScratch instead, which returns it at the end of the scope.
+         * @param  size Size in bytes.
+         * @return      Pointer to the buffer or NULL if there is not enough room.
+         */
+        uint8_t *scratchAcquire(uint16_t size) {
+                size = (size + 3) & ~3; // Keep the following buffers aligned
+                if(scratchUsed + size > scratchPeak)
+                        scratchPeak = scratchUsed + size;
+                if(size > USB_SCRATCH_SIZE - scratchUsed)
+                        return NULL;
+                uint8_t *buf = &scratch[scratchUsed];
+                scratchUsed += size;
+                return buf;
+        };
+
+        /** Return a buffer and all taken after it to the scratch arena. */
+        void scratchRelease(uint8_t *buf) {
+                scratchUsed = buf - scratch;
+        };
+
+        /** @return The most bytes of the scratch arena in use at the same time. If it is larger than USB_SCRATCH_SIZE, some requests failed. */
+        uint16_t getScratchPeak() {
+                return scratchPeak;
+        };
+#endif
+
+#if ENABLE_USB_PROFILING
+        /**
+         * Get the time spent in the Poll() function of a driver.
+         * @param  driver Index of the driver in the order they were registered.
+         * @return        Pointer to the profile or NULL if the index is invalid.
+         */
+        const USBProfile *getPollProfile(uint8_t driver) {
+                return (driver < USB_NUMDEVICES && devConfig[driver]) ? &pollProfile[driver] : NULL;
+        };
+
+        /**
+         * Get the time spent in a phase for all drivers together.
+         * @param  phase USB_PROFILE_POLL, USB_PROFILE_ENUM, USB_PROFILE_INIT or USB_PROFILE_RELEASE.
+         * @return       Pointer to the profile or NULL if the phase is invalid.
+         */
+        const USBProfile *getPhaseProfile(uint8_t phase) {
+                return (phase < USB_PROFILE_PHASES) ? &phaseProfile[phase] : NULL;
+        };
+        void resetProfile();
+
+        /**
+         * Call a function when a single Task() takes too long.
+         * @param func      Function to call or NULL to disable it. It is called at the end of Task().
+         * @param threshold Duration of Task() in us from which the function is called.
+         */
+        void attachOnTaskStall(void (*func)(const USBStallInfo *info), uint32_t threshold) {
+                pFuncOnTaskStall = func;
+                stallThreshold = threshold;
+        };
+#endif
+
         uint8_t DefaultAddressing(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Configuring(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t ReleaseDevice(uint8_t addr);
 
         uint8_t ctrlReq(uint8_t addr, uint8_t ep, uint8_t bmReqType, uint8_t bRequest, uint8_t wValLo, uint8_t wValHi,
-                uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t* dataptr, USBReadParser *p);
+                uint16_t wInd, uint16_t total, uint16_t nbytes, uint8_t* dataptr, USBReadParser *p, uint16_t timeout = 0);
 
 private:
         void init();
         uint8_t SetAddress(uint8_t addr, uint8_t ep, EpInfo **ppep, uint16_t *nak_limit);
-        uint8_t OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8_t *data);
-        uint8_t InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t *data, uint8_t bInterval = 0);
+        uint8_t dispatchPkt(uint8_t token, uint8_t ep, uint16_t nak_limit, uint32_t deadline);
+        uint8_t OutTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t nbytes, uint8_t *data, uint32_t deadline);
+        uint8_t InTransfer(EpInfo *pep, uint16_t nak_limit, uint16_t *nbytesptr, uint8_t *data, uint8_t bInterval, uint32_t deadline);
+        void clearInResume(EpInfo *first, uint8_t count);
+
+#if ENABLE_USB_PROFILING
+        uint32_t profileStart() {
+                return (uint32_t)micros();
+        };
+        void profileEnd(uint32_t start, uint8_t phase, uint8_t driver);
+
+        void profileXfer(uint8_t addr, uint8_t ep) {
+                lastXfer.addr = addr;
+                lastXfer.ep = ep;
+                lastXfer.rcode = USB_ERROR_TRANSFER_IN_PROGRESS;
+        };
+
+        uint8_t profileXferDone(uint8_t rcode) {
+                lastXfer.rcode = rcode;
+                return rcode;
+        };
+#else
+        // Compiled away when profiling is disabled
+        uint32_t profileStart() {
+                return 0;
+        };
+
+        void profileEnd(uint32_t start __attribute__((unused)), uint8_t phase __attribute__((unused)), uint8_t driver __attribute__((unused))) {
+        };
+
+        void profileXfer(uint8_t addr __attribute__((unused)), uint8_t ep __attribute__((unused))) {
+        };
+
+        uint8_t profileXferDone(uint8_t rcode) {
+                return rcode;
+        };
+#endif
         uint8_t AttemptConfig(uint8_t driver, uint8_t parent, uint8_t port, bool lowspeed);
+        uint8_t AssignAddress(uint8_t parent, uint8_t port, bool lowspeed, uint8_t *addr);
+        void ResetDevice(uint8_t parent, uint8_t port);
+};
+
+#if USB_SCRATCH_SIZE
+/**
+ * Temporary buffer from the scratch arena of a USB instance, returned when the object goes out of scope.
+ * Use it for buffers which are only needed during a transfer, rather than large buffers on the stack or in every driver.
+ * It converts to a pointer to the data, which is NULL if the arena had no room.
+ */
+class USBScratch {
+        USB *pUsb;
+        uint8_t *buf;
+
+public:
+        USBScratch(USB *p, uint16_t size) : pUsb(p), buf(p->scratchAcquire(size)) {
+        };
+
+        ~USBScratch() {
+                if(buf)
+                        pUsb->scratchRelease(buf);
+        };
+
+        operator uint8_t *() {
+                return buf;
+        };
+
+private:
+        USBScratch(const USBScratch &);
+        USBScratch &operator=(const USBScratch &);
 };
 
+/* Declares the pointer name to a temporary buffer of size bytes, taken from the scratch arena of usb. Check it for NULL before use */
+#define USB_SCRATCH_BUFFER(name, usb, size) USBScratch name(usb, size)
+#else
+/* Without the arena the buffer is on the stack, so it is never NULL */
+#define USB_SCRATCH_BUFFER(name, usb, size) uint8_t name##Data[size]; uint8_t *name = name##Data
+#endif
+
 #if 0 //defined(USB_METHODS_INLINE)
 //get device descriptor
 
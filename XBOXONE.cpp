@@ -166,8 +166,6 @@ uint8_t XBOXONE::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         if(rcode)
                 goto FailSetDevTblEntry;
 
-        delay(200); // Give time for address change
-
         rcode = pUsb->setConf(bAddress, epInfo[ XBOX_ONE_CONTROL_PIPE ].epAddr, bConfNum);
         if(rcode)
                 goto FailSetConfDescr;
@@ -318,7 +316,7 @@ uint8_t XBOXONE::Poll() {
 #endif
                 }
 #ifdef DEBUG_USB_HOST
-                else if(rcode != hrNAK) { // Not a matter of no update to send
+                else if(rcode != hrNAK && rcode != USB_ERROR_TRANSFER_IN_PROGRESS) { // Not a matter of no update to send, or the rest of the report comes on the next poll
                         Notify(PSTR("\r\nXbox One Poll Failed, error code: "), 0x80);
                         NotifyFail(rcode);
                 }
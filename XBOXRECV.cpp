@@ -107,7 +107,7 @@ uint8_t XBOXRECV::ConfigureDevice(uint8_t parent, uint8_t port, bool lowspeed) {
 
         epInfo[0].maxPktSize = udd->bMaxPacketSize0; // Extract Max Packet Size from device descriptor
 
-        delay(20); // Wait a little before resetting device
+        // The quirks table in Usb.cpp already waited a little before the device is reset
 
         return USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET;
 
@@ -151,8 +151,6 @@ uint8_t XBOXRECV::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
                 return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
         }
 
-        delay(300); // Assign new address to the device
-
         rcode = pUsb->setAddr(0, 0, bAddress); // Assign new address to the device
         if(rcode) {
 #ifdef DEBUG_USB_HOST
@@ -244,8 +242,6 @@ uint8_t XBOXRECV::Init(uint8_t parent __attribute__((unused)), uint8_t port __at
         if(rcode)
                 goto FailSetDevTblEntry;
 
-        delay(200); //Give time for address change
-
         rcode = pUsb->setConf(bAddress, epInfo[ XBOX_CONTROL_PIPE ].epAddr, 1);
         if(rcode)
                 goto FailSetConfDescr;
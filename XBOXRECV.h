@@ -97,6 +97,8 @@ public:
                 return bAddress;
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         /**
          * Used to check if the controller has been initialized.
          * @return True if it's ready.
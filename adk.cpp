@@ -40,7 +40,21 @@ pUsb(p), //pointer to USB class instance - mandatory
 bAddress(0), //device address - mandatory
 bConfNum(0), //configuration number
 bNumEP(1), //if config descriptor needs to be parsed
-ready(false) {
+ready(false),
+accState(ADK_ACC_IDLE),
+accStrIndex(0),
+qNextAccTime(0),
+bRootPort(false),
+bPollEnable(true),
+qTxFlushTime(0),
+bTxLatency(ADK_TX_LATENCY),
+rxHighWater(0),
+bRxAboveHighWater(false),
+pFuncOnRxHighWater(NULL),
+rxBytes(0),
+txBytes(0),
+rxOverruns(0),
+bRxHeld(false) {
         // initialize endpoint data structures
         for(uint8_t i = 0; i < ADK_MAX_ENDPOINTS; i++) {
                 epInfo[i].epAddr = 0;
@@ -229,32 +243,14 @@ uint8_t ADK::Init(uint8_t parent, uint8_t port, bool lowspeed) {
                 USBTRACE2("\r\nADK protocol rev. ", adkproto);
         }
 
-        delay(100);
-
-        //sending ID strings
-        sendStr(ACCESSORY_STRING_MANUFACTURER, manufacturer);
-        delay(10);
-        sendStr(ACCESSORY_STRING_MODEL, model);
-        delay(10);
-        sendStr(ACCESSORY_STRING_DESCRIPTION, description);
-        delay(10);
-        sendStr(ACCESSORY_STRING_VERSION, version);
-        delay(10);
-        sendStr(ACCESSORY_STRING_URI, uri);
-        delay(10);
-        sendStr(ACCESSORY_STRING_SERIAL, serial);
-
-        delay(100);
-
-        //switch to accessory mode
-        //the Android phone will reset
-        rcode = switchAcc();
-        if(rcode) {
-                goto FailSwAcc; //init fails
-        }
-        rcode = USB_ERROR_CONFIG_REQUIRES_ADDITIONAL_RESET;
-        delay(100); // Give Android a chance to do its reset. This is a guess, and possibly could be lower.
-        goto SwAttempt; //switch to accessory mode attempted
+        // The ID strings and the switch to accessory mode are sent from Poll(), so Usb.Task() keeps running meanwhile.
+        // The phone then drops off the bus and comes back in accessory mode, which is handled like any other attach.
+        accState = ADK_ACC_SEND_STRINGS;
+        accStrIndex = ACCESSORY_STRING_MANUFACTURER;
+        qNextAccTime = (uint32_t)millis() + ADK_STRINGS_DELAY;
+        bRootPort = (parent == 0);
+        USBTRACE("\r\nAccessory mode switch started");
+        return 0;
 
         /* diagnostic messages */
 FailGetDevDescr:
@@ -287,19 +283,11 @@ FailGetProto:
         goto Fail;
 #endif
 
-FailSwAcc:
-#ifdef DEBUG_USB_HOST
-        USBTRACE("\r\nswAcc:");
-        goto Fail;
-#endif
-
         //FailOnInit:
         //        USBTRACE("OnInit:");
         //        goto Fail;
         //
-SwAttempt:
 #ifdef DEBUG_USB_HOST
-        USBTRACE("\r\nAccessory mode switch attempt");
 Fail:
 #endif
         //USBTRACE2("\r\nADK Init Failed, error code: ", rcode);
@@ -308,6 +296,124 @@ Fail:
         return rcode;
 }
 
+/* Sends buffered data and reads the bulk IN endpoint into rxBuffer */
+uint8_t ADK::Poll() {
+        if(accState != ADK_ACC_IDLE)
+                return stepAccSwitch();
+        if(!ready)
+                return 0;
+
+        if(txBuffer.available()) {
+                // A short time budget, so a phone which does not read its data only delays the receive side
+                uint8_t rcode = SendBuffered((int32_t)((uint32_t)millis() - qTxFlushTime) >= 0L, USB_POLL_TX_TIMEOUT);
+                if(!ready)
+                        return rcode; // Released
+        }
+
+        if(!bPollEnable)
+                return 0;
+
+        if(rxBuffer.available() < rxHighWater)
+                bRxAboveHighWater = false;
+
+        uint8_t buf[64]; // Full speed bulk endpoints are at most 64 bytes
+        uint16_t rcvd = epInfo[epDataInIndex].maxPktSize;
+        if(rcvd == 0 || rcvd > sizeof (buf))
+                rcvd = sizeof (buf);
+
+        // Leave the data in the phone until the sketch has made room for a whole packet
+        if(rxBuffer.room() < rcvd) {
+                if(!bRxHeld) {
+                        // Counted once per time the buffer fills up. No data is lost, as it stays in the device
+                        bRxHeld = true;
+                        rxOverruns++;
+                }
+                return 0;
+        }
+        bRxHeld = false;
+
+        uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, &rcvd, buf);
+        if(rcode) {
+                if(rcode == hrNAK)
+                        return 0;
+                if(!pUsb->recoverEp(bAddress, &epInfo[epDataInIndex], true, rcode))
+                        Release();
+                return rcode;
+        }
+        rxBuffer.write(buf, rcvd);
+        rxBytes += rcvd;
+
+        if(pFuncOnRxHighWater && rxHighWater && !bRxAboveHighWater && rxBuffer.available() >= rxHighWater) {
+                bRxAboveHighWater = true;
+                pFuncOnRxHighWater();
+        }
+        return 0;
+}
+
+/* Advances the switch to accessory mode started by Init() */
+uint8_t ADK::stepAccSwitch() {
+        uint8_t rcode;
+
+        if((int32_t)((uint32_t)millis() - qNextAccTime) < 0L)
+                return 0;
+
+        switch(accState) {
+                case ADK_ACC_SEND_STRINGS:
+                        rcode = sendStr(accStrIndex, getAccString(accStrIndex));
+                        if(rcode)
+                                break;
+                        if(++accStrIndex > ACCESSORY_STRING_SERIAL) {
+                                accState = ADK_ACC_SWITCH;
+                                qNextAccTime = (uint32_t)millis() + ADK_SWITCH_DELAY;
+                        } else
+                                qNextAccTime = (uint32_t)millis() + ADK_STRING_INTERVAL;
+                        return 0;
+
+                case ADK_ACC_SWITCH:
+                        //switch to accessory mode
+                        //the Android phone will reset
+                        rcode = switchAcc();
+                        if(rcode)
+                                break;
+                        accState = ADK_ACC_WAIT_REENUM;
+                        qNextAccTime = (uint32_t)millis() + ADK_REENUM_TIMEOUT;
+                        USBTRACE("\r\nAccessory mode switch attempt");
+                        return 0;
+
+                default: // ADK_ACC_WAIT_REENUM
+                        // The phone should have dropped off the bus by now. Reset it if it is on the root port,
+                        // otherwise wait for it to be unplugged
+                        USBTRACE("\r\nNo re-enumeration after accessory mode switch");
+                        Release();
+                        if(bRootPort)
+                                pUsb->setUsbTaskState(USB_ATTACHED_SUBSTATE_RESET_DEVICE);
+                        return 0;
+        }
+
+#ifdef DEBUG_USB_HOST
+        USBTRACE2("\r\nAccessory mode switch failed: ", rcode);
+#endif
+        Release();
+        return rcode;
+}
+
+const char *ADK::getAccString(uint8_t index) {
+        switch(index) {
+                case ACCESSORY_STRING_MANUFACTURER:
+                        return manufacturer;
+                case ACCESSORY_STRING_MODEL:
+                        return model;
+                case ACCESSORY_STRING_DESCRIPTION:
+                        return description;
+                case ACCESSORY_STRING_VERSION:
+                        return version;
+                case ACCESSORY_STRING_URI:
+                        return uri;
+                default:
+                        return serial;
+        }
+}
+
 /* Extracts bulk-IN and bulk-OUT endpoint information from config descriptor */
 void ADK::EndpointXtract(uint8_t conf, uint8_t iface __attribute__((unused)), uint8_t alt __attribute__((unused)), uint8_t proto __attribute__((unused)), const USB_ENDPOINT_DESCRIPTOR *pep) {
         //ErrorMessage<uint8_t>(PSTR("Conf.Val"), conf);
@@ -341,17 +447,76 @@ uint8_t ADK::Release() {
 
         bAddress = 0;
         ready = false;
+        accState = ADK_ACC_IDLE;
+        rxBuffer.clear();
+        txBuffer.clear();
+        bRxAboveHighWater = false;
+        bRxHeld = false;
         return 0;
 }
 
 uint8_t ADK::RcvData(uint16_t *bytes_rcvd, uint8_t *dataptr) {
         //USBTRACE2("\r\nAddr: ", bAddress );
         //USBTRACE2("\r\nEP: ",epInfo[epDataInIndex].epAddr);
-        return pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, bytes_rcvd, dataptr);
+        if(rxBuffer.available()) {
+                *bytes_rcvd = rxBuffer.read(dataptr, *bytes_rcvd);
+                return 0;
+        }
+        uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, bytes_rcvd, dataptr);
+        if(!rcode)
+                rxBytes += *bytes_rcvd;
+        return rcode;
 }
 
 uint8_t ADK::SndData(uint16_t nbytes, uint8_t *dataptr) {
-        return pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, nbytes, dataptr);
+        uint8_t rcode = SendBuffered(true);
+        if(rcode)
+                return rcode;
+        rcode = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, nbytes, dataptr);
+        if(!rcode)
+                txBytes += nbytes;
+        return rcode;
+}
+
+/* Sends the full packets in txBuffer, or all of it if all is set */
+uint8_t ADK::SendBuffered(bool all, uint16_t timeout) {
+        uint8_t buf[64]; // Full speed bulk endpoints are at most 64 bytes
+        uint16_t pktSize = epInfo[epDataOutIndex].maxPktSize;
+        if(pktSize == 0 || pktSize > sizeof (buf))
+                pktSize = sizeof (buf);
+
+        while(txBuffer.available() >= pktSize || (all && txBuffer.available())) {
+                uint16_t nbytes = txBuffer.peek(buf, pktSize);
+                uint8_t rcode = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, nbytes, buf, timeout);
+                if(rcode) {
+                        if(rcode == hrSTALL)
+                                pUsb->clearEpHalt(bAddress, &epInfo[epDataOutIndex], false);
+                        return rcode; // The data is left in the buffer, so it is sent again next time on a NAK or cleared halt
+                }
+                txBuffer.skip(nbytes);
+                txBytes += nbytes;
+        }
+        return 0;
+}
+
+#if defined(ARDUINO) && ARDUINO >=100
+size_t ADK::write(const uint8_t *data, size_t size) {
+#else
+void ADK::write(const uint8_t *data, size_t size) {
+#endif
+        size_t written = 0;
+
+        while(ready && written < size) {
+                if(!txBuffer.available())
+                        qTxFlushTime = (uint32_t)millis() + bTxLatency;
+                uint16_t len = (size - written > 0xFFFF) ? 0xFFFF : (uint16_t)(size - written);
+                written += txBuffer.write(data + written, len);
+                if(written < size && SendBuffered(false))
+                        break; // The phone did not take the data
+        }
+#if defined(ARDUINO) && ARDUINO >=100
+        return written;
+#endif
 }
 
 void ADK::PrintEndpointDescriptor(const USB_ENDPOINT_DESCRIPTOR* ep_ptr) {
@@ -48,9 +48,26 @@ e-mail   :  support@circuitsathome.com
 
 #define ADK_MAX_ENDPOINTS 3 //endpoint 0, bulk_IN, bulk_OUT
 
+/* Timing of the switch to accessory mode in ms */
+#define ADK_STRINGS_DELAY       100  //after getProto() before the first ID string
+#define ADK_STRING_INTERVAL     10   //between the ID strings
+#define ADK_SWITCH_DELAY        100  //after the last ID string before switchAcc()
+#define ADK_REENUM_TIMEOUT      1000 //time the phone gets to drop off the bus after switchAcc()
+
+/* States of the switch to accessory mode */
+#define ADK_ACC_IDLE            0
+#define ADK_ACC_SEND_STRINGS    1
+#define ADK_ACC_SWITCH          2
+#define ADK_ACC_WAIT_REENUM     3
+
 class ADK;
 
-class ADK : public USBDeviceConfig, public UsbConfigXtracter {
+/**
+ * Driver for Android phones in accessory mode.
+ * Data from the phone is read in the background from Usb.Task(), and data written with write() is packed into full packets.
+ * It inherits the Arduino Stream class, so the standard print and stream functions can be used on it.
+ */
+class ADK : public USBDeviceConfig, public UsbConfigXtracter, public Stream {
 private:
         /* ID strings */
         const char* manufacturer;
@@ -64,6 +81,8 @@ private:
         uint8_t getProto(uint8_t* adkproto);
         uint8_t sendStr(uint8_t index, const char* str);
         uint8_t switchAcc(void);
+        const char *getAccString(uint8_t index);
+        uint8_t stepAccSwitch(void);
 
 protected:
         static const uint8_t epDataInIndex; // DataIn endpoint index
@@ -76,11 +95,31 @@ protected:
 
         uint8_t bNumEP; // total number of EP in the configuration
         bool ready;
+        uint8_t accState; // State of the switch to accessory mode
+        uint8_t accStrIndex; // Next ID string to send
+        uint32_t qNextAccTime; // Time of the next step of the switch
+        bool bRootPort; // The phone is connected directly to the MAX3421E
+        bool bPollEnable; // Read the bulk IN endpoint from Poll()
+
+        USBRingBuffer<ADK_RX_BUFFER_SIZE> rxBuffer; // Data received from Poll()
+        USBRingBuffer<ADK_TX_BUFFER_SIZE> txBuffer; // Data written with write()
+        uint32_t qTxFlushTime; // Time the oldest byte in txBuffer has to be sent
+        uint8_t bTxLatency; // Time in ms data may wait in txBuffer
+
+        uint16_t rxHighWater; // Fill level of rxBuffer which triggers pFuncOnRxHighWater
+        bool bRxAboveHighWater; // pFuncOnRxHighWater has been called since the fill level was last below rxHighWater
+        void (*pFuncOnRxHighWater)(void);
+
+        uint32_t rxBytes; // Bytes received from the phone
+        uint32_t txBytes; // Bytes sent to the phone
+        uint32_t rxOverruns; // Number of times rxBuffer filled up, so the device had to hold on to its data
+        bool bRxHeld; // Polling is held off until rxBuffer has room for a packet
 
         /* Endpoint data structure */
         EpInfo epInfo[ADK_MAX_ENDPOINTS];
 
         void PrintEndpointDescriptor(const USB_ENDPOINT_DESCRIPTOR* ep_ptr);
+        uint8_t SendBuffered(bool all, uint16_t timeout = 0);
 
 public:
         ADK(USB *pUsb, const char* manufacturer,
@@ -91,27 +130,177 @@ public:
                 const char* serial);
 
         // Methods for receiving and sending data
+        // RcvData() returns data already received by Poll() first, and SndData() sends the data buffered by write() first,
+        // so they can be mixed with the Stream functions
         uint8_t RcvData(uint16_t *nbytesptr, uint8_t *dataptr);
         uint8_t SndData(uint16_t nbytes, uint8_t *dataptr);
 
+        /**
+         * Get number of bytes received in the background and waiting to be read.
+         * @return Return the number of bytes ready to be read.
+         */
+        int available(void) {
+                return rxBuffer.available();
+        };
+
+        /**
+         * Used to read the next value in the buffer without advancing to the next one.
+         * @return Return the byte. Will return -1 if no bytes are available.
+         */
+        int peek(void) {
+                return rxBuffer.peek();
+        };
+
+        /**
+         * Used to read the buffer.
+         * @return Return the byte. Will return -1 if no bytes are available.
+         */
+        int read(void) {
+                return rxBuffer.read();
+        };
+
+        /**
+         * Copy the received data to a buffer without waiting for more data, unlike Stream::readBytes() which waits for the timeout.
+         * @param  buffer Where to store the data.
+         * @param  length Maximum number of bytes to read.
+         * @return        Number of bytes copied.
+         */
+        size_t readAvailable(uint8_t *buffer, size_t length) {
+                return rxBuffer.read(buffer, (length > 0xFFFF) ? 0xFFFF : (uint16_t)length);
+        };
+
+        /** Throw away all received data. */
+        void discard(void) {
+                rxBuffer.clear();
+        };
+
+        /**
+         * Enable or disable reading the bulk IN endpoint from Usb.Task().
+         * When disabled the data stays in the phone until RcvData() is called.
+         * @param enable True to read in the background, which is the default.
+         */
+        void setRxPolling(bool enable) {
+                bPollEnable = enable;
+        };
+
+        /**
+         * Write a byte. The data is sent from Usb.Task() once a full packet has been written,
+         * when the latency set by setTxLatency() has expired, or when flush() is called.
+         * @param  data The byte to write.
+         * @return      Number of bytes written.
+         */
+#if defined(ARDUINO) && ARDUINO >=100
+        size_t write(uint8_t data) {
+                return write(&data, 1);
+        };
+
+        /**
+         * Write several bytes. If the buffer gets full, full packets are sent right away.
+         * @param  data The data to write.
+         * @param  size Number of bytes.
+         * @return      Number of bytes written, less than size if the phone stopped taking data.
+         */
+        size_t write(const uint8_t *data, size_t size);
+        /** Pull in write(const char *str) from Print */
+#if !defined(RBL_NRF51822) && !defined(NRF52_SERIES)
+        using Print::write;
+#endif
+#else
+        void write(uint8_t data) {
+                write(&data, 1);
+        };
+        void write(const uint8_t *data, size_t size);
+#endif
+
+        /** @return Number of bytes which can be written without sending data to the phone first. */
+        int availableForWrite(void) {
+                return txBuffer.room();
+        };
+
+        /** @return Number of bytes written, but not yet sent to the phone. */
+        uint16_t txPending(void) {
+                return txBuffer.available();
+        };
+
+        /** Send all data written with write() right away. */
+        void flush(void) {
+                SendBuffered(true);
+        };
+
+        /**
+         * Set how long data written with write() may wait for more data before it is sent.
+         * @param ms Time in ms, 0 sends the data on the next call to Usb.Task().
+         */
+        void setTxLatency(uint8_t ms) {
+                bTxLatency = ms;
+        };
+
+        /**
+         * Used to call your own function when the receive buffer fills up, so the sketch can drain it before polling is held off.
+         * The function is called from Usb.Task() once each time the number of buffered bytes reaches the level.
+         * @param funcOnRxHighWater Function to call, NULL to disable it.
+         * @param level             Number of buffered bytes which triggers the function.
+         */
+        void attachOnRxHighWater(void (*funcOnRxHighWater)(void), uint16_t level) {
+                pFuncOnRxHighWater = funcOnRxHighWater;
+                rxHighWater = level;
+                bRxAboveHighWater = false;
+        };
+
+        /** @return Number of bytes received since the counters were reset. */
+        uint32_t getRxBytes(void) {
+                return rxBytes;
+        };
+
+        /** @return Number of bytes sent since the counters were reset. */
+        uint32_t getTxBytes(void) {
+                return txBytes;
+        };
+
+        /** @return Number of times the receive buffer filled up, so the phone had to hold on to its data until the sketch read some. No data is lost. */
+        uint32_t getRxOverruns(void) {
+                return rxOverruns;
+        };
+
+        /** @return Capacity, current and peak occupancy of the receive buffer. */
+        USBBufferUsage getRxUsage(void) {
+                return rxBuffer.usage();
+        };
+
+        /** @return Capacity, current and peak occupancy of the transmit buffer. */
+        USBBufferUsage getTxUsage(void) {
+                return txBuffer.usage();
+        };
+
+        void resetCounters(void) {
+                rxBytes = 0;
+                txBytes = 0;
+                rxOverruns = 0;
+        };
+
 
         // USBDeviceConfig implementation
         uint8_t ConfigureDevice(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Release();
 
-        virtual uint8_t Poll() {
-                return 0;
-        };
+        uint8_t Poll();
 
         virtual uint8_t GetAddress() {
                 return bAddress;
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         virtual bool isReady() {
                 return ready;
         };
 
+        /** @return True while a phone is being switched to accessory mode. */
+        bool isSwitching() {
+                return accState != ADK_ACC_IDLE;
+        };
+
         virtual bool VIDPIDOK(uint16_t vid, uint16_t pid) {
                 return (vid == ADK_VID && (pid == ADK_PID || pid == ADB_PID));
         };
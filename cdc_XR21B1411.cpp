@@ -22,88 +22,37 @@ ACM(p, pasync) {
         _enhanced_status = enhanced_features(); // Set up features
 }
 
-uint8_t XR21B1411::Init(uint8_t parent, uint8_t port, bool lowspeed) {
-        const uint8_t constBufSize = sizeof (USB_DEVICE_DESCRIPTOR);
+uint8_t XR21B1411::ConfigureDevice(uint8_t parent __attribute__((unused)), uint8_t port __attribute__((unused)), bool lowspeed __attribute__((unused))) {
+        const USB_DEVICE_DESCRIPTOR *udd = pUsb->getConfiguringDevDescr();
 
-        uint8_t buf[constBufSize];
-        USB_DEVICE_DESCRIPTOR * udd = reinterpret_cast<USB_DEVICE_DESCRIPTOR*>(buf);
+        if(bAddress)
+                return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
+
+        if(!udd || !VIDPIDOK(udd->idVendor, udd->idProduct))
+                return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+        return 0;
+}
 
+uint8_t XR21B1411::Init(uint8_t parent __attribute__((unused)), uint8_t port __attribute__((unused)), bool lowspeed __attribute__((unused))) {
+        // The core has already given the device an address, see CoreAddressing()
+        const USB_DEVICE_DESCRIPTOR *udd = pUsb->getConfiguringDevDescr();
         uint8_t rcode;
-        UsbDevice *p = NULL;
-        EpInfo *oldep_ptr = NULL;
         uint8_t num_of_conf; // number of configurations
 
-        AddressPool &addrPool = pUsb->GetAddressPool();
-
         USBTRACE("XR Init\r\n");
 
-        if(bAddress)
-                return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
-
-        // Get pointer to pseudo device with address 0 assigned
-        p = addrPool.GetUsbDevicePtr(0);
-
-        if(!p)
+        if(!udd || !pUsb->getConfiguringAddress())
                 return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
 
-        if(!p->epinfo) {
-                USBTRACE("epinfo\r\n");
-                return USB_ERROR_EPINFO_IS_NULL;
-        }
-
-        // Save old pointer to EP_RECORD of address 0
-        oldep_ptr = p->epinfo;
-
-        // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
-        p->epinfo = epInfo;
-
-        p->lowspeed = lowspeed;
-
-        // Get device descriptor
-        rcode = pUsb->getDevDescr(0, 0, constBufSize, (uint8_t*)buf);
-
-        // Restore p->epinfo
-        p->epinfo = oldep_ptr;
-
-        if(rcode)
-                goto FailGetDevDescr;
-
-        // Allocate new address according to device class
-        bAddress = addrPool.AllocAddress(parent, false, port);
+        bAddress = pUsb->getConfiguringAddress();
 
-        if(!bAddress)
-                return USB_ERROR_OUT_OF_ADDRESS_SPACE_IN_POOL;
+        USBTRACE2("Addr:", bAddress);
 
         // Extract Max Packet Size from the device descriptor
         epInfo[0].maxPktSize = udd->bMaxPacketSize0;
 
-        // Assign new address to the device
-        rcode = pUsb->setAddr(0, 0, bAddress);
-
-        if(rcode) {
-                p->lowspeed = false;
-                addrPool.FreeAddress(bAddress);
-                bAddress = 0;
-                USBTRACE2("setAddr:", rcode);
-                return rcode;
-        }
-
-        USBTRACE2("Addr:", bAddress);
-
-        p->lowspeed = false;
-
-        p = addrPool.GetUsbDevicePtr(bAddress);
-
-        if(!p)
-                return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
-
-        p->lowspeed = lowspeed;
-
         num_of_conf = udd->bNumConfigurations;
 
-        if((((udd->idVendor != 0x2890U) || (udd->idProduct != 0x0201U)) && ((udd->idVendor != 0x04e2U) || (udd->idProduct != 0x1411U))))
-                return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
-
         // Assign epInfo to epinfo pointer
         rcode = pUsb->setEpInfoEntry(bAddress, 1, epInfo);
 
@@ -137,8 +86,10 @@ uint8_t XR21B1411::Init(uint8_t parent, uint8_t port, bool lowspeed) {
                         break;
         } // for
 
-        if(bNumEP < 4)
+        if(bNumEP < 4) {
+                Release();
                 return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+        }
 
         // Assign epInfo to epinfo pointer
         rcode = pUsb->setEpInfoEntry(bAddress, bNumEP, epInfo);
@@ -168,17 +119,11 @@ uint8_t XR21B1411::Init(uint8_t parent, uint8_t port, bool lowspeed) {
 
         ready = true;
 
-        //bPollEnable = true;
+        bPollEnable = true;
 
-        //USBTRACE("Poll enabled\r\n");
+        USBTRACE("Poll enabled\r\n");
         return 0;
 
-FailGetDevDescr:
-#ifdef DEBUG_USB_HOST
-        NotifyFailGetDevDescr();
-        goto Fail;
-#endif
-
 FailSetDevTblEntry:
 #ifdef DEBUG_USB_HOST
         NotifyFailSetDevTblEntry();
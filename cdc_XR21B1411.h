@@ -106,6 +106,8 @@ protected:
 public:
         XR21B1411(USB *pusb, CDCAsyncOper *pasync);
 
+        USB_DEVICE_MEMORY_USAGE();
+
         /**
          * Used by the USB core to check what this driver support.
          * @param  vid The device's VID.
@@ -116,6 +118,7 @@ public:
                 return (((vid == 0x2890U) && (pid == 0x0201U)) || ((vid == 0x04e2U) && (pid == 0x1411U)));
         };
 
+        uint8_t ConfigureDevice(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed);
 
         virtual tty_features enhanced_features(void) {
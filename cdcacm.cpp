@@ -29,7 +29,13 @@ bDataIface(0),
 bNumEP(1),
 qNextPollTime(0),
 bPollEnable(false),
-ready(false) {
+ready(false),
+rxOverruns(0),
+bRxHeld(false),
+qTxFlushTime(0),
+bTxLatency(CDC_TX_LATENCY),
+bTxZlpEnable(true),
+bTxZlpPending(false) {
         _enhanced_status = enhanced_features(); // Set up features
         for(uint8_t i = 0; i < ACM_MAX_ENDPOINTS; i++) {
                 epInfo[i].epAddr = 0;
@@ -43,84 +49,30 @@ ready(false) {
                 pUsb->RegisterDeviceClass(this);
 }
 
-uint8_t ACM::Init(uint8_t parent, uint8_t port, bool lowspeed) {
-
-        const uint8_t constBufSize = sizeof (USB_DEVICE_DESCRIPTOR);
-
-        uint8_t buf[constBufSize];
-        USB_DEVICE_DESCRIPTOR * udd = reinterpret_cast<USB_DEVICE_DESCRIPTOR*>(buf);
+uint8_t ACM::ConfigureDevice(uint8_t parent __attribute__((unused)), uint8_t port __attribute__((unused)), bool lowspeed __attribute__((unused))) {
+        if(bAddress)
+                return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
+        return 0;
+}
 
+uint8_t ACM::Init(uint8_t parent __attribute__((unused)), uint8_t port __attribute__((unused)), bool lowspeed __attribute__((unused))) {
+        // The core has already given the device an address, see CoreAddressing()
+        const USB_DEVICE_DESCRIPTOR *udd = pUsb->getConfiguringDevDescr();
         uint8_t rcode;
-        UsbDevice *p = NULL;
-        EpInfo *oldep_ptr = NULL;
         uint8_t num_of_conf; // number of configurations
 
-        AddressPool &addrPool = pUsb->GetAddressPool();
-
         USBTRACE("ACM Init\r\n");
 
-        if(bAddress)
-                return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
-
-        // Get pointer to pseudo device with address 0 assigned
-        p = addrPool.GetUsbDevicePtr(0);
-
-        if(!p)
+        if(!udd || !pUsb->getConfiguringAddress())
                 return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
 
-        if(!p->epinfo) {
-                USBTRACE("epinfo\r\n");
-                return USB_ERROR_EPINFO_IS_NULL;
-        }
-
-        // Save old pointer to EP_RECORD of address 0
-        oldep_ptr = p->epinfo;
-
-        // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
-        p->epinfo = epInfo;
-
-        p->lowspeed = lowspeed;
+        bAddress = pUsb->getConfiguringAddress();
 
-        // Get device descriptor
-        rcode = pUsb->getDevDescr(0, 0, constBufSize, (uint8_t*)buf);
-
-        // Restore p->epinfo
-        p->epinfo = oldep_ptr;
-
-        if(rcode)
-                goto FailGetDevDescr;
-
-        // Allocate new address according to device class
-        bAddress = addrPool.AllocAddress(parent, false, port);
-
-        if(!bAddress)
-                return USB_ERROR_OUT_OF_ADDRESS_SPACE_IN_POOL;
+        USBTRACE2("Addr:", bAddress);
 
         // Extract Max Packet Size from the device descriptor
         epInfo[0].maxPktSize = udd->bMaxPacketSize0;
 
-        // Assign new address to the device
-        rcode = pUsb->setAddr(0, 0, bAddress);
-
-        if(rcode) {
-                p->lowspeed = false;
-                addrPool.FreeAddress(bAddress);
-                bAddress = 0;
-                USBTRACE2("setAddr:", rcode);
-                return rcode;
-        }
-
-        USBTRACE2("Addr:", bAddress);
-
-        p->lowspeed = false;
-
-        p = addrPool.GetUsbDevicePtr(bAddress);
-
-        if(!p)
-                return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
-
-        p->lowspeed = lowspeed;
-
         num_of_conf = udd->bNumConfigurations;
 
         // Assign epInfo to epinfo pointer
@@ -156,8 +108,10 @@ uint8_t ACM::Init(uint8_t parent, uint8_t port, bool lowspeed) {
                         break;
         } // for
 
-        if(bNumEP < 4)
+        if(bNumEP < 4) {
+                Release();
                 return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+        }
 
         // Assign epInfo to epinfo pointer
         rcode = pUsb->setEpInfoEntry(bAddress, bNumEP, epInfo);
@@ -186,17 +140,11 @@ uint8_t ACM::Init(uint8_t parent, uint8_t port, bool lowspeed) {
 
         ready = true;
 
-        //bPollEnable = true;
+        bPollEnable = true;
 
-        //USBTRACE("Poll enabled\r\n");
+        USBTRACE("Poll enabled\r\n");
         return 0;
 
-FailGetDevDescr:
-#ifdef DEBUG_USB_HOST
-        NotifyFailGetDevDescr();
-        goto Fail;
-#endif
-
 FailSetDevTblEntry:
 #ifdef DEBUG_USB_HOST
         NotifyFailSetDevTblEntry();
@@ -266,33 +214,120 @@ uint8_t ACM::Release() {
         bAddress = 0;
         qNextPollTime = 0;
         bPollEnable = false;
+        rxBuffer.clear();
+        rxOverruns = 0;
+        bRxHeld = false;
+        txBuffer.clear();
+        bTxZlpPending = false;
         return 0;
 }
 
 uint8_t ACM::Poll() {
-        //uint8_t rcode = 0;
-        //if(!bPollEnable)
-        //        return 0;
-        //return rcode;
+        if(!bPollEnable)
+                return 0;
+
+        if(txBuffer.available() || bTxZlpPending) {
+                // A short time budget, so a device which does not read its data only delays the receive side
+                uint8_t rcode = SendBuffered((int32_t)((uint32_t)millis() - qTxFlushTime) >= 0L, USB_POLL_TX_TIMEOUT);
+                if(!bPollEnable)
+                        return rcode; // Released
+        }
+
+        uint8_t buf[64]; // Full speed bulk endpoints are at most 64 bytes
+        uint16_t rcvd = epInfo[epDataInIndex].maxPktSize;
+        if(rcvd == 0 || rcvd > sizeof (buf))
+                rcvd = sizeof (buf);
+
+        // Leave the data in the device until the sketch has made room for a whole packet
+        if(rxBuffer.room() < rcvd) {
+                if(!bRxHeld) {
+                        // Counted once per time the buffer fills up. No data is lost, as it stays in the device
+                        bRxHeld = true;
+                        rxOverruns++;
+                }
+                return 0;
+        }
+        bRxHeld = false;
+
+        uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, &rcvd, buf);
+        if(rcode) {
+                if(rcode == hrNAK)
+                        return 0;
+                if(!pUsb->recoverEp(bAddress, &epInfo[epDataInIndex], true, rcode))
+                        Release();
+                return rcode;
+        }
+        rxBuffer.write(buf, rcvd);
         return 0;
 }
 
 uint8_t ACM::RcvData(uint16_t *bytes_rcvd, uint8_t *dataptr) {
+        if(rxBuffer.available()) {
+                *bytes_rcvd = rxBuffer.read(dataptr, *bytes_rcvd);
+                return 0;
+        }
         uint8_t rv = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, bytes_rcvd, dataptr);
-        if(rv && rv != hrNAK) {
+        if(!pUsb->recoverEp(bAddress, &epInfo[epDataInIndex], true, rv)) {
                 Release();
         }
         return rv;
 }
 
 uint8_t ACM::SndData(uint16_t nbytes, uint8_t *dataptr) {
-        uint8_t rv = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, nbytes, dataptr);
-        if(rv && rv != hrNAK) {
+        uint8_t rv = SendBuffered(true);
+        if(rv)
+                return rv;
+        rv = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, nbytes, dataptr);
+        if(!rv && bTxZlpEnable && nbytes && (nbytes % epInfo[epDataOutIndex].maxPktSize) == 0)
+                rv = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, 0, NULL); // Terminate the transfer
+        if(!pUsb->recoverEp(bAddress, &epInfo[epDataOutIndex], false, rv)) {
                 Release();
         }
         return rv;
 }
 
+/* Send the data in txBuffer. Only full packets are sent unless 'all' is set, in which case
+   the buffer is emptied and a transfer ending on a packet boundary is terminated with a zero length packet */
+uint8_t ACM::SendBuffered(bool all, uint16_t timeout) {
+        uint8_t buf[64]; // Full speed bulk endpoints are at most 64 bytes
+        uint16_t pktSize = epInfo[epDataOutIndex].maxPktSize;
+        if(pktSize == 0 || pktSize > sizeof (buf))
+                pktSize = sizeof (buf);
+
+        while(txBuffer.available() >= pktSize || (all && (txBuffer.available() || bTxZlpPending))) {
+                uint16_t nbytes = txBuffer.peek(buf, pktSize);
+                uint8_t rv = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, nbytes, buf, timeout);
+                if(rv) {
+                        if(!pUsb->recoverEp(bAddress, &epInfo[epDataOutIndex], false, rv))
+                                Release();
+                        return rv; // The data is left in the buffer, so it is sent again next time on a NAK or cleared halt
+                }
+                txBuffer.skip(nbytes);
+                bTxZlpPending = bTxZlpEnable && nbytes == pktSize;
+        }
+        return 0;
+}
+
+#if defined(ARDUINO) && ARDUINO >=100
+size_t ACM::write(const uint8_t *data, size_t size) {
+#else
+void ACM::write(const uint8_t *data, size_t size) {
+#endif
+        size_t written = 0;
+
+        while(ready && written < size) {
+                if(!txBuffer.available())
+                        qTxFlushTime = (uint32_t)millis() + bTxLatency;
+                uint16_t len = (size - written > 0xFFFF) ? 0xFFFF : (uint16_t)(size - written);
+                written += txBuffer.write(data + written, len);
+                if(written < size && SendBuffered(false))
+                        break; // The device did not take the data
+        }
+#if defined(ARDUINO) && ARDUINO >=100
+        return written;
+#endif
+}
+
 uint8_t ACM::SetCommFeature(uint16_t fid, uint8_t nbytes, uint8_t *dataptr) {
         uint8_t rv = ( pUsb->ctrlReq(bAddress, 0, bmREQ_CDCOUT, CDC_SET_COMM_FEATURE, (fid & 0xff), (fid >> 8), bControlIface, nbytes, nbytes, dataptr, NULL));
         if(rv && rv != hrNAK) {
@@ -160,7 +160,11 @@ typedef struct {
 
 #define ACM_MAX_ENDPOINTS               4
 
-class ACM : public USBDeviceConfig, public UsbConfigXtracter {
+/**
+ * Driver for CDC-ACM devices.
+ * It inherits the Arduino Stream class, so the standard print and stream functions can be used on it.
+ */
+class ACM : public USBDeviceConfig, public UsbConfigXtracter, public Stream {
 protected:
         USB *pUsb;
         CDCAsyncOper *pAsync;
@@ -173,8 +177,17 @@ protected:
         volatile bool bPollEnable; // poll enable flag
         volatile bool ready; //device ready indicator
         tty_features _enhanced_status; // current status
+        USBRingBuffer<CDC_RX_BUFFER_SIZE> rxBuffer; // Data received from Poll()
+        uint32_t rxOverruns; // Number of times rxBuffer filled up, so the device had to hold on to its data
+        bool bRxHeld; // Polling is held off until rxBuffer has room for a packet
+        USBRingBuffer<CDC_TX_BUFFER_SIZE> txBuffer; // Data written with write()
+        uint32_t qTxFlushTime; // Time the oldest byte in txBuffer has to be sent
+        uint8_t bTxLatency; // Time in ms data may wait in txBuffer
+        bool bTxZlpEnable; // Terminate transfers which end on a packet boundary with a zero length packet
+        bool bTxZlpPending; // The last packet sent was a full packet
 
         void PrintEndpointDescriptor(const USB_ENDPOINT_DESCRIPTOR* ep_ptr);
+        uint8_t SendBuffered(bool all, uint16_t timeout = 0);
 
 public:
         static const uint8_t epDataInIndex; // DataIn endpoint index
@@ -194,22 +207,149 @@ public:
         uint8_t GetNotif(uint16_t *bytes_rcvd, uint8_t *dataptr);
 
         // Methods for receiving and sending data
+        // RcvData() returns data already received by Poll() first, and SndData() sends the data buffered by write() first,
+        // so they can be mixed with the Stream functions
         uint8_t RcvData(uint16_t *nbytesptr, uint8_t *dataptr);
         uint8_t SndData(uint16_t nbytes, uint8_t *dataptr);
 
         // USBDeviceConfig implementation
+        uint8_t ConfigureDevice(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Release();
         uint8_t Poll();
 
-        bool available(void) {
-                return false;
+        virtual bool CoreAddressing() {
+                return true;
+        };
+
+        /**
+         * Get number of bytes received in the background and waiting to be read.
+         * @return Return the number of bytes ready to be read.
+         */
+        int available(void) {
+                return rxBuffer.available();
+        };
+
+        /**
+         * Used to read the next value in the buffer without advancing to the next one.
+         * @return Return the byte. Will return -1 if no bytes are available.
+         */
+        int peek(void) {
+                return rxBuffer.peek();
+        };
+
+        /**
+         * Used to read the buffer.
+         * @return Return the byte. Will return -1 if no bytes are available.
+         */
+        int read(void) {
+                return rxBuffer.read();
+        };
+
+        /**
+         * Copy the received data to a buffer without waiting for more data, unlike Stream::readBytes() which waits for the timeout.
+         * @param  buffer Where to store the data.
+         * @param  length Maximum number of bytes to read.
+         * @return        Number of bytes copied.
+         */
+        size_t readAvailable(uint8_t *buffer, size_t length) {
+                return rxBuffer.read(buffer, (length > 0xFFFF) ? 0xFFFF : (uint16_t)length);
+        };
+
+        /** Discard all received data. */
+        void discard(void) {
+                rxBuffer.clear();
+        };
+
+        /**
+         * Enable or disable reading the bulk IN endpoint from Usb.Task().
+         * Polling is enabled when the device is configured.
+         * @param enable Set to false to only receive through RcvData().
+         */
+        void setRxPolling(bool enable) {
+                bPollEnable = enable && ready;
+        };
+
+#if defined(ARDUINO) && ARDUINO >=100
+        /**
+         * Writes the byte to send to a buffer. The data is sent when a packet is full,
+         * when the latency set by setTxLatency() has expired, or when flush() is called.
+         * @param  data The byte to write.
+         * @return      Return the number of bytes written.
+         */
+        size_t write(uint8_t data) {
+                return write(&data, 1);
+        };
+        /**
+         * Writes the bytes to send to a buffer. Full packets are sent right away if the buffer runs full.
+         * @param  data The data array to send.
+         * @param  size Size of the data.
+         * @return      Return the number of bytes written.
+         */
+        size_t write(const uint8_t *data, size_t size);
+        /** Pull in write(const char *str) from Print */
+#if !defined(RBL_NRF51822) && !defined(NRF52_SERIES)
+        using Print::write;
+#endif
+#else
+        void write(uint8_t data) {
+                write(&data, 1);
+        };
+        void write(const uint8_t *data, size_t size);
+#endif
+
+        /** @return Number of bytes which can be written without waiting for the device. */
+        int availableForWrite(void) {
+                return txBuffer.room();
+        };
+
+        /** Send out all bytes in the buffer. */
+        void flush(void) {
+                SendBuffered(true);
+        };
+
+        /**
+         * Set how long written data may be held back to fill up a packet.
+         * @param ms Time in ms, 0 sends the data on the next call to Usb.Task().
+         */
+        void setTxLatency(uint8_t ms) {
+                bTxLatency = ms;
+        };
+
+        /**
+         * Enable or disable sending a zero length packet after a transfer which is an exact multiple of the packet size.
+         * This is enabled by default.
+         * @param enable Set to false for devices which do not handle zero length packets.
+         */
+        void setTxZlp(bool enable) {
+                bTxZlpEnable = enable;
+        };
+
+        /** @return Number of times the receive buffer filled up, so the device had to hold on to its data until the sketch read some. No data is lost. */
+        uint32_t getRxOverruns(void) {
+                return rxOverruns;
+        };
+
+        void resetRxOverruns(void) {
+                rxOverruns = 0;
+        };
+
+        /** @return Capacity, current and peak occupancy of the receive buffer. */
+        USBBufferUsage getRxUsage(void) {
+                return rxBuffer.usage();
+        };
+
+        /** @return Capacity, current and peak occupancy of the transmit buffer. */
+        USBBufferUsage getTxUsage(void) {
+                return txBuffer.usage();
         };
 
         virtual uint8_t GetAddress() {
                 return bAddress;
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         virtual bool isReady() {
                 return ready;
         };
@@ -16,76 +16,64 @@ e-mail   :  support@circuitsathome.com
  */
 #include "cdcftdi.h"
 
-const uint8_t FTDI::epDataInIndex = 1;
-const uint8_t FTDI::epDataOutIndex = 2;
-const uint8_t FTDI::epInterruptInIndex = 3;
+FTDIPort::FTDIPort() :
+pFtdi(NULL),
+bIndex(0),
+epDataInIndex(0),
+epDataOutIndex(0),
+bTxLatency(CDC_TX_LATENCY),
+bTxZlpEnable(false) {
+        Reset();
+}
+
+/* Clear the state which belongs to a connected device */
+void FTDIPort::Reset() {
+        bLatency = 16; // Default of the chip
+        dwBaudRate = 0;
+        rxBuffer.clear();
+        memset(&status, 0, sizeof (FTDI_STATUS));
+        rxOverruns = 0;
+        bRxHeld = false;
+        txBuffer.clear();
+        qTxFlushTime = 0;
+        bTxZlpPending = false;
+}
 
 FTDI::FTDI(USB *p, FTDIAsyncOper *pasync, uint16_t idProduct) :
 pAsync(pasync),
 pUsb(p),
 bAddress(0),
+bNumIface(0),
 bNumEP(1),
 wFTDIType(0),
-wIdProduct(idProduct) {
+wIdProduct(idProduct),
+bNumPorts(0),
+bNextPort(0) {
         for(uint8_t i = 0; i < FTDI_MAX_ENDPOINTS; i++) {
                 epInfo[i].epAddr = 0;
                 epInfo[i].maxPktSize = (i) ? 0 : 8;
                 epInfo[i].bmSndToggle = 0;
                 epInfo[i].bmRcvToggle = 0;
-                epInfo[i].bmNakPower = (i == epDataInIndex) ? USB_NAK_NOWAIT : USB_NAK_MAX_POWER;
+                epInfo[i].bmNakPower = (i & 1) ? USB_NAK_NOWAIT : USB_NAK_MAX_POWER; // IN endpoints are polled
+        }
+        for(uint8_t i = 0; i < FTDI_MAX_PORTS; i++) {
+                ports[i].pFtdi = this;
+                ports[i].epDataInIndex = 1 + 2 * i;
+                ports[i].epDataOutIndex = 2 + 2 * i;
         }
         if(pUsb)
                 pUsb->RegisterDeviceClass(this);
 }
 
-uint8_t FTDI::Init(uint8_t parent, uint8_t port, bool lowspeed) {
-        const uint8_t constBufSize = sizeof (USB_DEVICE_DESCRIPTOR);
-
-        uint8_t buf[constBufSize];
-        USB_DEVICE_DESCRIPTOR * udd = reinterpret_cast<USB_DEVICE_DESCRIPTOR*>(buf);
-        uint8_t rcode;
-        UsbDevice *p = NULL;
-        EpInfo *oldep_ptr = NULL;
-
-        uint8_t num_of_conf; // number of configurations
-
-        AddressPool &addrPool = pUsb->GetAddressPool();
-
-        USBTRACE("FTDI Init\r\n");
+uint8_t FTDI::ConfigureDevice(uint8_t parent __attribute__((unused)), uint8_t port __attribute__((unused)), bool lowspeed __attribute__((unused))) {
+        const USB_DEVICE_DESCRIPTOR *udd = pUsb->getConfiguringDevDescr();
 
         if(bAddress) {
                 USBTRACE("FTDI CLASS IN USE??\r\n");
                 return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
         }
-        // Get pointer to pseudo device with address 0 assigned
-        p = addrPool.GetUsbDevicePtr(0);
-
-        if(!p) {
-                USBTRACE("FTDI NO ADDRESS??\r\n");
-                return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
-        }
-        if(!p->epinfo) {
-                USBTRACE("epinfo\r\n");
-                return USB_ERROR_EPINFO_IS_NULL;
-        }
-
-        // Save old pointer to EP_RECORD of address 0
-        oldep_ptr = p->epinfo;
-
-        // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
-        p->epinfo = epInfo;
-
-        p->lowspeed = lowspeed;
-
-        // Get device descriptor
-        rcode = pUsb->getDevDescr(0, 0, sizeof (USB_DEVICE_DESCRIPTOR), buf);
-
-        // Restore p->epinfo
-        p->epinfo = oldep_ptr;
-
-        if(rcode) {
-                goto FailGetDevDescr;
-        }
+        if(!udd)
+                return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
         if(udd->idVendor != FTDI_VID || udd->idProduct != wIdProduct) {
                 USBTRACE("FTDI Init: Product not supported\r\n");
                 USBTRACE2("Expected VID:", FTDI_VID);
@@ -95,43 +83,35 @@ uint8_t FTDI::Init(uint8_t parent, uint8_t port, bool lowspeed) {
                 USBTRACE2("Found PID:", udd->idProduct);
                 return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
         }
+        return 0;
+}
 
-        // Save type of FTDI chip
-        wFTDIType = udd->bcdDevice;
-
-        // Allocate new address according to device class
-        bAddress = addrPool.AllocAddress(parent, false, port);
-
-        if(!bAddress)
-                return USB_ERROR_OUT_OF_ADDRESS_SPACE_IN_POOL;
+uint8_t FTDI::Init(uint8_t parent __attribute__((unused)), uint8_t port __attribute__((unused)), bool lowspeed __attribute__((unused))) {
+        // The core has already given the device an address, see CoreAddressing()
+        const USB_DEVICE_DESCRIPTOR *udd = pUsb->getConfiguringDevDescr();
+        uint8_t rcode;
 
-        // Extract Max Packet Size from the device descriptor
-        epInfo[0].maxPktSize = udd->bMaxPacketSize0;
-        // Some devices set endpoint lengths to zero, which is incorrect.
-        // we should check them, and if zero, set them to 64.
-        if(epInfo[0].maxPktSize == 0) epInfo[0].maxPktSize = 64;
+        uint8_t num_of_conf; // number of configurations
 
-        // Assign new address to the device
-        rcode = pUsb->setAddr(0, 0, bAddress);
+        USBTRACE("FTDI Init\r\n");
 
-        if(rcode) {
-                p->lowspeed = false;
-                addrPool.FreeAddress(bAddress);
-                bAddress = 0;
-                USBTRACE2("setAddr:", rcode);
-                return rcode;
+        if(!udd || !pUsb->getConfiguringAddress()) {
+                USBTRACE("FTDI NO ADDRESS??\r\n");
+                return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
         }
 
-        USBTRACE2("Addr:", bAddress);
-
-        p->lowspeed = false;
+        bAddress = pUsb->getConfiguringAddress();
 
-        p = addrPool.GetUsbDevicePtr(bAddress);
+        USBTRACE2("Addr:", bAddress);
 
-        if(!p)
-                return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
+        // Save type of FTDI chip
+        wFTDIType = udd->bcdDevice;
 
-        p->lowspeed = lowspeed;
+        // Extract Max Packet Size from the device descriptor
+        epInfo[0].maxPktSize = udd->bMaxPacketSize0;
+        // Some devices set endpoint lengths to zero, which is incorrect.
+        // we should check them, and if zero, set them to 64.
+        if(epInfo[0].maxPktSize == 0) epInfo[0].maxPktSize = 64;
 
         num_of_conf = udd->bNumConfigurations;
 
@@ -161,10 +141,24 @@ uint8_t FTDI::Init(uint8_t parent, uint8_t port, bool lowspeed) {
                         break;
         } // for
 
-        if(bNumEP < 2)
-                return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+        // Use the ports up to the first one without a pair of bulk endpoints
+        for(bNumPorts = 0; bNumPorts < FTDI_MAX_PORTS; bNumPorts++) {
+                if(!epInfo[ports[bNumPorts].epDataInIndex].epAddr || !epInfo[ports[bNumPorts].epDataOutIndex].epAddr)
+                        break;
+        }
+
+        if(bNumPorts == 0) {
+                rcode = USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+                goto FailNoPorts;
+        }
+
+        for(uint8_t i = 0; i < bNumPorts; i++)
+                ports[i].bIndex = (bNumIface > 1) ? i + 1 : 0;
+
+        bNumEP = 1 + 2 * bNumPorts;
 
         USBTRACE2("NumEP:", bNumEP);
+        USBTRACE2("NumPorts:", bNumPorts);
 
         // Assign epInfo to epinfo pointer
         rcode = pUsb->setEpInfoEntry(bAddress, bNumEP, epInfo);
@@ -178,9 +172,11 @@ uint8_t FTDI::Init(uint8_t parent, uint8_t port, bool lowspeed) {
                 goto FailSetConfDescr;
 
         // default latency is 16ms on-chip, reduce it to 1
-        rcode = SetLatency(1);
-        if(rcode)
-                goto FailOnLatency;
+        for(uint8_t i = 0; i < bNumPorts; i++) {
+                rcode = ports[i].SetLatency(1);
+                if(rcode)
+                        goto FailOnLatency;
+        }
 
 
         rcode = pAsync->OnInit(this);
@@ -191,17 +187,18 @@ uint8_t FTDI::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         USBTRACE("FTDI configured\r\n");
 
         ready = true;
+        bPollEnable = true;
         return 0;
 
-FailOnLatency:
+FailNoPorts:
 #ifdef DEBUG_USB_HOST
-        USBTRACE("SetLatency: ");
+        USBTRACE("No port with bulk endpoints: ");
         goto Fail;
 #endif
 
-FailGetDevDescr:
+FailOnLatency:
 #ifdef DEBUG_USB_HOST
-        NotifyFailGetDevDescr();
+        USBTRACE("SetLatency: ");
         goto Fail;
 #endif
 
@@ -241,15 +238,15 @@ void FTDI::EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t prot
 
         bConfNum = conf;
 
-        uint8_t index;
-
-        if((pep->bmAttributes & bmUSB_TRANSFER_TYPE) == USB_TRANSFER_TYPE_INTERRUPT && (pep->bEndpointAddress & 0x80) == 0x80)
-                index = epInterruptInIndex;
-        else if((pep->bmAttributes & bmUSB_TRANSFER_TYPE) == USB_TRANSFER_TYPE_BULK)
-                index = ((pep->bEndpointAddress & 0x80) == 0x80) ? epDataInIndex : epDataOutIndex;
-        else
+        if(alt != 0)
+                return;
+        if(iface >= bNumIface)
+                bNumIface = iface + 1;
+        if(iface >= FTDI_MAX_PORTS || (pep->bmAttributes & bmUSB_TRANSFER_TYPE) != USB_TRANSFER_TYPE_BULK)
                 return;
 
+        uint8_t index = ((pep->bEndpointAddress & 0x80) == 0x80) ? ports[iface].epDataInIndex : ports[iface].epDataOutIndex;
+
         // Fill in the endpoint info structure
         epInfo[index].epAddr = (pep->bEndpointAddress & 0x0F);
         epInfo[index].maxPktSize = (uint8_t)pep->wMaxPacketSize;
@@ -269,33 +266,129 @@ uint8_t FTDI::Release() {
 
         bAddress = 0;
         bNumEP = 1;
+        bNumIface = 0;
+        bNumPorts = 0;
+        bNextPort = 0;
         qNextPollTime = 0;
         bPollEnable = false;
         ready = false;
+        for(uint8_t i = 1; i < FTDI_MAX_ENDPOINTS; i++)
+                epInfo[i].epAddr = 0;
+        for(uint8_t i = 0; i < FTDI_MAX_PORTS; i++)
+                ports[i].Reset();
         return pAsync->OnRelease(this);
 }
 
 uint8_t FTDI::Poll() {
         uint8_t rcode = 0;
 
-        //if (!bPollEnable)
-        //      return 0;
+        // Every port gets at most one packet in each direction per call,
+        // starting with a different port each time, so a busy port can not hold up the others
+        for(uint8_t i = 0; i < bNumPorts && bPollEnable; i++) {
+                FTDIPort &port = ports[(bNextPort + i) % bNumPorts];
+
+                rcode = port.PollTx();
+                if(!bPollEnable)
+                        return rcode; // Released
+                rcode = port.PollRx();
+                if(rcode && rcode != hrNAK)
+                        return rcode;
+        }
+        if(bNumPorts && ++bNextPort >= bNumPorts)
+                bNextPort = 0;
+        return 0;
+}
+
+uint8_t FTDIPort::PollTx() {
+        if(!txBuffer.available() && !bTxZlpPending)
+                return 0;
+        // A short time budget, so a device which does not read its data only delays the receive side
+        return SendBuffered((int32_t)((uint32_t)millis() - qTxFlushTime) >= 0L, true, USB_POLL_TX_TIMEOUT);
+}
 
-        //if (qNextPollTime <= (uint32_t)millis())
-        //{
-        //      USB_HOST_SERIAL.println(bAddress, HEX);
+uint8_t FTDIPort::PollRx() {
+        uint8_t buf[64]; // Full speed bulk endpoints are at most 64 bytes
+        uint16_t rcvd = pFtdi->epInfo[epDataInIndex].maxPktSize;
+        if(rcvd > sizeof (buf))
+                rcvd = sizeof (buf);
+
+        // Leave the data in the device until the sketch has made room for a whole packet
+        if(rxBuffer.room() < rcvd - 2) {
+                if(!bRxHeld) {
+                        // Counted once per time the buffer fills up. No data is lost, as it stays in the device
+                        bRxHeld = true;
+                        rxOverruns++;
+                }
+                return 0;
+        }
+        bRxHeld = false;
 
-        //      qNextPollTime = (uint32_t)millis() + 100;
-        //}
-        return rcode;
+        uint8_t rcode = pFtdi->pUsb->inTransfer(pFtdi->bAddress, pFtdi->epInfo[epDataInIndex].epAddr, &rcvd, buf);
+        if(rcode) {
+                if(rcode == hrNAK)
+                        return 0;
+                if(!pFtdi->pUsb->recoverEp(pFtdi->bAddress, &pFtdi->epInfo[epDataInIndex], true, rcode))
+                        pFtdi->Release();
+                return rcode;
+        }
+
+        // The data of each packet goes straight into the buffer, without its two status bytes
+        uint16_t pktSize = pFtdi->epInfo[epDataInIndex].maxPktSize;
+        for(uint16_t in = 0; in + 2 <= rcvd; in += pktSize) {
+                uint16_t len = rcvd - in;
+                if(len > pktSize)
+                        len = pktSize;
+                ParseStatus(buf + in);
+                rxBuffer.write(buf + in + 2, len - 2);
+        }
+        return 0;
+}
+
+/* The device reserves the first two bytes of every packet for the modem and line status */
+void FTDIPort::ParseStatus(const uint8_t *pkt) {
+        uint8_t modem = pkt[0] & 0xF0; // The lower nibble is reserved
+        status.bModemChanged |= modem ^ status.bModemStatus;
+        status.bModemStatus = modem;
+        status.bLineStatus = pkt[1];
+        status.bLineErrors |= pkt[1] & FTDI_SIO_LINE_ERROR_MASK;
 }
 
-uint8_t FTDI::SetBaudRate(uint32_t baud) {
+/* Store the status bytes of every packet and move the data down over them, for data read into the buffer of the caller.
+   Returns the number of data bytes left. */
+uint16_t FTDIPort::StripStatus(uint8_t *dataptr, uint16_t nbytes) {
+        uint16_t pktSize = pFtdi->epInfo[epDataInIndex].maxPktSize;
+        uint16_t in = 0, out = 0;
+
+        while(in + 2 <= nbytes) {
+                uint16_t len = nbytes - in;
+                if(len > pktSize)
+                        len = pktSize;
+
+                ParseStatus(dataptr + in);
+
+                if(out != in + 2)
+                        memmove(dataptr + out, dataptr + in + 2, len - 2);
+                out += len - 2;
+                in += len;
+        }
+        return out;
+}
+
+/* Vendor request to this port. The port number goes into the low byte of wIndex */
+uint8_t FTDIPort::VendorOut(uint8_t bRequest, uint16_t wValue, uint8_t wIndexHi) {
+        uint8_t rv = pFtdi->pUsb->ctrlReq(pFtdi->bAddress, 0, bmREQ_FTDI_OUT, bRequest, wValue & 0xff, wValue >> 8, (wIndexHi << 8) | bIndex, 0, 0, NULL, NULL);
+        if(rv && rv != hrNAK) {
+                pFtdi->Release();
+        }
+        return rv;
+}
+
+uint8_t FTDIPort::SetBaudRate(uint32_t baud) {
         uint16_t baud_value, baud_index = 0;
         uint32_t divisor3;
         divisor3 = 48000000 / 2 / baud; // divisor shifted 3 bits to the left
 
-        if(wFTDIType == FT232AM) {
+        if(pFtdi->wFTDIType == FT232AM) {
                 if((divisor3 & 0x7) == 7)
                         divisor3++; // round x.7/8 up to x+1
 
@@ -323,71 +416,122 @@ uint8_t FTDI::SetBaudRate(uint32_t baud) {
         }
         USBTRACE2("baud_value:", baud_value);
         USBTRACE2("baud_index:", baud_index);
-        uint8_t rv = pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_SET_BAUD_RATE, baud_value & 0xff, baud_value >> 8, baud_index, 0, 0, NULL, NULL);
-        if(rv && rv != hrNAK) {
-                Release();
+        uint8_t rv;
+        // The newer chips take the port in the low byte and the divisor in the high byte of wIndex
+        uint16_t type = pFtdi->wFTDIType;
+        if(type == FT2232 || type == FT2232H || type == FT4232H || type == FT232H)
+                rv = VendorOut(FTDI_SIO_SET_BAUD_RATE, baud_value, baud_index); // Releases the device on an error
+        else {
+                rv = pFtdi->pUsb->ctrlReq(pFtdi->bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_SET_BAUD_RATE, baud_value & 0xff, baud_value >> 8, baud_index, 0, 0, NULL, NULL);
+                if(rv && rv != hrNAK)
+                        pFtdi->Release();
         }
+        if(!rv)
+                dwBaudRate = baud;
         return rv;
 }
 
 // No docs on if this is 8 or 16 bit, so play it safe, make maximum 255ms
 
-uint8_t FTDI::SetLatency(uint8_t l) {
-        uint8_t rv = pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_SET_LATENCY_TIMER, l, 0, 0, 0, 0, NULL, NULL);
-        if(rv && rv != hrNAK) {
-                Release();
-        }
+uint8_t FTDIPort::SetLatency(uint8_t l) {
+        uint8_t rv = VendorOut(FTDI_SIO_SET_LATENCY_TIMER, l);
+        if(!rv)
+                bLatency = l;
         return rv;
 }
 
 // No docs on if this is 8 or 16 bit, so play it safe, make maximum 255ms
 
-uint8_t FTDI::GetLatency(uint8_t *l) {
-        uint8_t rv = pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_GET_LATENCY_TIMER, 0, 0, 0, 0, 1, (uint8_t *)l, NULL);
+uint8_t FTDIPort::GetLatency(uint8_t *l) {
+        uint8_t rv = pFtdi->pUsb->ctrlReq(pFtdi->bAddress, 0, bmREQ_FTDI_IN, FTDI_SIO_GET_LATENCY_TIMER, 0, 0, bIndex, 1, 1, (uint8_t *)l, NULL);
         if(rv && rv != hrNAK) {
-                Release();
+                pFtdi->Release();
         }
         return rv;
 }
 
-uint8_t FTDI::SetModemControl(uint16_t signal) {
-        uint8_t rv = pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_MODEM_CTRL, signal & 0xff, signal >> 8, 0, 0, 0, NULL, NULL);
-        if(rv && rv != hrNAK) {
-                Release();
-        }
-        return rv;
+uint8_t FTDIPort::SetModemControl(uint16_t signal) {
+        return VendorOut(FTDI_SIO_MODEM_CTRL, signal);
 }
 
-uint8_t FTDI::SetFlowControl(uint8_t protocol, uint8_t xon, uint8_t xoff) {
-        uint8_t rv = pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_SET_FLOW_CTRL, xon, xoff, protocol << 8, 0, 0, NULL, NULL);
-        if(rv && rv != hrNAK) {
-                Release();
+uint8_t FTDIPort::SetFlowControl(uint8_t protocol, uint8_t xon, uint8_t xoff) {
+        return VendorOut(FTDI_SIO_SET_FLOW_CTRL, (xoff << 8) | xon, protocol);
+}
+
+uint8_t FTDIPort::SetData(uint16_t databm) {
+        return VendorOut(FTDI_SIO_SET_DATA, databm);
+}
+
+uint8_t FTDIPort::RcvData(uint16_t *bytes_rcvd, uint8_t *dataptr) {
+        if(rxBuffer.available()) {
+                *bytes_rcvd = rxBuffer.read(dataptr, *bytes_rcvd);
+                return 0;
         }
+        uint8_t rv = pFtdi->pUsb->inTransfer(pFtdi->bAddress, pFtdi->epInfo[epDataInIndex].epAddr, bytes_rcvd, dataptr);
+        if(!pFtdi->pUsb->recoverEp(pFtdi->bAddress, &pFtdi->epInfo[epDataInIndex], true, rv)) {
+                pFtdi->Release();
+        }
+        if(!rv)
+                *bytes_rcvd = StripStatus(dataptr, *bytes_rcvd);
         return rv;
 }
 
-uint8_t FTDI::SetData(uint16_t databm) {
-        uint8_t rv = pUsb->ctrlReq(bAddress, 0, bmREQ_FTDI_OUT, FTDI_SIO_SET_DATA, databm & 0xff, databm >> 8, 0, 0, 0, NULL, NULL);
-        if(rv && rv != hrNAK) {
-                Release();
+uint8_t FTDIPort::SndData(uint16_t nbytes, uint8_t *dataptr) {
+        uint8_t rv = SendBuffered(true);
+        if(rv)
+                return rv;
+        rv = pFtdi->pUsb->outTransfer(pFtdi->bAddress, pFtdi->epInfo[epDataOutIndex].epAddr, nbytes, dataptr);
+        if(!rv && bTxZlpEnable && nbytes && (nbytes % pFtdi->epInfo[epDataOutIndex].maxPktSize) == 0)
+                rv = pFtdi->pUsb->outTransfer(pFtdi->bAddress, pFtdi->epInfo[epDataOutIndex].epAddr, 0, NULL); // Terminate the transfer
+        if(!pFtdi->pUsb->recoverEp(pFtdi->bAddress, &pFtdi->epInfo[epDataOutIndex], false, rv)) {
+                pFtdi->Release();
         }
         return rv;
 }
 
-uint8_t FTDI::RcvData(uint16_t *bytes_rcvd, uint8_t *dataptr) {
-        uint8_t rv = pUsb->inTransfer(bAddress, epInfo[epDataInIndex].epAddr, bytes_rcvd, dataptr);
-        if(rv && rv != hrNAK) {
-                Release();
+/* Send the data in txBuffer. Only full packets are sent unless 'all' is set, in which case
+   the buffer is emptied and a transfer ending on a packet boundary is terminated with a zero length packet.
+   If 'single' is set at most one packet is sent */
+uint8_t FTDIPort::SendBuffered(bool all, bool single, uint16_t timeout) {
+        uint8_t buf[64]; // Full speed bulk endpoints are at most 64 bytes
+        uint16_t pktSize = pFtdi->epInfo[epDataOutIndex].maxPktSize;
+        if(pktSize == 0 || pktSize > sizeof (buf))
+                pktSize = sizeof (buf);
+
+        while(txBuffer.available() >= pktSize || (all && (txBuffer.available() || bTxZlpPending))) {
+                uint16_t nbytes = txBuffer.peek(buf, pktSize);
+                uint8_t rv = pFtdi->pUsb->outTransfer(pFtdi->bAddress, pFtdi->epInfo[epDataOutIndex].epAddr, nbytes, buf, timeout);
+                if(rv) {
+                        if(!pFtdi->pUsb->recoverEp(pFtdi->bAddress, &pFtdi->epInfo[epDataOutIndex], false, rv))
+                                pFtdi->Release();
+                        return rv; // The data is left in the buffer, so it is sent again next time on a NAK or cleared halt
+                }
+                txBuffer.skip(nbytes);
+                bTxZlpPending = bTxZlpEnable && nbytes == pktSize;
+                if(single)
+                        break;
         }
-        return rv;
+        return 0;
 }
 
-uint8_t FTDI::SndData(uint16_t nbytes, uint8_t *dataptr) {
-        uint8_t rv = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, nbytes, dataptr);
-        if(rv && rv != hrNAK) {
-                Release();
+#if defined(ARDUINO) && ARDUINO >=100
+size_t FTDIPort::write(const uint8_t *data, size_t size) {
+#else
+void FTDIPort::write(const uint8_t *data, size_t size) {
+#endif
+        size_t written = 0;
+
+        while(pFtdi->ready && written < size) {
+                if(!txBuffer.available())
+                        qTxFlushTime = (uint32_t)millis() + bTxLatency;
+                uint16_t len = (size - written > 0xFFFF) ? 0xFFFF : (uint16_t)(size - written);
+                written += txBuffer.write(data + written, len);
+                if(written < size && SendBuffered(false))
+                        break; // The device did not take the data
         }
-        return rv;
+#if defined(ARDUINO) && ARDUINO >=100
+        return written;
+#endif
 }
 
 void FTDI::PrintEndpointDescriptor(const USB_ENDPOINT_DESCRIPTOR* ep_ptr) {
@@ -27,11 +27,16 @@ e-mail   :  support@circuitsathome.com
 
 #define FTDI_VID                        0x0403  // FTDI VID
 #define FTDI_PID                        0x6001  // FTDI PID
+#define FTDI_PID_FT2232                 0x6010  // Dual port chips
+#define FTDI_PID_FT4232                 0x6011  // Quad port chips
 
 #define FT232AM                         0x0200
 #define FT232BM                         0x0400
 #define FT2232                          0x0500
 #define FT232R                          0x0600
+#define FT2232H                         0x0700
+#define FT4232H                         0x0800
+#define FT232H                          0x0900
 
 // Commands
 #define FTDI_SIO_RESET                  0  /* Reset the port */
@@ -76,6 +81,25 @@ e-mail   :  support@circuitsathome.com
 #define FTDI_SIO_RI_MASK                0x40
 #define FTDI_SIO_RLSD_MASK              0x80
 
+// Line status, second byte of every bulk IN packet
+#define FTDI_SIO_DR_MASK                0x01 // Data ready
+#define FTDI_SIO_OE_MASK                0x02 // Overrun error
+#define FTDI_SIO_PE_MASK                0x04 // Parity error
+#define FTDI_SIO_FE_MASK                0x08 // Framing error
+#define FTDI_SIO_BI_MASK                0x10 // Break interrupt
+#define FTDI_SIO_THRE_MASK              0x20 // Transmitter holding register empty
+#define FTDI_SIO_TEMT_MASK              0x40 // Transmitter empty
+#define FTDI_SIO_FIFO_ERR_MASK          0x80 // Error in receiver FIFO
+#define FTDI_SIO_LINE_ERROR_MASK        (FTDI_SIO_OE_MASK | FTDI_SIO_PE_MASK | FTDI_SIO_FE_MASK | FTDI_SIO_BI_MASK | FTDI_SIO_FIFO_ERR_MASK)
+
+/** Modem and line status reported by the device at the start of every bulk IN packet. */
+typedef struct {
+        uint8_t bModemStatus; // Latest modem status, see FTDI_SIO_CTS_MASK etc.
+        uint8_t bLineStatus; // Latest line status, see FTDI_SIO_DR_MASK etc.
+        uint8_t bModemChanged; // Modem status bits which have changed since ClearStatus()
+        uint8_t bLineErrors; // Line errors which have occurred since ClearStatus(), see FTDI_SIO_LINE_ERROR_MASK
+} FTDI_STATUS;
+
 class FTDI;
 
 class FTDIAsyncOper {
@@ -90,15 +114,194 @@ public:
         };
 };
 
+// Every port uses a bulk IN and a bulk OUT endpoint. Port n uses epInfo[1 + 2 * n] and epInfo[2 + 2 * n].
+#define FTDI_MAX_ENDPOINTS              (1 + 2 * FTDI_MAX_PORTS)
+
+/**
+ * One UART of an FTDI chip. Dual and quad chips like the FT2232 and FT4232 have several of them.
+ * It inherits the Arduino Stream class, so the standard print and stream functions can be used on it.
+ */
+class FTDIPort : public Stream {
+        friend class FTDI;
+
+        FTDI *pFtdi;
+        uint8_t bIndex; // wIndex of the vendor requests, 0 on single port chips and 1 for port A on multi port chips
+        uint8_t epDataInIndex; // DataIn endpoint index
+        uint8_t epDataOutIndex; // DataOUT endpoint index
+        uint8_t bLatency; // Latency timer of the chip in ms
+        uint32_t dwBaudRate; // Last baud rate set
+
+        USBRingBuffer<CDC_RX_BUFFER_SIZE> rxBuffer; // Data received from Poll()
+        FTDI_STATUS status;
+        uint32_t rxOverruns; // Number of times rxBuffer filled up, so the device had to hold on to its data
+        bool bRxHeld; // Polling is held off until rxBuffer has room for a packet
+        USBRingBuffer<CDC_TX_BUFFER_SIZE> txBuffer; // Data written with write()
+        uint32_t qTxFlushTime; // Time the oldest byte in txBuffer has to be sent
+        uint8_t bTxLatency; // Time in ms data may wait in txBuffer
+        bool bTxZlpEnable; // Terminate transfers which end on a packet boundary with a zero length packet
+        bool bTxZlpPending; // The last packet sent was a full packet
+
+        void Reset();
+        uint8_t PollRx();
+        uint8_t PollTx();
+        uint8_t VendorOut(uint8_t bRequest, uint16_t wValue, uint8_t wIndexHi = 0);
+        void ParseStatus(const uint8_t *pkt);
+        uint16_t StripStatus(uint8_t *dataptr, uint16_t nbytes);
+        uint8_t SendBuffered(bool all, bool single = false, uint16_t timeout = 0);
+
+public:
+        FTDIPort();
+
+        uint8_t SetBaudRate(uint32_t baud);
+        uint8_t SetModemControl(uint16_t control);
+        uint8_t SetFlowControl(uint8_t protocol, uint8_t xon = 0x11, uint8_t xoff = 0x13);
+        uint8_t SetData(uint16_t databm);
+        uint8_t SetLatency(uint8_t l);
+        uint8_t GetLatency(uint8_t *l);
+
+        /** @return The baud rate last set with SetBaudRate(). */
+        uint32_t GetBaudRate(void) {
+                return dwBaudRate;
+        };
+
+        // Methods for receiving and sending data
+        // The status bytes are removed from the received data, use GetStatus() to read them.
+        // RcvData() returns data already received by Poll() first, and SndData() sends the data buffered by write() first
+        uint8_t RcvData(uint16_t *bytes_rcvd, uint8_t *dataptr);
+        uint8_t SndData(uint16_t nbytes, uint8_t *dataptr);
+
+        /**
+         * Get number of bytes received in the background and waiting to be read.
+         * @return Return the number of bytes ready to be read.
+         */
+        int available(void) {
+                return rxBuffer.available();
+        };
+
+        /**
+         * Used to read the next value in the buffer without advancing to the next one.
+         * @return Return the byte. Will return -1 if no bytes are available.
+         */
+        int peek(void) {
+                return rxBuffer.peek();
+        };
+
+        /**
+         * Used to read the buffer.
+         * @return Return the byte. Will return -1 if no bytes are available.
+         */
+        int read(void) {
+                return rxBuffer.read();
+        };
+
+        /**
+         * Copy the received data to a buffer without waiting for more data, unlike Stream::readBytes() which waits for the timeout.
+         * @param  buffer Where to store the data.
+         * @param  length Maximum number of bytes to read.
+         * @return        Number of bytes copied.
+         */
+        size_t readAvailable(uint8_t *buffer, size_t length) {
+                return rxBuffer.read(buffer, (length > 0xFFFF) ? 0xFFFF : (uint16_t)length);
+        };
+
+        /** Discard all received data. */
+        void discard(void) {
+                rxBuffer.clear();
+        };
+
+#if defined(ARDUINO) && ARDUINO >=100
+        /**
+         * Writes the byte to send to a buffer. The data is sent when a packet is full,
+         * when the latency set by setTxLatency() has expired, or when flush() is called.
+         * @param  data The byte to write.
+         * @return      Return the number of bytes written.
+         */
+        size_t write(uint8_t data) {
+                return write(&data, 1);
+        };
+        /**
+         * Writes the bytes to send to a buffer. Full packets are sent right away if the buffer runs full.
+         * @param  data The data array to send.
+         * @param  size Size of the data.
+         * @return      Return the number of bytes written.
+         */
+        size_t write(const uint8_t *data, size_t size);
+        /** Pull in write(const char *str) from Print */
+#if !defined(RBL_NRF51822) && !defined(NRF52_SERIES)
+        using Print::write;
+#endif
+#else
+        void write(uint8_t data) {
+                write(&data, 1);
+        };
+        void write(const uint8_t *data, size_t size);
+#endif
+
+        /** @return Number of bytes which can be written without waiting for the device. */
+        int availableForWrite(void) {
+                return txBuffer.room();
+        };
+
+        /** Send out all bytes in the buffer. */
+        void flush(void) {
+                SendBuffered(true);
+        };
+
+        /**
+         * Set how long written data may be held back to fill up a packet.
+         * @param ms Time in ms, 0 sends the data on the next call to Usb.Task().
+         */
+        void setTxLatency(uint8_t ms) {
+                bTxLatency = ms;
+        };
+
+        /**
+         * Enable or disable sending a zero length packet after a transfer which is an exact multiple of the packet size.
+         * The chip handles every packet on its own, so this is disabled by default.
+         * @param enable Set to true to terminate transfers with a zero length packet.
+         */
+        void setTxZlp(bool enable) {
+                bTxZlpEnable = enable;
+        };
+
+        /** @return Modem and line status from the last packet received. */
+        const FTDI_STATUS &GetStatus(void) {
+                return status;
+        };
+
+        /** Clear FTDI_STATUS::bModemChanged and FTDI_STATUS::bLineErrors. */
+        void ClearStatus(void) {
+                status.bModemChanged = 0;
+                status.bLineErrors = 0;
+        };
+
+        /** @return Number of times the receive buffer filled up, so the device had to hold on to its data until the sketch read some. No data is lost. */
+        uint32_t getRxOverruns(void) {
+                return rxOverruns;
+        };
+
+        void resetRxOverruns(void) {
+                rxOverruns = 0;
+        };
+
+        /** @return Capacity, current and peak occupancy of the receive buffer. */
+        USBBufferUsage getRxUsage(void) {
+                return rxBuffer.usage();
+        };
 
-// Only single port chips are currently supported by the library,
-//              so only three endpoints are allocated.
-#define FTDI_MAX_ENDPOINTS              3
+        /** @return Capacity, current and peak occupancy of the transmit buffer. */
+        USBBufferUsage getTxUsage(void) {
+                return txBuffer.usage();
+        };
+};
 
-class FTDI : public USBDeviceConfig, public UsbConfigXtracter {
-        static const uint8_t epDataInIndex; // DataIn endpoint index
-        static const uint8_t epDataOutIndex; // DataOUT endpoint index
-        static const uint8_t epInterruptInIndex; // InterruptIN  endpoint index
+/**
+ * Driver for FTDI USB to serial converters.
+ * All interfaces of multi port chips are used, see getPort(). The functions of this class act on the first port.
+ * It inherits the Arduino Stream class, so the standard print and stream functions can be used on it.
+ */
+class FTDI : public USBDeviceConfig, public UsbConfigXtracter, public Stream {
+        friend class FTDIPort;
 
         FTDIAsyncOper *pAsync;
         USB *pUsb;
@@ -111,26 +314,66 @@ class FTDI : public USBDeviceConfig, public UsbConfigXtracter {
         volatile bool ready; //device ready indicator
         uint16_t wFTDIType; // Type of FTDI chip
         uint16_t wIdProduct; // expected PID
+        uint8_t bNumPorts; // Number of ports in use
+        uint8_t bNextPort; // Port polled first on the next call to Poll()
 
         EpInfo epInfo[FTDI_MAX_ENDPOINTS];
+        FTDIPort ports[FTDI_MAX_PORTS];
 
         void PrintEndpointDescriptor(const USB_ENDPOINT_DESCRIPTOR* ep_ptr);
 
 public:
         FTDI(USB *pusb, FTDIAsyncOper *pasync, uint16_t idProduct = FTDI_PID);
 
-        uint8_t SetBaudRate(uint32_t baud);
-        uint8_t SetModemControl(uint16_t control);
-        uint8_t SetFlowControl(uint8_t protocol, uint8_t xon = 0x11, uint8_t xoff = 0x13);
-        uint8_t SetData(uint16_t databm);
-        uint8_t SetLatency(uint8_t l);
-        uint8_t GetLatency(uint8_t *l);
+        /** @return Number of ports of the connected chip, limited to FTDI_MAX_PORTS. */
+        uint8_t getNumPorts(void) {
+                return bNumPorts;
+        };
+
+        /**
+         * Get one port of a multi port chip.
+         * @param  port 0 for port A, 1 for port B etc.
+         * @return      Pointer to the port or NULL if the chip does not have it.
+         */
+        FTDIPort *getPort(uint8_t port) {
+                return (port < bNumPorts) ? &ports[port] : NULL;
+        };
+
+        uint8_t SetBaudRate(uint32_t baud) {
+                return ports[0].SetBaudRate(baud);
+        };
+
+        uint8_t SetModemControl(uint16_t control) {
+                return ports[0].SetModemControl(control);
+        };
+
+        uint8_t SetFlowControl(uint8_t protocol, uint8_t xon = 0x11, uint8_t xoff = 0x13) {
+                return ports[0].SetFlowControl(protocol, xon, xoff);
+        };
+
+        uint8_t SetData(uint16_t databm) {
+                return ports[0].SetData(databm);
+        };
+
+        uint8_t SetLatency(uint8_t l) {
+                return ports[0].SetLatency(l);
+        };
+
+        uint8_t GetLatency(uint8_t *l) {
+                return ports[0].GetLatency(l);
+        };
 
         // Methods for receiving and sending data
-        uint8_t RcvData(uint16_t *bytes_rcvd, uint8_t *dataptr);
-        uint8_t SndData(uint16_t nbytes, uint8_t *dataptr);
+        uint8_t RcvData(uint16_t *bytes_rcvd, uint8_t *dataptr) {
+                return ports[0].RcvData(bytes_rcvd, dataptr);
+        };
+
+        uint8_t SndData(uint16_t nbytes, uint8_t *dataptr) {
+                return ports[0].SndData(nbytes, dataptr);
+        };
 
         // USBDeviceConfig implementation
+        uint8_t ConfigureDevice(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Release();
         uint8_t Poll();
@@ -139,11 +382,108 @@ public:
                 return bAddress;
         };
 
+        virtual bool CoreAddressing() {
+                return true;
+        };
+
+        USB_DEVICE_MEMORY_USAGE();
+
+        int available(void) {
+                return ports[0].available();
+        };
+
+        int peek(void) {
+                return ports[0].peek();
+        };
+
+        int read(void) {
+                return ports[0].read();
+        };
+
+        size_t readAvailable(uint8_t *buffer, size_t length) {
+                return ports[0].readAvailable(buffer, length);
+        };
+
+        void discard(void) {
+                ports[0].discard();
+        };
+
+#if defined(ARDUINO) && ARDUINO >=100
+        size_t write(uint8_t data) {
+                return ports[0].write(data);
+        };
+
+        size_t write(const uint8_t *data, size_t size) {
+                return ports[0].write(data, size);
+        };
+        /** Pull in write(const char *str) from Print */
+#if !defined(RBL_NRF51822) && !defined(NRF52_SERIES)
+        using Print::write;
+#endif
+#else
+        void write(uint8_t data) {
+                ports[0].write(data);
+        };
+
+        void write(const uint8_t *data, size_t size) {
+                ports[0].write(data, size);
+        };
+#endif
+
+        int availableForWrite(void) {
+                return ports[0].availableForWrite();
+        };
+
+        void flush(void) {
+                ports[0].flush();
+        };
+
+        void setTxLatency(uint8_t ms) {
+                ports[0].setTxLatency(ms);
+        };
+
+        void setTxZlp(bool enable) {
+                ports[0].setTxZlp(enable);
+        };
+
+        const FTDI_STATUS &GetStatus(void) {
+                return ports[0].GetStatus();
+        };
+
+        void ClearStatus(void) {
+                ports[0].ClearStatus();
+        };
+
+        uint32_t getRxOverruns(void) {
+                return ports[0].getRxOverruns();
+        };
+
+        void resetRxOverruns(void) {
+                ports[0].resetRxOverruns();
+        };
+
+        USBBufferUsage getRxUsage(void) {
+                return ports[0].getRxUsage();
+        };
+
+        USBBufferUsage getTxUsage(void) {
+                return ports[0].getTxUsage();
+        };
+
+        /**
+         * Enable or disable reading the bulk IN endpoints from Usb.Task().
+         * Polling is enabled when the device is configured.
+         * @param enable Set to false to only receive through RcvData().
+         */
+        void setRxPolling(bool enable) {
+                bPollEnable = enable && ready;
+        };
+
         // UsbConfigXtracter implementation
         void EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t proto, const USB_ENDPOINT_DESCRIPTOR *ep);
 
         virtual bool VIDPIDOK(uint16_t vid, uint16_t pid) {
-                return (vid == FTDI_VID && pid == FTDI_PID);
+                return (vid == FTDI_VID && pid == wIdProduct);
         }
         virtual bool isReady() {
                 return ready;
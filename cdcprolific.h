@@ -126,11 +126,14 @@ public:
         PL2303(USB *pusb, CDCAsyncOper *pasync);
 
         // USBDeviceConfig implementation
+        uint8_t ConfigureDevice(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed);
         //virtual uint8_t Release();
         //virtual uint8_t Poll();
         //virtual uint8_t GetAddress() { return bAddress; };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         //// UsbConfigXtracter implementation
         //virtual void EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t proto, const USB_ENDPOINT_DESCRIPTOR *ep);
 
@@ -0,0 +1,533 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+#if !defined(__CDCSIM_H__)
+#define __CDCSIM_H__
+
+#include "cdcacm.h"
+#include "cdcftdi.h"
+#include "cdcprolific.h"
+
+#ifndef CDC_SIM_FIFO_SIZE
+#define CDC_SIM_FIFO_SIZE       256 // Bytes the simulated device holds before it NAKs OUT packets
+#endif
+
+/** Device simulated by CDCSimulator. */
+enum CDCSimType {
+        CDC_SIM_ACM, // Generic CDC ACM device
+        CDC_SIM_FTDI, // FT232R with its vendor requests, status bytes and latency timer
+        CDC_SIM_PL2303 // PL2303 with its vendor requests
+};
+
+/** Counters of the simulated device. */
+struct CDCSimStats {
+        uint32_t inPackets; // Bulk IN packets sent, including the FTDI status only packets
+        uint32_t outPackets; // Bulk OUT packets accepted
+        uint32_t inNaks; // Bulk IN tokens answered with a NAK
+        uint32_t outNaks; // Bulk OUT packets answered with a NAK
+};
+
+/**
+ * MAX3421E with a CDC serial device connected to it, simulated in software.
+ * Attach it with Usb.setSpiBackend() before Usb.Init() to run the CDC drivers without a shield. Wrap it in a USBSpiMock
+ * to add a latency to the FIFO transfers. The device is enumerated like a real one and echoes the data it receives
+ * on its bulk OUT endpoint back on its bulk IN endpoint. Only the registers used by the USB class are simulated.
+ */
+class CDCSimulator : public USBSpiBackend {
+        CDCSimType type;
+        bool connected;
+
+        /* MAX3421E */
+        uint8_t regs[32]; // Registers without side effects, indexed by register number
+        uint8_t hirq;
+        uint8_t hrsl; // Result of the last transfer
+        bool rcvTog, sndTog;
+        bool cmdNext; // The next byte is the command byte of a transaction
+        uint8_t cmd;
+        uint8_t sud[8];
+        uint8_t sudPos;
+        uint8_t sndBuf[64];
+        uint8_t sndPos, sndLen;
+        uint8_t rcvBuf[64];
+        uint8_t rcvPos, rcvLen;
+
+        /* Device */
+        uint8_t address;
+        uint8_t config;
+        uint8_t setup[8]; // Last SETUP packet
+        uint8_t ctrlBuf[72];
+        uint8_t ctrlLen, ctrlPos;
+        bool ctrlStall;
+        uint8_t lineCoding[7];
+        uint8_t latency; // FTDI latency timer in ms
+        uint32_t lastIn; // Time of the last FTDI packet in us
+
+        /* Loopback */
+        bool loopback;
+        uint8_t fifo[CDC_SIM_FIFO_SIZE];
+        uint16_t fifoHead, fifoCount;
+        uint16_t fifoReady; // Bytes which have made it through the simulated line
+        uint16_t fifoLimit;
+        uint32_t byteTime; // us per byte on the line, 0 for no delay
+        uint32_t nextByte; // Time the next byte is through the line
+
+        uint32_t nakPattern[2]; // Indexed by direction, 0 for IN and 1 for OUT
+        uint8_t nakBits[2];
+        uint8_t nakPos[2];
+        CDCSimStats stats;
+
+        uint8_t epIn() {
+                return (type == CDC_SIM_PL2303) ? 3 : 1;
+        };
+
+        uint8_t epOut() {
+                return 2;
+        };
+
+        uint8_t epNotify() {
+                return (type == CDC_SIM_ACM) ? 3 : (type == CDC_SIM_PL2303) ? 1 : 0;
+        };
+
+        void chipReset() {
+                memset(regs, 0, sizeof (regs));
+                hirq = connected ? bmCONDETIRQ : 0;
+                hrsl = hrSUCCESS;
+                rcvTog = sndTog = false;
+                sudPos = sndPos = sndLen = rcvPos = rcvLen = 0;
+        };
+
+        void busReset() {
+                address = 0;
+                config = 0;
+                ctrlLen = ctrlPos = 0;
+                ctrlStall = false;
+                latency = 16;
+                fifoHead = fifoCount = fifoReady = 0;
+        };
+
+        /* Move the bytes which have been sent on the line in the meantime to the part of the FIFO which can be read */
+        void advanceLine() {
+                if(!byteTime) {
+                        fifoReady = fifoCount;
+                        return;
+                }
+                while(fifoReady < fifoCount && (int32_t)((uint32_t)micros() - nextByte) >= 0L) {
+                        fifoReady++;
+                        nextByte += byteTime;
+                }
+        };
+
+        /* Returns true if the pattern NAKs the next bulk transaction in the direction */
+        bool nakNext(uint8_t dir) {
+                if(!nakBits[dir])
+                        return false;
+                bool nak = (nakPattern[dir] >> nakPos[dir]) & 1;
+                if(++nakPos[dir] >= nakBits[dir])
+                        nakPos[dir] = 0;
+                return nak;
+        };
+
+        void loadRcv(const uint8_t *data, uint8_t len) {
+                if(len)
+                        memcpy(rcvBuf, data, len);
+                rcvLen = len;
+                rcvPos = 0;
+                hirq |= bmRCVDAVIRQ;
+        };
+
+        void putCtrl(const uint8_t *data, uint8_t len) {
+                if(len > sizeof (ctrlBuf))
+                        len = sizeof (ctrlBuf);
+                memcpy(ctrlBuf, data, len);
+                ctrlLen = len;
+        };
+
+        void putDevDescr() {
+                uint16_t vid = 0x1209, pid = 0x0001, bcd = 0x0100;
+                uint8_t klass = USB_CLASS_COM_AND_CDC_CTRL;
+
+                if(type == CDC_SIM_FTDI) {
+                        vid = FTDI_VID;
+                        pid = FTDI_PID;
+                        bcd = 0x0600; // FT232R
+                        klass = 0;
+                } else if(type == CDC_SIM_PL2303) {
+                        vid = PL_VID;
+                        pid = 0x2303;
+                        bcd = PROLIFIC_REV_X;
+                        klass = 0;
+                }
+                const uint8_t d[] = {18, USB_DESCRIPTOR_DEVICE, 0x00, 0x02, klass, 0, 0, 64,
+                        (uint8_t)vid, (uint8_t)(vid >> 8), (uint8_t)pid, (uint8_t)(pid >> 8), (uint8_t)bcd, (uint8_t)(bcd >> 8), 0, 0, 0, 1};
+                putCtrl(d, sizeof (d));
+        };
+
+        void putConfDescr() {
+                if(type == CDC_SIM_FTDI) {
+                        const uint8_t d[] = {9, USB_DESCRIPTOR_CONFIGURATION, 32, 0, 1, 1, 0, 0x80, 45,
+                                9, USB_DESCRIPTOR_INTERFACE, 0, 0, 2, 0xff, 0xff, 0xff, 0,
+                                7, USB_DESCRIPTOR_ENDPOINT, 0x81, USB_TRANSFER_TYPE_BULK, 64, 0, 0,
+                                7, USB_DESCRIPTOR_ENDPOINT, 0x02, USB_TRANSFER_TYPE_BULK, 64, 0, 0};
+                        putCtrl(d, sizeof (d));
+                } else if(type == CDC_SIM_PL2303) {
+                        const uint8_t d[] = {9, USB_DESCRIPTOR_CONFIGURATION, 39, 0, 1, 1, 0, 0x80, 50,
+                                9, USB_DESCRIPTOR_INTERFACE, 0, 0, 3, 0xff, 0, 0, 0,
+                                7, USB_DESCRIPTOR_ENDPOINT, 0x81, USB_TRANSFER_TYPE_INTERRUPT, 10, 0, 1,
+                                7, USB_DESCRIPTOR_ENDPOINT, 0x02, USB_TRANSFER_TYPE_BULK, 64, 0, 0,
+                                7, USB_DESCRIPTOR_ENDPOINT, 0x83, USB_TRANSFER_TYPE_BULK, 64, 0, 0};
+                        putCtrl(d, sizeof (d));
+                } else {
+                        const uint8_t d[] = {9, USB_DESCRIPTOR_CONFIGURATION, 67, 0, 2, 1, 0, 0x80, 50,
+                                9, USB_DESCRIPTOR_INTERFACE, 0, 0, 1, USB_CLASS_COM_AND_CDC_CTRL, CDC_SUBCLASS_ACM, CDC_PROTOCOL_ITU_T_V_250, 0,
+                                5, 0x24, 0x00, 0x10, 0x01, // Header functional descriptor
+                                5, 0x24, 0x01, 0x00, 1, // Call management
+                                4, 0x24, 0x02, 0x02, // Abstract control management
+                                5, 0x24, 0x06, 0, 1, // Union
+                                7, USB_DESCRIPTOR_ENDPOINT, 0x83, USB_TRANSFER_TYPE_INTERRUPT, 8, 0, 16,
+                                9, USB_DESCRIPTOR_INTERFACE, 1, 0, 2, USB_CLASS_CDC_DATA, 0, 0, 0,
+                                7, USB_DESCRIPTOR_ENDPOINT, 0x02, USB_TRANSFER_TYPE_BULK, 64, 0, 0,
+                                7, USB_DESCRIPTOR_ENDPOINT, 0x81, USB_TRANSFER_TYPE_BULK, 64, 0, 0};
+                        putCtrl(d, sizeof (d));
+                }
+        };
+
+        /* Fill in the data stage of a device to host request. Returns false if the request is not supported */
+        bool requestIn(uint8_t reqType, uint8_t req, uint16_t value) {
+                ctrlBuf[0] = ctrlBuf[1] = 0;
+                if(reqType == (bmREQ_GET_DESCR) && req == USB_REQUEST_GET_DESCRIPTOR) {
+                        if((value >> 8) == USB_DESCRIPTOR_DEVICE)
+                                putDevDescr();
+                        else if((value >> 8) == USB_DESCRIPTOR_CONFIGURATION)
+                                putConfDescr();
+                        else
+                                return false; // No strings
+                } else if(reqType == (bmREQ_GET_DESCR) && req == USB_REQUEST_GET_STATUS)
+                        ctrlLen = 2;
+                else if(reqType == (bmREQ_GET_DESCR) && req == USB_REQUEST_GET_CONFIGURATION) {
+                        ctrlBuf[0] = config;
+                        ctrlLen = 1;
+                } else if(type == CDC_SIM_FTDI && reqType == bmREQ_FTDI_IN) {
+                        if(req == FTDI_SIO_GET_LATENCY_TIMER) {
+                                ctrlBuf[0] = latency;
+                                ctrlLen = 1;
+                        } else if(req == FTDI_SIO_GET_MODEM_STATUS) {
+                                ctrlBuf[0] = FTDI_SIO_CTS_MASK | FTDI_SIO_DSR_MASK | 0x01;
+                                ctrlBuf[1] = FTDI_SIO_THRE_MASK | FTDI_SIO_TEMT_MASK;
+                                ctrlLen = 2;
+                        } else
+                                return false;
+                } else if(type != CDC_SIM_FTDI && reqType == (bmREQ_CDCIN) && req == CDC_GET_LINE_CODING)
+                        putCtrl(lineCoding, sizeof (lineCoding));
+                else if(type == CDC_SIM_PL2303 && reqType == VENDOR_READ_REQUEST_TYPE && req == VENDOR_READ_REQUEST)
+                        ctrlLen = 1;
+                else
+                        return false;
+                return true;
+        };
+
+        /* Carry out a host to device request once its data stage is done. Returns false if the request is not supported */
+        bool requestOut(uint8_t reqType, uint8_t req, uint16_t value) {
+                if(reqType == (bmREQ_SET) && req == USB_REQUEST_SET_ADDRESS)
+                        address = value;
+                else if(reqType == (bmREQ_SET) && req == USB_REQUEST_SET_CONFIGURATION)
+                        config = value;
+                else if(reqType == (bmREQ_CLEAR_EP) && req == USB_REQUEST_CLEAR_FEATURE)
+                        return true;
+                else if(type == CDC_SIM_FTDI && reqType == bmREQ_FTDI_OUT) {
+                        if(req == FTDI_SIO_SET_LATENCY_TIMER)
+                                latency = value ? value : 1;
+                        else if(req == FTDI_SIO_RESET && value != FTDI_SIO_RESET_PURGE_TX)
+                                fifoHead = fifoCount = fifoReady = 0;
+                } else if(type != CDC_SIM_FTDI && reqType == (bmREQ_CDCOUT)) {
+                        if(req == CDC_SET_LINE_CODING) {
+                                if(ctrlPos >= sizeof (lineCoding))
+                                        memcpy(lineCoding, ctrlBuf, sizeof (lineCoding));
+                        } else if(req != CDC_SET_CONTROL_LINE_STATE && req != CDC_SEND_BREAK)
+                                return false;
+                } else if(!(type == CDC_SIM_PL2303 && reqType == VENDOR_WRITE_REQUEST_TYPE && req == VENDOR_WRITE_REQUEST))
+                        return false;
+                return true;
+        };
+
+        uint8_t controlTransfer(uint8_t token) {
+                uint8_t len;
+
+                switch(token) {
+                        case tokSETUP:
+                                memcpy(setup, sud, sizeof (setup));
+                                sudPos = 0;
+                                ctrlLen = ctrlPos = 0;
+                                ctrlStall = false;
+                                if(setup[0] & 0x80) {
+                                        ctrlStall = !requestIn(setup[0], setup[1], setup[2] | (setup[3] << 8));
+                                        if(ctrlLen > (setup[6] | (setup[7] << 8)))
+                                                ctrlLen = setup[6] | (setup[7] << 8);
+                                }
+                                return hrSUCCESS;
+                        case tokIN:
+                                if(ctrlStall)
+                                        return hrSTALL;
+                                len = ctrlLen - ctrlPos;
+                                if(len > sizeof (rcvBuf))
+                                        len = sizeof (rcvBuf);
+                                loadRcv(ctrlBuf + ctrlPos, len);
+                                ctrlPos += len;
+                                return hrSUCCESS;
+                        case tokOUT:
+                                len = sndLen;
+                                if(len > sizeof (ctrlBuf) - ctrlPos)
+                                        len = sizeof (ctrlBuf) - ctrlPos;
+                                memcpy(ctrlBuf + ctrlPos, sndBuf, len);
+                                ctrlPos += len;
+                                return hrSUCCESS;
+                        case tokINHS: // Status stage of a host to device request
+                                if(ctrlStall || !requestOut(setup[0], setup[1], setup[2] | (setup[3] << 8)))
+                                        return hrSTALL;
+                                return hrSUCCESS;
+                        case tokOUTHS:
+                                return ctrlStall ? hrSTALL : hrSUCCESS;
+                }
+                return hrBADREQ;
+        };
+
+        uint8_t bulkIn(uint8_t ep) {
+                if(ep != epIn())
+                        return (ep == epNotify()) ? hrNAK : hrSTALL; // There are never any notifications
+                if(nakNext(0)) {
+                        stats.inNaks++;
+                        return hrNAK;
+                }
+                advanceLine();
+
+                uint8_t hdr = (type == CDC_SIM_FTDI) ? 2 : 0;
+                uint8_t len = sizeof (rcvBuf) - hdr;
+                if(fifoReady < len)
+                        len = fifoReady;
+
+                if(type == CDC_SIM_FTDI) {
+                        // A packet is sent once it is full or when the latency timer runs out, which also sends the status on its own
+                        if(len < sizeof (rcvBuf) - hdr && (uint32_t)micros() - lastIn < latency * 1000UL) {
+                                stats.inNaks++;
+                                return hrNAK;
+                        }
+                        lastIn = (uint32_t)micros();
+                        rcvBuf[0] = FTDI_SIO_CTS_MASK | FTDI_SIO_DSR_MASK | 0x01;
+                        rcvBuf[1] = FTDI_SIO_THRE_MASK | FTDI_SIO_TEMT_MASK;
+                } else if(!len) {
+                        stats.inNaks++;
+                        return hrNAK;
+                }
+                for(uint8_t i = 0; i < len; i++)
+                        rcvBuf[hdr + i] = fifo[(fifoHead + i) % CDC_SIM_FIFO_SIZE];
+                fifoHead = (fifoHead + len) % CDC_SIM_FIFO_SIZE;
+                fifoCount -= len;
+                fifoReady -= len;
+                rcvLen = hdr + len;
+                rcvPos = 0;
+                hirq |= bmRCVDAVIRQ;
+                stats.inPackets++;
+                return hrSUCCESS;
+        };
+
+        uint8_t bulkOut(uint8_t ep) {
+                if(ep != epOut())
+                        return hrSTALL;
+                if(nakNext(1) || (loopback && fifoCount + sndLen > fifoLimit)) {
+                        stats.outNaks++;
+                        return hrNAK;
+                }
+                if(loopback) {
+                        advanceLine();
+                        if(fifoReady == fifoCount)
+                                nextByte = (uint32_t)micros() + byteTime; // The line was idle
+                        for(uint8_t i = 0; i < sndLen; i++)
+                                fifo[(fifoHead + fifoCount + i) % CDC_SIM_FIFO_SIZE] = sndBuf[i];
+                        fifoCount += sndLen;
+                }
+                stats.outPackets++;
+                return hrSUCCESS;
+        };
+
+        void transact(uint8_t token, uint8_t ep) {
+                uint8_t rcode;
+
+                if(!connected || regs[rPERADDR >> 3] != address)
+                        rcode = hrTIMEOUT;
+                else if(ep == 0)
+                        rcode = controlTransfer(token);
+                else if(!config)
+                        rcode = hrSTALL;
+                else if(token == tokIN)
+                        rcode = bulkIn(ep);
+                else if(token == tokOUT)
+                        rcode = bulkOut(ep);
+                else
+                        rcode = hrBADREQ;
+
+                if(rcode == hrSUCCESS && token == tokIN)
+                        rcvTog = !rcvTog;
+                else if(rcode == hrSUCCESS && token == tokOUT)
+                        sndTog = !sndTog;
+                hrsl = rcode;
+                hirq |= bmHXFRDNIRQ;
+        };
+
+        void regWrite(uint8_t reg, uint8_t data) {
+                switch(reg) {
+                        case rUSBCTL:
+                                if(data & bmCHIPRES)
+                                        chipReset();
+                                break;
+                        case rHIRQ:
+                                hirq &= ~data;
+                                if(data & bmRCVDAVIRQ)
+                                        rcvPos = rcvLen = 0; // The buffer is free again
+                                break;
+                        case rHCTL:
+                                if(data & bmBUSRST)
+                                        busReset();
+                                if(data & (bmRCVTOG0 | bmRCVTOG1))
+                                        rcvTog = data & bmRCVTOG1;
+                                if(data & (bmSNDTOG0 | bmSNDTOG1))
+                                        sndTog = data & bmSNDTOG1;
+                                regs[reg >> 3] = data & bmSAMPLEBUS; // The bus reset finishes at once
+                                break;
+                        case rSUDFIFO:
+                                sud[sudPos++ & 7] = data;
+                                break;
+                        case rSNDFIFO:
+                                if(sndPos < sizeof (sndBuf))
+                                        sndBuf[sndPos++] = data;
+                                break;
+                        case rSNDBC:
+                                sndLen = (data > sizeof (sndBuf)) ? sizeof (sndBuf) : data;
+                                sndPos = 0;
+                                break;
+                        case rHXFR:
+                                transact(data & 0xf0, data & 0x0f);
+                                break;
+                        default:
+                                regs[reg >> 3] = data;
+                }
+        };
+
+        uint8_t regRead(uint8_t reg) {
+                switch(reg) {
+                        case rRCVFIFO:
+                                return (rcvPos < rcvLen) ? rcvBuf[rcvPos++] : 0;
+                        case rRCVBC:
+                                return rcvLen;
+                        case rUSBIRQ:
+                                return bmOSCOKIRQ;
+                        case rREVISION:
+                                return 0x13;
+                        case rHIRQ:
+                                return hirq | bmFRAMEIRQ | bmSNDBAVIRQ;
+                        case rHRSL:
+                                return hrsl | (rcvTog ? bmRCVTOGRD : 0) | (sndTog ? bmSNDTOGRD : 0) | (connected ? bmJSTATUS : 0);
+                }
+                return regs[reg >> 3];
+        };
+
+public:
+        CDCSimulator(CDCSimType simType = CDC_SIM_ACM) :
+        type(simType),
+        connected(true),
+        lastIn(0),
+        loopback(true),
+        fifoLimit(CDC_SIM_FIFO_SIZE),
+        byteTime(0),
+        nextByte(0) {
+                const uint8_t lc[] = {0x00, 0xc2, 0x01, 0x00, 0, 0, 8}; // 115200 8N1
+                memcpy(lineCoding, lc, sizeof (lineCoding));
+                setNakPattern(false, 0, 0);
+                setNakPattern(true, 0, 0);
+                clearStats();
+                chipReset();
+                busReset();
+                cmdNext = true;
+        };
+
+        /** Change the simulated device. Call this before Usb.Init(), or follow it with setConnected(false) and setConnected(true). */
+        void setType(CDCSimType simType) {
+                type = simType;
+        };
+
+        /** Plug the device in or out. The host notices it on the next Usb.Task(). */
+        void setConnected(bool attached) {
+                if(attached != connected) {
+                        connected = attached;
+                        hirq |= bmCONDETIRQ;
+                        busReset();
+                }
+        };
+
+        /**
+         * Configure the loopback.
+         * @param enable   Echo the received data. Otherwise it is thrown away.
+         * @param baud     Rate at which the data goes through the simulated serial line, 10 bits per byte. 0 echoes the data at once.
+         * @param fifoSize Bytes the device holds before it NAKs OUT packets, at most CDC_SIM_FIFO_SIZE.
+         */
+        void setLoopback(bool enable, uint32_t baud = 0, uint16_t fifoSize = CDC_SIM_FIFO_SIZE) {
+                loopback = enable;
+                byteTime = baud ? 10000000UL / baud : 0;
+                fifoLimit = (fifoSize > CDC_SIM_FIFO_SIZE || fifoSize < sizeof (sndBuf)) ? CDC_SIM_FIFO_SIZE : fifoSize;
+        };
+
+        /**
+         * NAK bulk transactions following a pattern, on top of the NAKs the device sends when it has no data or no room.
+         * @param out     true for the OUT endpoint, false for the IN endpoint.
+         * @param pattern Bit n set NAKs the n-th transaction, starting with bit 0.
+         * @param bits    Length of the pattern, which repeats after this many transactions. 0 turns it off.
+         */
+        void setNakPattern(bool out, uint32_t pattern, uint8_t bits) {
+                nakPattern[out] = pattern;
+                nakBits[out] = (bits > 32) ? 32 : bits;
+                nakPos[out] = 0;
+        };
+
+        const CDCSimStats &getStats() {
+                return stats;
+        };
+
+        void clearStats() {
+                memset(&stats, 0, sizeof (stats));
+        };
+
+        void beginTransaction() {
+                cmdNext = true;
+        };
+
+        void transfer(const uint8_t *tx, uint8_t *rx, uint16_t len) {
+                for(uint16_t i = 0; i < len; i++) {
+                        uint8_t c = tx ? tx[i] : 0;
+
+                        if(cmdNext) {
+                                cmdNext = false;
+                                cmd = c;
+                                c = regRead(rHIRQ); // Status byte
+                        } else if(cmd & 0x02) {
+                                regWrite(cmd & 0xf8, c);
+                                c = 0;
+                        } else
+                                c = regRead(cmd & 0xf8);
+                        if(rx)
+                                rx[i] = c;
+                }
+        };
+};
+
+#endif // __CDCSIM_H__
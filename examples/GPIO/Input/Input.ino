@@ -14,6 +14,12 @@
 USB Usb; // Create an UHS2 interface object
 UHS2_GPIO Gpio(&Usb); // Create a GPIO object
 
+// Called from Gpio.Task() with a bit set for every input which changed
+void onInputChange(uint8_t changed, uint8_t value) {
+  (void)changed;
+  Gpio.digitalWrite(OUTPUT_PIN, (value & (1 << INPUT_PIN)) ? LOW : HIGH);
+}
+
 void setup() {
   Serial.begin( 115200 );
 #if !defined(__MIPSEL__)
@@ -25,12 +31,14 @@ void setup() {
     Serial.println("OSC did not start.");
 
   delay( 200 );
+
+  // Set the output from the input once, then only when the input changes
+  Gpio.digitalWrite(OUTPUT_PIN, Gpio.digitalRead(INPUT_PIN) ? LOW : HIGH);
+  Gpio.attachOnChange(onInputChange, 1 << INPUT_PIN);
 }
 
 void loop() {
-  // Get the value of input, set value of output
-  int nValue = Gpio.digitalRead(INPUT_PIN);
-  nValue = (nValue ? LOW : HIGH);
-  Gpio.digitalWrite(OUTPUT_PIN, nValue);
+  // Reads a single register unless the input has changed
+  Gpio.Task();
 }
 
@@ -0,0 +1,75 @@
+/*
+ *******************************************************************************
+ * USB-MIDI router
+ *
+ * Merges the notes of two keyboards onto a sound module and sends all
+ * controller messages of the first keyboard to the second device.
+ *
+ * This is sample program. Do not expect perfect behavior.
+ *******************************************************************************
+ */
+
+#include <usbh_midi.h>
+#include <usbh_midi_router.h>
+#include <usbhub.h>
+
+USB Usb;
+USBHub Hub1(&Usb);
+USBH_MIDI Midi1(&Usb);
+USBH_MIDI Midi2(&Usb);
+USBH_MIDI Midi3(&Usb);
+USBH_MIDI_Router Router;
+
+uint8_t noteRoute1, noteRoute2, ccRoute;
+uint32_t timer;
+
+void printStats(const char *name, uint8_t route) {
+  const MidiRouteStats *s = Router.getRouteStats(route);
+  Serial.print(name);
+  Serial.print(F(": events "));
+  Serial.print(s->events);
+  Serial.print(F(" dropped "));
+  Serial.print(s->dropped);
+  Serial.print(F(" avg "));
+  Serial.print(s->events ? s->latencySum / s->events : 0);
+  Serial.print(F("us max "));
+  Serial.print(s->latencyMax);
+  Serial.println(F("us"));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+#if !defined(__MIPSEL__)
+  while (!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+
+  if (Usb.Init() == -1) {
+    while (1); //halt
+  }//if (Usb.Init() == -1...
+  delay( 200 );
+
+  uint8_t port1 = Router.addPort(&Midi1);
+  uint8_t port2 = Router.addPort(&Midi2);
+  uint8_t port3 = Router.addPort(&Midi3);
+
+  // Merge: notes from both keyboards to the sound module
+  noteRoute1 = Router.addRoute(port1, port3, MIDI_ROUTE_ANY_CABLE, MIDI_ROUTE_SAME_CABLE, MIDI_ROUTE_ALL_CHANNELS, MIDI_ROUTE_NOTES);
+  noteRoute2 = Router.addRoute(port2, port3, MIDI_ROUTE_ANY_CABLE, MIDI_ROUTE_SAME_CABLE, MIDI_ROUTE_ALL_CHANNELS, MIDI_ROUTE_NOTES);
+  // Split: controllers on channel 1 of the first keyboard also go to the second device
+  ccRoute = Router.addRoute(port1, port2, MIDI_ROUTE_ANY_CABLE, MIDI_ROUTE_SAME_CABLE, 0x0001, MIDI_ROUTE_CONTROL_CHANGE);
+  timer = millis();
+}
+
+void loop()
+{
+  Usb.Task();
+  Router.Task();
+
+  if ((int32_t)((uint32_t)millis() - timer) >= 5000) {
+    timer = millis();
+    printStats("Notes 1", noteRoute1);
+    printStats("Notes 2", noteRoute2);
+    printStats("CC", ccRoute);
+  }
+}
@@ -0,0 +1,88 @@
+/*
+ Example sketch showing how much RAM the library uses at runtime.
+ It prints the unused stack, the RAM of every registered driver and the buffer occupancy of a CDC ACM device every few seconds.
+ Add the drivers your project uses to see how close it is to running out of memory.
+ The unused stack can only be measured on AVR.
+ */
+
+#include <cdcacm.h>
+#include <usbhub.h>
+
+// Satisfy the IDE, which needs to see the include statment in the ino too.
+#ifdef dobogusinclude
+#include <spi4teensy3.h>
+#endif
+#include <SPI.h>
+
+class ACMAsyncOper : public CDCAsyncOper
+{
+public:
+    uint8_t OnInit(ACM *pacm) {
+      return pacm->SetControlLineState(3); // Set DTR = 1 RTS=1
+    };
+};
+
+USB     Usb;
+USBHub  Hub(&Usb);
+ACMAsyncOper  AsyncOper;
+ACM     Acm(&Usb, &AsyncOper);
+
+uint32_t next_time;
+
+void printUsage(const __FlashStringHelper *name, USBBufferUsage usage) {
+  Serial.print(name);
+  Serial.print(usage.used);
+  Serial.print(F("/"));
+  Serial.print(usage.size);
+  Serial.print(F(" bytes, peak "));
+  Serial.println(usage.peak);
+}
+
+void setup() {
+  USB::paintStack(); // As early as possible, so all later stack use is seen
+
+  Serial.begin(115200);
+#if !defined(__MIPSEL__)
+  while (!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+  Serial.println(F("Start"));
+
+  if (Usb.Init() == -1)
+    Serial.println(F("OSC did not start."));
+
+  next_time = (uint32_t)millis() + 5000;
+}
+
+void loop() {
+  Usb.Task();
+
+  if ((int32_t)((uint32_t)millis() - next_time) < 0L)
+    return;
+  next_time = (uint32_t)millis() + 5000;
+
+  Serial.print(F("\r\nStack never used: "));
+  Serial.println(USB::getStackUnused());
+  Serial.print(F("USB core: "));
+  Serial.println(sizeof (Usb));
+#if USB_SCRATCH_SIZE // The arena is disabled by default on AVR
+  Serial.print(F("Scratch arena peak: "));
+  Serial.print(Usb.getScratchPeak());
+  Serial.print(F("/"));
+  Serial.println(USB_SCRATCH_SIZE);
+#endif
+
+  for (uint8_t i = 0; i < USB_NUMDEVICES; i++) {
+    USBDeviceConfig *pDriver = Usb.getDeviceConfig(i);
+    if (!pDriver)
+      continue;
+    Serial.print(F("Driver "));
+    Serial.print(i);
+    if (pDriver == &Acm)
+      Serial.print(F(" (ACM)"));
+    Serial.print(F(": "));
+    Serial.println(pDriver->GetMemoryUsage());
+  }
+
+  printUsage(F("ACM receive buffer: "), Acm.getRxUsage());
+  printUsage(F("ACM transmit buffer: "), Acm.getTxUsage());
+}
@@ -0,0 +1,302 @@
+/*
+ * Throughput and latency benchmark for the CDC serial drivers: ACM, PL2303, XR21B1411 and FTDI.
+ * Connect TX to RX on the adapter, or use a device which echoes everything back.
+ *
+ * For every message size the sketch reports:
+ *   - throughput of the echoed data in bytes per second
+ *   - time spent inside the driver calls per byte, Usb.Task() included for the buffered test
+ *   - average and worst round trip time of a message
+ * Both the raw RcvData()/SndData() calls and the buffered write()/read() functions are measured.
+ * On FTDI chips the buffered test is repeated for several latency timer settings.
+ *
+ * Set BENCH_SIMULATED to run without a shield against a simulated ACM, FTDI or PL2303 device, see cdcsim.h.
+ * The tests are then repeated for every NAK pattern in nakPatterns[], which the device sends on top of its own NAKs.
+ */
+#include <cdcacm.h>
+#include <cdcprolific.h>
+#include <cdc_XR21B1411.h>
+#include <cdcftdi.h>
+#include <usbhub.h>
+#include <cdcsim.h>
+
+// Satisfy the IDE, which needs to see the include statment in the ino too.
+#ifdef dobogusinclude
+#include <spi4teensy3.h>
+#endif
+#include <SPI.h>
+
+#define BENCH_ACM       0
+#define BENCH_PL2303    1
+#define BENCH_XR21B1411 2
+#define BENCH_FTDI      3
+
+#define BENCH_DRIVER    BENCH_FTDI // Select the driver of the adapter here
+#define BENCH_BAUD      115200
+#define BENCH_MESSAGES  20 // Messages sent for every size
+#define BENCH_TIMEOUT   1000 // Time in ms to wait for the echo of a message
+
+#define BENCH_SIMULATED         0 // Use a simulated device instead of the shield
+#define BENCH_SIM_BAUD          0 // Rate of the simulated serial line, 0 echoes the data at once
+#define BENCH_SIM_SPI_LATENCY   0 // Time in us added to every FIFO transfer of the simulated MAX3421E
+
+const uint16_t sizes[] = { 1, 8, 32, 62, 64, 128, 256 };
+const uint8_t latencies[] = { 1, 4, 16 }; // FTDI latency timer settings in ms
+
+#if BENCH_SIMULATED
+struct NakPattern {
+        uint32_t in; // Bit n set NAKs the n-th bulk IN transaction
+        uint32_t out;
+        uint8_t bits; // Length of the patterns
+};
+
+const NakPattern nakPatterns[] = {
+        { 0x00, 0x00, 0 }, // Only the NAKs of the device itself
+        { 0x01, 0x00, 2 }, // Every other IN
+        { 0x00, 0x01, 2 }, // Every other OUT
+        { 0x07, 0x07, 8 }, // Bursts of three
+        { 0x7f, 0x00, 8 } // Seven out of eight IN
+};
+#endif
+
+#if BENCH_DRIVER == BENCH_FTDI
+class AsyncOper : public FTDIAsyncOper {
+public:
+        uint8_t OnInit(FTDI *pftdi) {
+                uint8_t rcode = pftdi->SetBaudRate(BENCH_BAUD);
+                if(!rcode)
+                        rcode = pftdi->SetFlowControl(FTDI_SIO_DISABLE_FLOW_CTRL);
+                if(rcode)
+                        ErrorMessage<uint8_t>(PSTR("OnInit"), rcode);
+                return rcode;
+        };
+};
+#else
+class AsyncOper : public CDCAsyncOper {
+public:
+        uint8_t OnInit(ACM *pacm) {
+                uint8_t rcode = pacm->SetControlLineState(3); // Set DTR = 1 RTS = 1
+                if(!rcode) {
+                        LINE_CODING lc;
+                        lc.dwDTERate = BENCH_BAUD;
+                        lc.bCharFormat = 0;
+                        lc.bParityType = 0;
+                        lc.bDataBits = 8;
+                        rcode = pacm->SetLineCoding(&lc);
+                }
+                if(rcode)
+                        ErrorMessage<uint8_t>(PSTR("OnInit"), rcode);
+                return rcode;
+        };
+};
+#endif
+
+USB Usb;
+//USBHub Hub(&Usb);
+AsyncOper Async;
+#if BENCH_DRIVER == BENCH_FTDI
+FTDI Dev(&Usb, &Async);
+#elif BENCH_DRIVER == BENCH_PL2303
+PL2303 Dev(&Usb, &Async);
+#elif BENCH_DRIVER == BENCH_XR21B1411
+XR21B1411 Dev(&Usb, &Async);
+#else
+ACM Dev(&Usb, &Async);
+#endif
+
+#if BENCH_SIMULATED
+#if BENCH_DRIVER == BENCH_FTDI
+CDCSimulator Sim(CDC_SIM_FTDI);
+#elif BENCH_DRIVER == BENCH_PL2303
+CDCSimulator Sim(CDC_SIM_PL2303);
+#elif BENCH_DRIVER == BENCH_ACM
+CDCSimulator Sim(CDC_SIM_ACM);
+#else
+#error "There is no simulated XR21B1411"
+#endif
+USBSpiMock SimBus(&Sim, BENCH_SIM_SPI_LATENCY);
+#endif
+
+uint8_t txBuf[256], rxBuf[256 + 64]; // Room for a whole packet after the longest message
+
+struct Result {
+        uint32_t bytes;
+        uint32_t errors;
+        uint32_t elapsed; // Total time in us
+        uint32_t busy; // Time spent in the driver in us
+        uint32_t rttSum;
+        uint32_t rttMax;
+};
+
+void fillPattern(uint16_t len, uint8_t seed) {
+        for(uint16_t i = 0; i < len; i++)
+                txBuf[i] = seed + i;
+}
+
+// Send one message with SndData() and wait for the echo with RcvData()
+bool rawMessage(uint16_t len, Result &r) {
+        uint32_t start = micros();
+        uint8_t rcode = Dev.SndData(len, txBuf);
+        r.busy += micros() - start;
+        if(rcode)
+                return false;
+
+        uint16_t got = 0;
+        while(got < len) {
+                if((micros() - start) / 1000 > BENCH_TIMEOUT)
+                        return false;
+                // One packet at a time like Poll(). A longer transfer loses the packets it has read if the device NAKs before it is complete
+                uint16_t rcvd = 64;
+                uint32_t t = micros();
+                rcode = Dev.RcvData(&rcvd, rxBuf + got);
+                r.busy += micros() - t;
+                if(rcode && rcode != hrNAK)
+                        return false;
+                if(!rcode)
+                        got += rcvd;
+        }
+        uint32_t rtt = micros() - start;
+        r.rttSum += rtt;
+        if(rtt > r.rttMax)
+                r.rttMax = rtt;
+        return got == len && !memcmp(txBuf, rxBuf, len);
+}
+
+// Send one message with write() and wait for the echo with read(), while Usb.Task() moves the data
+bool streamMessage(uint16_t len, Result &r) {
+        uint32_t start = micros();
+        Dev.write(txBuf, len);
+        Dev.flush();
+        r.busy += micros() - start;
+
+        uint16_t got = 0;
+        while(got < len) {
+                if((micros() - start) / 1000 > BENCH_TIMEOUT)
+                        return false;
+                uint32_t t = micros();
+                Usb.Task();
+                while(Dev.available() && got < sizeof (rxBuf))
+                        rxBuf[got++] = Dev.read();
+                r.busy += micros() - t;
+                if(!Dev.isReady())
+                        return false;
+        }
+        uint32_t rtt = micros() - start;
+        r.rttSum += rtt;
+        if(rtt > r.rttMax)
+                r.rttMax = rtt;
+        return got == len && !memcmp(txBuf, rxBuf, len);
+}
+
+void printResult(const __FlashStringHelper *name, uint16_t len, const Result &r) {
+        Serial.print(name);
+        Serial.print(F("\t"));
+        Serial.print(len);
+        Serial.print(F("\t"));
+        Serial.print(r.elapsed ? (uint32_t)((uint64_t)r.bytes * 1000000UL / r.elapsed) : 0);
+        Serial.print(F("\t\t"));
+        Serial.print(r.bytes ? (float)r.busy / r.bytes : 0.0f, 2);
+        Serial.print(F("\t\t"));
+        Serial.print(BENCH_MESSAGES - r.errors ? r.rttSum / (BENCH_MESSAGES - r.errors) : 0);
+        Serial.print(F("\t"));
+        Serial.print(r.rttMax);
+        Serial.print(F("\t"));
+        Serial.println(r.errors);
+}
+
+void runTest(const __FlashStringHelper *name, bool stream) {
+        for(uint8_t s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++) {
+                uint16_t len = sizes[s];
+                Result r;
+                memset(&r, 0, sizeof (r));
+
+                uint32_t start = micros();
+                for(uint8_t i = 0; i < BENCH_MESSAGES && Dev.isReady(); i++) {
+                        fillPattern(len, i);
+                        if(stream ? streamMessage(len, r) : rawMessage(len, r))
+                                r.bytes += len;
+                        else {
+                                r.errors++;
+                                Dev.discard(); // Drop a late echo, so it is not mistaken for the next one
+                        }
+                }
+                r.elapsed = micros() - start;
+                printResult(name, len, r);
+        }
+}
+
+void setup() {
+        Serial.begin(115200);
+#if !defined(__MIPSEL__)
+        while(!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+        Serial.println(F("Start"));
+
+#if BENCH_SIMULATED
+        Sim.setLoopback(true, BENCH_SIM_BAUD);
+        Usb.setSpiBackend(&SimBus);
+#endif
+
+        if(Usb.Init() == -1)
+                Serial.println(F("OSC did not start."));
+
+        delay(200);
+}
+
+void runTests() {
+        Serial.println(F("Test\tSize\tBytes/s\t\tus/byte\t\tRTT avg\tRTT max\tErrors"));
+
+        Dev.setRxPolling(false);
+        runTest(F("Raw"), false);
+        Dev.setRxPolling(true);
+
+#if BENCH_DRIVER == BENCH_FTDI
+        for(uint8_t i = 0; i < sizeof (latencies); i++) {
+                Dev.SetLatency(latencies[i]);
+                Serial.print(F("Latency timer "));
+                Serial.print(latencies[i]);
+                Serial.println(F(" ms"));
+                runTest(F("Stream"), true);
+        }
+#else
+        runTest(F("Stream"), true);
+#endif
+}
+
+void loop() {
+        static bool done = false;
+
+        Usb.Task();
+        if(!Dev.isReady() || done)
+                return;
+        done = true;
+
+#if BENCH_SIMULATED
+        for(uint8_t i = 0; i < sizeof (nakPatterns) / sizeof (nakPatterns[0]); i++) {
+                Sim.setNakPattern(false, nakPatterns[i].in, nakPatterns[i].bits);
+                Sim.setNakPattern(true, nakPatterns[i].out, nakPatterns[i].bits);
+                Sim.clearStats();
+                Serial.print(F("NAK pattern IN 0x"));
+                Serial.print(nakPatterns[i].in, HEX);
+                Serial.print(F(" OUT 0x"));
+                Serial.print(nakPatterns[i].out, HEX);
+                Serial.print(F(" of "));
+                Serial.print(nakPatterns[i].bits);
+                Serial.println(F(" transactions"));
+
+                runTests();
+
+                const CDCSimStats &stats = Sim.getStats();
+                Serial.print(F("Packets IN "));
+                Serial.print(stats.inPackets);
+                Serial.print(F(" OUT "));
+                Serial.print(stats.outPackets);
+                Serial.print(F(", NAKs IN "));
+                Serial.print(stats.inNaks);
+                Serial.print(F(" OUT "));
+                Serial.println(stats.outNaks);
+        }
+#else
+        runTests();
+#endif
+        Serial.println(F("Done"));
+}
@@ -78,15 +78,10 @@ void loop()
 #endif
     return;
   }
-  uint16_t len = sizeof(msg);
-
-  rcode = adk.RcvData(&len, msg);
-  if ( rcode ) {
-    USBTRACE2("Data rcv. :", rcode );
-  }
-  if (len > 0) {
+  // Commands from the phone are received in the background by Usb.Task(), so several can be waiting
+  while (adk.available() >= (int)sizeof(msg)) {
+    adk.readAvailable(msg, sizeof(msg));
     USBTRACE("\r\nData Packet.");
-    // assumes only one command per packet
     if (msg[0] == 0x2) {
       switch ( msg[1] ) {
         case 0:
@@ -98,7 +93,7 @@ void loop()
           break;
       }//switch( msg[1]...
     }//if (msg[0] == 0x2...
-  }//if( len > 0...
+  }//while (adk.available()...
 
   msg[0] = 0x1;
 
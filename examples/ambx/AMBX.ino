@@ -42,20 +42,25 @@ void loop() {
         }
         if (state == 0) {
           Serial.print(F("\r\nRed"));
-          AMBX.setAllLights(Red);
+          AMBX.stageAllLights(Red);
         } else if (state == 1) {
           Serial.print(F("\r\nGreen"));
-          AMBX.setAllLights(Green);
+          AMBX.stageAllLights(Green);
         } else if (state == 2) {
           Serial.print(F("\r\nBlue"));
-          AMBX.setAllLights(Blue);
+          AMBX.stageAllLights(Blue);
         } else if (state == 3) {
           Serial.print(F("\r\nWhite"));
-          AMBX.setAllLights(White);
+          AMBX.stageAllLights(White);
         }
         state++;
+        AMBX.commitFrame(500); // Fade to the new color in 500 ms, this is done by Usb.Task()
       }
     }
   //Example using single light:
   //AMBX.setLight(Wallwasher_center, White);
+  //Example setting several lights at once:
+  //AMBX.stageLight(Sidelight_left, Red);
+  //AMBX.stageLight(Sidelight_right, Blue);
+  //AMBX.commitFrame();
 }
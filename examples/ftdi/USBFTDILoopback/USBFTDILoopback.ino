@@ -83,10 +83,9 @@ void loop()
         if (rcode && rcode != hrNAK)
             ErrorMessage<uint8_t>(PSTR("Ret"), rcode);
 
-        // The device reserves the first two bytes of data
-        //   to contain the current values of the modem and line status registers.
-        if (rcvd > 2)
-            Serial.print((char*)(buf+2));
+        // The modem and line status bytes are removed by the driver, see Ftdi.GetStatus()
+        if (rcvd)
+            Serial.print((char*)buf);
 
         delay(10);
     }
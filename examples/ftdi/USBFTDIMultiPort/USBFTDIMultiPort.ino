@@ -0,0 +1,108 @@
+/*
+ * Bridges every port of a dual or quad FTDI chip (FT2232 or FT4232) to the serial monitor.
+ * Data received on a port is printed with the port letter in front of it.
+ * Type a port letter followed by a line of text to send the text to that port, e.g. "Bhello".
+ * Note that FTDI_MAX_PORTS in settings.h limits the number of ports used.
+ */
+#include <cdcftdi.h>
+#include <usbhub.h>
+
+// Satisfy the IDE, which needs to see the include statment in the ino too.
+#ifdef dobogusinclude
+#include <spi4teensy3.h>
+#endif
+#include <SPI.h>
+
+class FTDIAsync : public FTDIAsyncOper
+{
+public:
+    uint8_t OnInit(FTDI *pftdi);
+};
+
+uint8_t FTDIAsync::OnInit(FTDI *pftdi)
+{
+    for (uint8_t i = 0; i < pftdi->getNumPorts(); i++)
+    {
+        FTDIPort *port = pftdi->getPort(i);
+        uint8_t rcode = port->SetBaudRate(115200);
+
+        if (!rcode)
+            rcode = port->SetFlowControl(FTDI_SIO_DISABLE_FLOW_CTRL);
+        if (rcode)
+        {
+            ErrorMessage<uint8_t>(PSTR("Port setup"), rcode);
+            return rcode;
+        }
+    }
+    Serial.print(F("Ports: "));
+    Serial.println(pftdi->getNumPorts());
+    return 0;
+}
+
+USB              Usb;
+//USBHub         Hub(&Usb);
+FTDIAsync        FtdiAsync;
+FTDI             Ftdi(&Usb, &FtdiAsync, FTDI_PID_FT4232); // Use FTDI_PID_FT2232 for dual port chips
+
+FTDIPort *txPort = NULL; // Port the serial monitor input goes to
+
+void setup()
+{
+  Serial.begin( 115200 );
+#if !defined(__MIPSEL__)
+  while (!Serial); // Wait for serial port to connect - used on Leonardo, Teensy and other boards with built-in USB CDC serial connection
+#endif
+  Serial.println("Start");
+
+  if (Usb.Init() == -1)
+      Serial.println("OSC did not start.");
+
+  delay( 200 );
+}
+
+void loop()
+{
+    Usb.Task();
+
+    if (!Ftdi.isReady())
+        return;
+
+    // Forward the serial monitor to the selected port
+    while (Serial.available())
+    {
+        char c = Serial.read();
+        if (!txPort)
+            txPort = Ftdi.getPort(c - 'A');
+        else
+        {
+            txPort->write(c);
+            if (c == '\n')
+            {
+                txPort->flush();
+                txPort = NULL;
+            }
+        }
+    }
+
+    // Everything received in the background by Usb.Task()
+    for (uint8_t i = 0; i < Ftdi.getNumPorts(); i++)
+    {
+        FTDIPort *port = Ftdi.getPort(i);
+        if (!port->available())
+            continue;
+
+        Serial.write('A' + i);
+        Serial.print(F(": "));
+        while (port->available())
+            Serial.write(port->read());
+        Serial.println();
+
+        const FTDI_STATUS &status = port->GetStatus();
+        if (status.bLineErrors)
+        {
+            Serial.print(F("Line errors: 0x"));
+            Serial.println(status.bLineErrors, HEX);
+            port->ClearStatus();
+        }
+    }
+}
@@ -17,6 +17,8 @@ Max_LCD lcd(&Usb);
 void setup() {
   // Set up the LCD's number of columns and rows:
   lcd.begin(16, 2);
+  // Draw into RAM and let lcd.Task() send only the characters which changed
+  lcd.setBuffered(true);
   // Print a message to the LCD.
   lcd.print("Hello, World!");
 }
@@ -26,4 +28,6 @@ void loop() {
   lcd.setCursor(0, 1);
   // Print the number of seconds since reset:
   lcd.print((uint32_t)millis() / 1000);
+  // Send a few of the changed characters to the display
+  lcd.Task();
 }
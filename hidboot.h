@@ -235,6 +235,8 @@ public:
                 return bAddress;
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         virtual bool isReady() {
                 return bPollEnable;
         };
@@ -582,7 +584,7 @@ uint8_t HIDBoot<BOOT_PROTOCOL>::Poll() {
 
                 // To-do: optimize manually, using the for loop only if needed.
                 for(int i = 0; i < epMUL(BOOT_PROTOCOL); i++) {
-                        const uint16_t const_buff_len = 64;
+                        const uint16_t const_buff_len = maxReportLen;
 
                         USBTRACE3("(hidboot.h) i=", i, 0x81);
                         USBTRACE3("(hidboot.h) epInfo[epInterruptInIndex + i].epAddr=", epInfo[epInterruptInIndex + i].epAddr, 0x81);
@@ -597,6 +599,8 @@ uint8_t HIDBoot<BOOT_PROTOCOL>::Poll() {
                         rcode = pUsb->inTransfer(bAddress, epInfo[epInterruptInIndex + i].epAddr, &read, buf);
                         // SOME buggy dongles report extra keys (like sleep) using a 2 byte packet on the wrong endpoint.
                         // Since keyboard and mice must report at least 3 bytes, we ignore the extra data.
+                        if(!rcode && read > rptPeak)
+                                rptPeak = read;
                         if(!rcode && read > 2) {
                                 if(pRptParser[i])
                                         pRptParser[i]->Parse((USBHID*)this, 0, (uint8_t)read, buf);
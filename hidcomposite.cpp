@@ -91,100 +91,32 @@ HIDReportParser* HIDComposite::GetReportParser(uint8_t id) {
         return NULL;
 }
 
-uint8_t HIDComposite::Init(uint8_t parent, uint8_t port, bool lowspeed) {
-        const uint8_t constBufSize = sizeof (USB_DEVICE_DESCRIPTOR);
+uint8_t HIDComposite::ConfigureDevice(uint8_t parent __attribute__((unused)), uint8_t port __attribute__((unused)), bool lowspeed __attribute__((unused))) {
+        if(bAddress)
+                return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
+        return 0;
+}
 
-        uint8_t buf[constBufSize];
-        USB_DEVICE_DESCRIPTOR * udd = reinterpret_cast<USB_DEVICE_DESCRIPTOR*>(buf);
+uint8_t HIDComposite::Init(uint8_t parent __attribute__((unused)), uint8_t port __attribute__((unused)), bool lowspeed __attribute__((unused))) {
+        // The core has already given the device an address, see CoreAddressing()
+        const USB_DEVICE_DESCRIPTOR *udd = pUsb->getConfiguringDevDescr();
         uint8_t rcode;
-        UsbDevice *p = NULL;
-        EpInfo *oldep_ptr = NULL;
-        uint8_t len = 0;
 
         uint8_t num_of_conf; // number of configurations
         //uint8_t num_of_intf; // number of interfaces
 
-        AddressPool &addrPool = pUsb->GetAddressPool();
-
         USBTRACE("HU Init\r\n");
 
-        if(bAddress)
-                return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
-
-        // Get pointer to pseudo device with address 0 assigned
-        p = addrPool.GetUsbDevicePtr(0);
-
-        if(!p)
+        if(!udd || !pUsb->getConfiguringAddress())
                 return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
 
-        if(!p->epinfo) {
-                USBTRACE("epinfo\r\n");
-                return USB_ERROR_EPINFO_IS_NULL;
-        }
-
-        // Save old pointer to EP_RECORD of address 0
-        oldep_ptr = p->epinfo;
+        bAddress = pUsb->getConfiguringAddress();
 
-        // Temporary assign new pointer to epInfo to p->epinfo in order to avoid toggle inconsistence
-        p->epinfo = epInfo;
-
-        p->lowspeed = lowspeed;
-
-        // Get device descriptor
-        rcode = pUsb->getDevDescr(0, 0, 8, (uint8_t*)buf);
-
-        if(!rcode)
-                len = (buf[0] > constBufSize) ? constBufSize : buf[0];
-
-        if(rcode) {
-                // Restore p->epinfo
-                p->epinfo = oldep_ptr;
-
-                goto FailGetDevDescr;
-        }
-
-        // Restore p->epinfo
-        p->epinfo = oldep_ptr;
-
-        // Allocate new address according to device class
-        bAddress = addrPool.AllocAddress(parent, false, port);
-
-        if(!bAddress)
-                return USB_ERROR_OUT_OF_ADDRESS_SPACE_IN_POOL;
+        USBTRACE2("Addr:", bAddress);
 
         // Extract Max Packet Size from the device descriptor
         epInfo[0].maxPktSize = udd->bMaxPacketSize0;
 
-        // Assign new address to the device
-        rcode = pUsb->setAddr(0, 0, bAddress);
-
-        if(rcode) {
-                p->lowspeed = false;
-                addrPool.FreeAddress(bAddress);
-                bAddress = 0;
-                USBTRACE2("setAddr:", rcode);
-                return rcode;
-        }
-
-        //delay(2); //per USB 2.0 sect.9.2.6.3
-
-        USBTRACE2("Addr:", bAddress);
-
-        p->lowspeed = false;
-
-        p = addrPool.GetUsbDevicePtr(bAddress);
-
-        if(!p)
-                return USB_ERROR_ADDRESS_NOT_FOUND_IN_POOL;
-
-        p->lowspeed = lowspeed;
-
-        if(len)
-                rcode = pUsb->getDevDescr(bAddress, 0, len, (uint8_t*)buf);
-
-        if(rcode)
-                goto FailGetDevDescr;
-
         VID = udd->idVendor; // Can be used by classes that inherits this class to check the VID and PID of the connected device
         PID = udd->idProduct;
 
@@ -213,8 +145,10 @@ uint8_t HIDComposite::Init(uint8_t parent, uint8_t port, bool lowspeed) {
                         break;
         } // for
 
-        if(bNumEP < 2)
+        if(bNumEP < 2) {
+                Release();
                 return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+        }
 
         // Assign epInfo to epinfo pointer
         rcode = pUsb->setEpInfoEntry(bAddress, bNumEP, epInfo);
@@ -250,12 +184,6 @@ uint8_t HIDComposite::Init(uint8_t parent, uint8_t port, bool lowspeed) {
         bPollEnable = true;
         return 0;
 
-FailGetDevDescr:
-#ifdef DEBUG_USB_HOST
-        NotifyFailGetDevDescr();
-        goto Fail;
-#endif
-
 FailSetDevTblEntry:
 #ifdef DEBUG_USB_HOST
         NotifyFailSetDevTblEntry();
@@ -377,7 +305,9 @@ uint8_t HIDComposite::Poll() {
         if((int32_t)((uint32_t)millis() - qNextPollTime) >= 0L) {
                 qNextPollTime = (uint32_t)millis() + pollInterval;
 
-                uint8_t buf[constBuffLen];
+                USB_SCRATCH_BUFFER(buf, pUsb, constBuffLen);
+                if(!buf)
+                        return USB_ERROR_SCRATCH_EXHAUSTED;
 
                 for(uint8_t i = 0; i < bNumIface; i++) {
                         uint8_t index = hidInterfaces[i].epIndex[epInterruptInIndex];
@@ -387,8 +317,6 @@ uint8_t HIDComposite::Poll() {
 
                         uint16_t read = (uint16_t)epInfo[index].maxPktSize;
 
-                        ZeroMemory(constBuffLen, buf);
-
                         uint8_t rcode = pUsb->inTransfer(bAddress, epInfo[index].epAddr, &read, buf);
 
                         if(rcode) {
@@ -402,6 +330,9 @@ uint8_t HIDComposite::Poll() {
 
                         if(read > constBuffLen)
                                 read = constBuffLen;
+                        if(read > rptPeak)
+                                rptPeak = read;
+                        ZeroMemory(constBuffLen - read, buf + read); // Parsers may look past a short report, so the rest reads as 0
 
 #if 0
                         Notify(PSTR("\r\nBuf: "), 0x80);
@@ -52,7 +52,7 @@ protected:
         uint8_t pollInterval;
         bool bPollEnable; // poll enable flag
 
-        static const uint16_t constBuffLen = 64; // event buffer length
+        static const uint16_t constBuffLen = maxReportLen; // event buffer length
 
         void Initialize();
         HIDInterface* FindInterface(uint8_t iface, uint8_t alt, uint8_t proto);
@@ -88,6 +88,7 @@ public:
         bool SetReportParser(uint8_t id, HIDReportParser *prs);
 
         // USBDeviceConfig implementation
+        uint8_t ConfigureDevice(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed);
         uint8_t Release();
         uint8_t Poll();
@@ -96,6 +97,12 @@ public:
                 return bAddress;
         };
 
+        virtual bool CoreAddressing() {
+                return true;
+        };
+
+        USB_DEVICE_MEMORY_USAGE();
+
         virtual bool isReady() {
                 return bPollEnable;
         };
@@ -26,14 +26,14 @@ uint8_t HIDUniversal::Poll() {
         if((int32_t)((uint32_t)millis() - qNextPollTime) >= 0L) {
                 qNextPollTime = (uint32_t)millis() + pollInterval;
 
-                uint8_t buf[constBuffLen];
+                USB_SCRATCH_BUFFER(buf, pUsb, constBuffLen);
+                if(!buf)
+                        return USB_ERROR_SCRATCH_EXHAUSTED;
 
                 for(uint8_t i = 0; i < bNumIface; i++) {
                         uint8_t index = hidInterfaces[i].epIndex[epInterruptInIndex];
                         uint16_t read = (uint16_t)epInfo[index].maxPktSize;
 
-                        ZeroMemory(constBuffLen, buf);
-
                         USBTRACE1("  => Poll:\r\n", 0x90);
                         USBTRACE3("     - interface ", i, 0x90);
                         USBTRACE3("     - index ", index, 0x90);
@@ -52,6 +52,9 @@ uint8_t HIDUniversal::Poll() {
 
                         if(read > constBuffLen)
                                 read = constBuffLen;
+                        if(read > rptPeak)
+                                rptPeak = read;
+                        ZeroMemory(constBuffLen - read, buf + read); // Parsers may look past a short report, so the rest reads as 0
 
                         // TODO: handle read == 0 ? continue like HIDComposite,
                         //       return early like in the error case above?
@@ -46,6 +46,8 @@ public:
 
         uint8_t Poll() override;
 
+        USB_DEVICE_MEMORY_USAGE();
+
         // UsbConfigXtracter implementation
         void EndpointXtract(uint8_t conf, uint8_t iface, uint8_t alt, uint8_t proto, const USB_ENDPOINT_DESCRIPTOR *ep) override
         {
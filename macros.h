@@ -81,8 +81,14 @@ e-mail   :  support@circuitsathome.com
  */
 #define USBTRACE(s) (Notify(PSTR(s), 0x80))
 #define USBTRACE1(s,l) (Notify(PSTR(s), l))
+#ifdef UHS_DEFERRED_LOG
+// A single log entry holds the string and the value
+#define USBTRACE2(s,r) (E_LogValue(USB_LOG_TRACE, PSTR(s), (r), 0x80))
+#define USBTRACE3(s,r,l) (E_LogValue(USB_LOG_TRACE, PSTR(s), (r), l))
+#else
 #define USBTRACE2(s,r) (Notify(PSTR(s), 0x80), D_PrintHex((r), 0x80), Notify(PSTR("\r\n"), 0x80))
 #define USBTRACE3(s,r,l) (Notify(PSTR(s), l), D_PrintHex((r), l), Notify(PSTR("\r\n"), l))
+#endif
 
 
 #endif /* MACROS_H */
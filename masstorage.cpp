@@ -846,10 +846,7 @@ uint8_t BulkOnly::ClearEpHalt(uint8_t index) {
         if(index == 0)
                 return 0;
 
-        uint8_t ret = 0;
-
-        while((ret = (pUsb->ctrlReq(bAddress, 0, USB_SETUP_HOST_TO_DEVICE | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_ENDPOINT, USB_REQUEST_CLEAR_FEATURE, USB_FEATURE_ENDPOINT_HALT, 0, ((index == epDataInIndex) ? (0x80 | epInfo[index].epAddr) : epInfo[index].epAddr), 0, 0, NULL, NULL)) == 0x01))
-                delay(6);
+        uint8_t ret = pUsb->clearEpHalt(bAddress, &epInfo[index], (index == epDataInIndex));
 
         if(ret) {
                 ErrorMessage<uint8_t > (PSTR("ClearEpHalt"), ret);
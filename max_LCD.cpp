@@ -39,7 +39,18 @@ e-mail   :  support@circuitsathome.com
 
 static uint8_t lcdPins; //copy of LCD pins
 
-Max_LCD::Max_LCD(USB *pusb) : pUsb(pusb) {
+static const uint8_t row_offsets[] = {0x00, 0x40, 0x14, 0x54}; // DDRAM address of the first character of each row
+
+Max_LCD::Max_LCD(USB *pusb) :
+pUsb(pusb),
+_numlines(1),
+_numcols(16),
+_buffered(false),
+_numDirty(0),
+_fbCol(0),
+_fbRow(0),
+_flushPos(0),
+_lcdAddr(MAX_LCD_ADDR_UNKNOWN) {
         lcdPins = 0;
 }
 
@@ -51,12 +62,13 @@ void Max_LCD::init() {
         begin(16, 1);
 }
 
-void Max_LCD::begin(uint8_t cols __attribute__((unused)), uint8_t lines, uint8_t dotsize) {
+void Max_LCD::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
         if(lines > 1) {
                 _displayfunction |= LCD_2LINE;
         }
         _numlines = lines;
         _currline = 0;
+        _numcols = (cols > MAX_LCD_COLS) ? MAX_LCD_COLS : cols;
 
         // for some 1 line displays you can select a 10 pixel high font
         if((dotsize != 0) && (lines == 1)) {
@@ -112,21 +124,41 @@ void Max_LCD::begin(uint8_t cols __attribute__((unused)), uint8_t lines, uint8_t
 
 /********** high level commands, for the user! */
 void Max_LCD::clear() {
+        if(_buffered) {
+                // only the characters which are not blank already are sent
+                for(_fbRow = 0; _fbRow < _numlines && _fbRow < MAX_LCD_ROWS; _fbRow++) {
+                        for(_fbCol = 0; _fbCol < _numcols;)
+                                fbWrite(' ');
+                }
+                _fbCol = _fbRow = 0;
+                return;
+        }
         command(LCD_CLEARDISPLAY); // clear display, set cursor position to zero
         delayMicroseconds(2000); // this command takes a long time!
 }
 
 void Max_LCD::home() {
+        if(_buffered) {
+                _fbCol = _fbRow = 0;
+                return;
+        }
         command(LCD_RETURNHOME); // set cursor position to zero
         delayMicroseconds(2000); // this command takes a long time!
 }
 
 void Max_LCD::setCursor(uint8_t col, uint8_t row) {
-        int row_offsets[] = {0x00, 0x40, 0x14, 0x54};
-        if(row > _numlines) {
+        if(row >= _numlines) {
                 row = _numlines - 1; // we count rows starting w/0
         }
+        if(row >= sizeof (row_offsets)) {
+                row = sizeof (row_offsets) - 1;
+        }
 
+        if(_buffered) {
+                _fbCol = col;
+                _fbRow = row;
+                return;
+        }
         command(LCD_SETDDRAMADDR | (col + row_offsets[row]));
 }
 
@@ -212,27 +244,122 @@ void Max_LCD::createChar(uint8_t location, uint8_t charmap[]) {
         location &= 0x7; // we only have 8 locations 0-7
         command(LCD_SETCGRAMADDR | (location << 3));
         for(int i = 0; i < 8; i++) {
-                write(charmap[i]);
+                LCD_sendchar(charmap[i]); // not write(), as that would go to the framebuffer
+        }
+        _lcdAddr = MAX_LCD_ADDR_UNKNOWN; // the display now points into CGRAM
+}
+
+/*********** framebuffer */
+
+void Max_LCD::setBuffered(bool enable) {
+        if(enable == _buffered)
+                return;
+        if(!enable) {
+                flush();
+                _buffered = false;
+                return;
+        }
+
+        memset(_fb, ' ', sizeof (_fb));
+        memset(_dirty, 0, sizeof (_dirty));
+        _numDirty = 0;
+        // the content of the display is unknown, so mark every visible cell
+        for(uint8_t row = 0; row < _numlines && row < MAX_LCD_ROWS; row++) {
+                for(uint8_t col = 0; col < _numcols; col++) {
+                        uint8_t i = row * MAX_LCD_COLS + col;
+                        _dirty[i >> 3] |= 1 << (i & 7);
+                        _numDirty++;
+                }
+        }
+        _fbCol = _fbRow = 0;
+        _flushPos = 0;
+        _lcdAddr = MAX_LCD_ADDR_UNKNOWN;
+        _buffered = true;
+}
+
+void Max_LCD::fbWrite(uint8_t value) {
+        if(_fbCol >= _numcols || _fbRow >= _numlines || _fbRow >= MAX_LCD_ROWS)
+                return; // clipped
+
+        uint8_t i = _fbRow * MAX_LCD_COLS + _fbCol++;
+        if(_fb[i] == value)
+                return;
+        _fb[i] = value;
+        if(!(_dirty[i >> 3] & (1 << (i & 7)))) {
+                _dirty[i >> 3] |= 1 << (i & 7);
+                _numDirty++;
         }
 }
 
+/* Sends the next changed character. Returns false if the byte budget ran out before it could be sent */
+bool Max_LCD::fbFlushCell() {
+        while(!(_dirty[_flushPos >> 3] & (1 << (_flushPos & 7)))) {
+                if(++_flushPos == MAX_LCD_FB_SIZE)
+                        _flushPos = 0;
+        }
+
+        uint8_t addr = row_offsets[_flushPos / MAX_LCD_COLS] + _flushPos % MAX_LCD_COLS;
+        if(addr != _lcdAddr) {
+                command(LCD_SETDDRAMADDR | addr); // start of a new run of changed characters
+                _lcdAddr = addr;
+                return false;
+        }
+
+        LCD_sendchar(_fb[_flushPos]);
+        _lcdAddr++;
+        _dirty[_flushPos >> 3] &= ~(1 << (_flushPos & 7));
+        _numDirty--;
+        if(++_flushPos == MAX_LCD_FB_SIZE)
+                _flushPos = 0;
+        return true;
+}
+
+void Max_LCD::Task() {
+        if(!_buffered)
+                return;
+
+        for(uint8_t budget = MAX_LCD_FLUSH_BYTES; budget && _numDirty; budget--)
+                fbFlushCell();
+
+        if(!_numDirty && (_displaycontrol & (LCD_CURSORON | LCD_BLINKON))) {
+                // put the visible cursor back where the sketch left it
+                uint8_t addr = row_offsets[_fbRow] + _fbCol;
+                if(addr != _lcdAddr) {
+                        command(LCD_SETDDRAMADDR | addr);
+                        _lcdAddr = addr;
+                }
+        }
+}
+
+void Max_LCD::flush() {
+        while(_buffered && _numDirty)
+                Task();
+}
+
 /*********** mid level commands, for sending data/cmds */
 
-inline void Max_LCD::command(uint8_t value) {
+void Max_LCD::command(uint8_t value) {
         LCD_sendcmd(value);
         delayMicroseconds(100);
+        _lcdAddr = MAX_LCD_ADDR_UNKNOWN; // callers which know the new address set it afterwards
 }
 
 #if defined(ARDUINO) && ARDUINO >=100
 
-inline size_t Max_LCD::write(uint8_t value) {
-        LCD_sendchar(value);
+size_t Max_LCD::write(uint8_t value) {
+        if(_buffered)
+                fbWrite(value);
+        else
+                LCD_sendchar(value);
         return 1; // Assume success
 }
 #else
 
-inline void Max_LCD::write(uint8_t value) {
-        LCD_sendchar(value);
+void Max_LCD::write(uint8_t value) {
+        if(_buffered)
+                fbWrite(value);
+        else
+                LCD_sendchar(value);
 }
 #endif
 
@@ -62,6 +62,26 @@ e-mail   :  support@circuitsathome.com
 #define LCD_5x10DOTS            0x04
 #define LCD_5x8DOTS             0x00
 
+// size of the framebuffer, large enough for a 20x4 display
+#ifndef MAX_LCD_COLS
+#define MAX_LCD_COLS            20
+#endif
+#ifndef MAX_LCD_ROWS
+#define MAX_LCD_ROWS            4
+#endif
+#define MAX_LCD_FB_SIZE         (MAX_LCD_COLS * MAX_LCD_ROWS)
+
+#if MAX_LCD_COLS > 40 || MAX_LCD_ROWS > 4
+#error "HD44780 displays have at most 40 columns and 4 rows"
+#endif
+
+// maximum number of bytes, characters and cursor moves, Task() sends to the display per call
+#ifndef MAX_LCD_FLUSH_BYTES
+#define MAX_LCD_FLUSH_BYTES     8
+#endif
+
+#define MAX_LCD_ADDR_UNKNOWN    0xFF
+
 class Max_LCD : public Print {
         USB *pUsb;
 
@@ -87,6 +107,25 @@ public:
         void setCursor(uint8_t, uint8_t);
         void command(uint8_t);
 
+        /**
+         * Enable or disable the framebuffer. When enabled print(), setCursor(), clear() and home() only update RAM,
+         * and Task() sends the characters which have changed to the display a few at a time.
+         * Text is always written left to right without autoscroll and is clipped at the end of the line.
+         * @param enable True to enable the framebuffer. It starts out blank, so the whole display is redrawn.
+         */
+        void setBuffered(bool enable);
+
+        /** Must be called in the loop when the framebuffer is enabled. Sends at most MAX_LCD_FLUSH_BYTES bytes to the display. */
+        void Task();
+
+        /** Send all changes in the framebuffer to the display right away. */
+        void flush();
+
+        /** @return True if the display shows the content of the framebuffer. */
+        bool isFlushed() {
+                return !_numDirty;
+        };
+
 #if defined(ARDUINO) && ARDUINO >=100
         size_t write(uint8_t);
         using Print::write;
@@ -101,6 +140,18 @@ private:
         uint8_t _displaymode;
         uint8_t _initialized;
         uint8_t _numlines, _currline;
+
+        void fbWrite(uint8_t value);
+        bool fbFlushCell();
+
+        uint8_t _numcols;
+        bool _buffered;
+        uint8_t _fb[MAX_LCD_FB_SIZE]; // characters to show, MAX_LCD_COLS per row
+        uint8_t _dirty[(MAX_LCD_FB_SIZE + 7) / 8]; // one bit per cell which has not been sent yet
+        uint8_t _numDirty; // number of bits set in _dirty
+        uint8_t _fbCol, _fbRow; // cursor in the framebuffer
+        uint8_t _flushPos; // next cell Task() looks at
+        uint8_t _lcdAddr; // DDRAM address the display writes the next character to
 };
 
 #endif
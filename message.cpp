@@ -28,8 +28,7 @@ e-mail   :  support@circuitsathome.com
 // TO-DO: Allow assignment to a different serial port by software
 int UsbDEBUGlvl = 0xFF;
 
-void E_Notifyc(char c, int lvl) {
-        if(UsbDEBUGlvl < lvl) return;
+static void E_Putc(char c) {
 #if defined(ARDUINO) && ARDUINO >=100
         USB_HOST_SERIAL.print(c);
 #else
@@ -38,25 +37,179 @@ void E_Notifyc(char c, int lvl) {
         //USB_HOST_SERIAL.flush();
 }
 
+#ifdef UHS_DEFERRED_LOG
+static UsbLogEntry logBuf[UHS_LOG_SIZE];
+static uint16_t logHead = 0; // Oldest entry
+static uint16_t logCount = 0;
+static uint16_t logDropped = 0;
+// Copies of the strings of the USB_LOG_RAM_STR entries. They are taken and freed in the same order as the entries
+static char logStr[UHS_LOG_STR_SIZE];
+static uint16_t logStrEnd = 0; // Where the next string is copied to
+static uint16_t logStrUsed = 0; // Bytes in use, including those skipped at the end of the buffer
+
+void E_Log(uint8_t type, uint8_t size, char const * msg, uint32_t value, int lvl) {
+        if(UsbDEBUGlvl < lvl) return;
+        if(logCount == UHS_LOG_SIZE) {
+                if(logDropped != 0xFFFF)
+                        logDropped++;
+                return;
+        }
+        uint16_t i = logHead + logCount;
+        if(i >= UHS_LOG_SIZE)
+                i -= UHS_LOG_SIZE;
+        logBuf[i].msg = msg;
+        logBuf[i].value = value;
+        logBuf[i].type = type;
+        logBuf[i].size = size;
+        logBuf[i].lvl = lvl;
+        logCount++;
+}
+
+/* Log a string in RAM as a single entry with a copy of the string */
+static void E_LogStr(char const * msg, int lvl) {
+        uint16_t len = strlen(msg) + 1;
+        uint16_t start = logStrEnd;
+        uint16_t size = len;
+
+        if(logStrUsed == 0)
+                start = 0;
+        else if(start + len > UHS_LOG_STR_SIZE) {
+                size += UHS_LOG_STR_SIZE - start; // The string does not fit before the end of the buffer
+                start = 0;
+        }
+        if(logCount == UHS_LOG_SIZE || logStrUsed + size > UHS_LOG_STR_SIZE) {
+                if(logDropped != 0xFFFF)
+                        logDropped++;
+                return;
+        }
+        memcpy(&logStr[start], msg, len);
+        logStrEnd = start + len;
+        logStrUsed += size;
+        E_Log(USB_LOG_RAM_STR, 0, &logStr[start], size, lvl);
+}
+
+bool E_LogRead(UsbLogEntry *entry) {
+        if(!logCount)
+                return false;
+        *entry = logBuf[logHead];
+        if(entry->type == USB_LOG_RAM_STR)
+                logStrUsed -= entry->value; // The string stays in place until another one is logged
+        if(++logHead == UHS_LOG_SIZE)
+                logHead = 0;
+        logCount--;
+        return true;
+}
+
+uint16_t E_LogDropped() {
+        return logDropped;
+}
+
+static void E_PutStr(char const * msg) {
+        char c;
+
+        if(msg)
+                while((c = pgm_read_byte(msg++))) E_Putc(c);
+}
+
+static void E_PutHex(uint32_t value, uint8_t size) {
+        for(int8_t shift = size * 8 - 4; shift >= 0; shift -= 4) {
+                char v = 48 + ((value >> shift) & 0x0f);
+                if(v > 57) v += 7;
+                E_Putc(v);
+        }
+}
+
+void E_LogFlush(uint16_t count) {
+        UsbLogEntry entry;
+
+        while(count-- && E_LogRead(&entry)) {
+                switch(entry.type) {
+                        case USB_LOG_STR:
+                                E_PutStr(entry.msg);
+                                break;
+                        case USB_LOG_RAM_STR:
+                                USB_HOST_SERIAL.print(entry.msg);
+                                break;
+                        case USB_LOG_CHAR:
+                                E_Putc((char)entry.value);
+                                break;
+                        case USB_LOG_DEC:
+                                USB_HOST_SERIAL.print(entry.value);
+                                break;
+                        case USB_LOG_FLOAT:
+                        {
+                                float f;
+                                memcpy(&f, &entry.value, sizeof (f));
+                                USB_HOST_SERIAL.print(f);
+                                break;
+                        }
+                        case USB_LOG_HEX:
+                                E_PutHex(entry.value, entry.size);
+                                break;
+                        case USB_LOG_BIN:
+                                for(uint32_t mask = (uint32_t)1 << (entry.size * 8 - 1); mask; mask >>= 1)
+                                        E_Putc((entry.value & mask) ? '1' : '0');
+                                break;
+                        case USB_LOG_TRACE:
+                                E_PutStr(entry.msg);
+                                E_PutHex(entry.value, entry.size);
+                                E_PutStr(PSTR("\r\n"));
+                                break;
+                        default: // USB_LOG_ERROR
+                                E_PutStr(entry.msg);
+                                E_PutStr(PSTR(": "));
+                                E_PutHex(entry.value, entry.size);
+                                E_PutStr(PSTR("\r\n"));
+                                break;
+                }
+        }
+        if(logDropped && !logCount) {
+                E_PutStr(PSTR("\r\nLog entries dropped: "));
+                USB_HOST_SERIAL.print(logDropped);
+                E_PutStr(PSTR("\r\n"));
+                logDropped = 0;
+        }
+}
+#endif
+
+void E_Notifyc(char c, int lvl) {
+        if(UsbDEBUGlvl < lvl) return;
+#ifdef UHS_DEFERRED_LOG
+        E_Log(USB_LOG_CHAR, 1, NULL, (uint8_t)c, lvl);
+#else
+        E_Putc(c);
+#endif
+}
+
 void E_Notify(char const * msg, int lvl) {
         if(UsbDEBUGlvl < lvl) return;
         if(!msg) return;
+#ifdef UHS_DEFERRED_LOG
+        E_Log(USB_LOG_STR, 0, msg, 0, lvl); // Only the pointer is stored, as the string is in program memory
+#else
         char c;
 
         while((c = pgm_read_byte(msg++))) E_Notifyc(c, lvl);
+#endif
 }
 
 void E_NotifyStr(char const * msg, int lvl) {
         if(UsbDEBUGlvl < lvl) return;
         if(!msg) return;
+#ifdef UHS_DEFERRED_LOG
+        E_LogStr(msg, lvl);
+#else
         char c;
 
         while((c = *msg++)) E_Notifyc(c, lvl);
+#endif
 }
 
 void E_Notify(uint8_t b, int lvl) {
         if(UsbDEBUGlvl < lvl) return;
-#if defined(ARDUINO) && ARDUINO >=100
+#ifdef UHS_DEFERRED_LOG
+        E_Log(USB_LOG_DEC, 1, NULL, b, lvl);
+#elif defined(ARDUINO) && ARDUINO >=100
         USB_HOST_SERIAL.print(b);
 #else
         USB_HOST_SERIAL.print(b, DEC);
@@ -66,7 +219,14 @@ void E_Notify(uint8_t b, int lvl) {
 
 void E_Notify(double d, int lvl) {
         if(UsbDEBUGlvl < lvl) return;
+#ifdef UHS_DEFERRED_LOG
+        float f = d; // Stored with the precision of a float, which is all AVR has anyway
+        uint32_t value;
+        memcpy(&value, &f, sizeof (value));
+        E_Log(USB_LOG_FLOAT, sizeof (value), NULL, value, lvl);
+#else
         USB_HOST_SERIAL.print(d);
+#endif
         //USB_HOST_SERIAL.flush();
 }
 
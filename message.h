@@ -33,6 +33,49 @@ void E_Notify(uint8_t b, int lvl);
 void E_NotifyStr(char const * msg, int lvl);
 void E_Notifyc(char c, int lvl);
 
+#ifdef UHS_DEFERRED_LOG
+// Types of UsbLogEntry, USB_LOG_HEX and USB_LOG_BIN are defined in printhex.h
+#define USB_LOG_STR             0       // msg
+#define USB_LOG_CHAR            1       // value as a character
+#define USB_LOG_DEC             2       // value in decimal
+#define USB_LOG_TRACE           5       // msg followed by value in hex and a line break, written by USBTRACE2() and USBTRACE3()
+#define USB_LOG_ERROR           6       // msg, ": ", value in hex and a line break, written by ErrorMessage()
+#define USB_LOG_FLOAT           7       // value holds the bits of a float
+#define USB_LOG_RAM_STR         8       // msg is a copy of a string in RAM, value is the number of bytes it takes in the string buffer
+
+/** Entry of the deferred log, see ENABLE_UHS_DEFERRED_LOG in settings.h. */
+struct UsbLogEntry {
+        // String in program memory or NULL. Its address identifies the message, so a host can look it up in the map file of the sketch.
+        // For USB_LOG_RAM_STR it points to RAM and stays valid until the next message is logged
+        char const * msg;
+        uint32_t value;
+        uint8_t type : 4;
+        uint8_t size : 4; // Size of value in bytes, the number of digits printed for hex and binary values
+        uint8_t lvl;
+};
+
+template <class T>
+void E_LogValue(uint8_t type, char const * msg, T value, int lvl) {
+        E_Log(type, (sizeof (T) > 4) ? 4 : sizeof (T), msg, (uint32_t)value, lvl);
+}
+
+/**
+ * Remove the oldest entry from the deferred log, so the sketch can send it to a host in binary form.
+ * @param  entry Where to store the entry.
+ * @return       false if the log is empty.
+ */
+bool E_LogRead(UsbLogEntry *entry);
+
+/**
+ * Print entries of the deferred log to USB_HOST_SERIAL.
+ * @param count Maximum number of entries to print.
+ */
+void E_LogFlush(uint16_t count = 0xFFFF);
+
+/** @return The number of entries which did not fit in the log since the last call to E_LogFlush(). */
+uint16_t E_LogDropped();
+#endif
+
 #ifdef DEBUG_USB_HOST
 #define Notify E_Notify
 #define NotifyStr E_NotifyStr
@@ -64,7 +107,9 @@ void NotifyFail(uint8_t rcode);
 
 template <class ERROR_TYPE>
 void ErrorMessage(uint8_t level, char const * msg, ERROR_TYPE rcode = 0) {
-#ifdef DEBUG_USB_HOST
+#ifdef UHS_DEFERRED_LOG
+        E_LogValue(USB_LOG_ERROR, msg, rcode, level);
+#elif defined(DEBUG_USB_HOST)
         Notify(msg, level);
         Notify(PSTR(": "), level);
         D_PrintHex<ERROR_TYPE > (rcode, level);
@@ -74,7 +119,9 @@ void ErrorMessage(uint8_t level, char const * msg, ERROR_TYPE rcode = 0) {
 
 template <class ERROR_TYPE>
 void ErrorMessage(char const * msg __attribute__((unused)), ERROR_TYPE rcode __attribute__((unused)) = 0) {
-#ifdef DEBUG_USB_HOST
+#ifdef UHS_DEFERRED_LOG
+        E_LogValue(USB_LOG_ERROR, msg, rcode, 0x80);
+#elif defined(DEBUG_USB_HOST)
         Notify(msg, 0x80);
         Notify(PSTR(": "), 0x80);
         D_PrintHex<ERROR_TYPE > (rcode, 0x80);
@@ -28,6 +28,11 @@ e-mail   :  support@circuitsathome.com
 #define __PRINTHEX_H__
 
 void E_Notifyc(char c, int lvl);
+#ifdef UHS_DEFERRED_LOG
+void E_Log(uint8_t type, uint8_t size, char const * msg, uint32_t value, int lvl);
+#define USB_LOG_HEX             3
+#define USB_LOG_BIN             4
+#endif
 
 template <class T>
 void PrintHex(T val, int lvl) {
@@ -74,14 +79,18 @@ void PrintHex2(Print *prn, T val) {
 }
 
 template <class T> void D_PrintHex(T val __attribute__((unused)), int lvl __attribute__((unused))) {
-#ifdef DEBUG_USB_HOST
+#ifdef UHS_DEFERRED_LOG
+        E_Log(USB_LOG_HEX, sizeof (T), NULL, (uint32_t)val, lvl);
+#elif defined(DEBUG_USB_HOST)
         PrintHex<T > (val, lvl);
 #endif
 }
 
 template <class T>
 void D_PrintBin(T val, int lvl) {
-#ifdef DEBUG_USB_HOST
+#ifdef UHS_DEFERRED_LOG
+        E_Log(USB_LOG_BIN, sizeof (T), NULL, (uint32_t)val, lvl);
+#elif defined(DEBUG_USB_HOST)
         PrintBin<T > (val, lvl);
 #endif
 }
@@ -34,6 +34,29 @@ e-mail   :  support@circuitsathome.com
 //#define USB_SPI SPI1
 #endif
 
+/* Fastest SPI clock used for the MAX3421E, which can handle up to 26MHz.
+ * Only used if the SPI library supports transactions or an SPI backend is attached.
+ */
+#ifndef USB_SPI_CLOCK
+#define USB_SPI_CLOCK 26000000
+#endif
+
+/* Set this to 1 to let Init() find the fastest SPI clock that works reliably, by writing test patterns to a register and reading them back.
+ * The test is repeated every USB_SPI_CHECK_INTERVAL ms from Usb.Task(). The clock is lowered one step if it fails,
+ * or if USB_SPI_MAX_FAULTS transfers were corrupted since the last test.
+ */
+#ifndef ENABLE_USB_SPI_AUTOTUNE
+#define ENABLE_USB_SPI_AUTOTUNE 0
+#endif
+
+#ifndef USB_SPI_CHECK_INTERVAL
+#define USB_SPI_CHECK_INTERVAL 1000
+#endif
+
+#ifndef USB_SPI_MAX_FAULTS
+#define USB_SPI_MAX_FAULTS 3
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // DEBUGGING
 ////////////////////////////////////////////////////////////////////////////////
@@ -41,6 +64,30 @@ e-mail   :  support@circuitsathome.com
 /* Set this to 1 to activate serial debugging */
 #define ENABLE_UHS_DEBUGGING 0
 
+/* Set this to 1 to store the debug messages in a buffer instead of printing them when they occur.
+ * This keeps the timing of the library close to that of a build without debugging.
+ * The sketch prints the messages with E_LogFlush() or reads them with E_LogRead() at a convenient time.
+ */
+#define ENABLE_UHS_DEFERRED_LOG 0
+
+/* Number of messages the deferred log can hold. A message is a string, a value or both */
+#ifndef UHS_LOG_SIZE
+#if defined(__AVR__)
+#define UHS_LOG_SIZE 32
+#else
+#define UHS_LOG_SIZE 128
+#endif
+#endif
+
+/* Bytes the deferred log keeps for copies of strings in RAM, which are printed with NotifyStr() */
+#ifndef UHS_LOG_STR_SIZE
+#if defined(__AVR__)
+#define UHS_LOG_STR_SIZE 32
+#else
+#define UHS_LOG_STR_SIZE 128
+#endif
+#endif
+
 /* This can be used to select which serial port to use for debugging if
  * multiple serial ports are available.
  * For example Serial3.
@@ -49,6 +96,13 @@ e-mail   :  support@circuitsathome.com
 #define USB_HOST_SERIAL Serial
 #endif
 
+/* Set this to 1 to time the Poll() and Release() calls of the drivers and the enumeration, see USB::getPollProfile().
+ * It costs two calls to micros() per driver per Usb.Task() and about 30 bytes of RAM per driver slot.
+ */
+#ifndef ENABLE_USB_PROFILING
+#define ENABLE_USB_PROFILING 0
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Manual board activation
 ////////////////////////////////////////////////////////////////////////////////
@@ -79,6 +133,68 @@ e-mail   :  support@circuitsathome.com
 #define MASS_MAX_SUPPORTED_LUN 8
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+// CDC SERIAL
+////////////////////////////////////////////////////////////////////////////////
+// Size of the buffer the ACM, FTDI, PL2303 and XR21B1411 drivers receive into from Usb.Task().
+// A new packet is only read when there is room for a full packet, so it must be at least 64 bytes.
+#ifndef CDC_RX_BUFFER_SIZE
+#if defined(__AVR__)
+#define CDC_RX_BUFFER_SIZE 64
+#else
+#define CDC_RX_BUFFER_SIZE 256
+#endif
+#endif
+
+// Size of the buffer used by write() to pack data into full packets, at least 64 bytes as well.
+#ifndef CDC_TX_BUFFER_SIZE
+#if defined(__AVR__)
+#define CDC_TX_BUFFER_SIZE 64
+#else
+#define CDC_TX_BUFFER_SIZE 256
+#endif
+#endif
+
+// Number of ports of dual and quad FTDI chips like the FT2232 and FT4232 which are used. Each port has its own buffers.
+#ifndef FTDI_MAX_PORTS
+#if defined(__AVR__)
+#define FTDI_MAX_PORTS 1
+#else
+#define FTDI_MAX_PORTS 4
+#endif
+#endif
+
+// Default time in ms data written with write() may wait in the buffer before it is sent from Usb.Task().
+#ifndef CDC_TX_LATENCY
+#define CDC_TX_LATENCY 2
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// ANDROID ACCESSORY
+////////////////////////////////////////////////////////////////////////////////
+// Size of the buffers the ADK driver receives into from Usb.Task() and packs data written with write() into.
+// Like the CDC buffers they must be at least 64 bytes.
+#ifndef ADK_RX_BUFFER_SIZE
+#if defined(__AVR__)
+#define ADK_RX_BUFFER_SIZE 64
+#else
+#define ADK_RX_BUFFER_SIZE 512
+#endif
+#endif
+
+#ifndef ADK_TX_BUFFER_SIZE
+#if defined(__AVR__)
+#define ADK_TX_BUFFER_SIZE 64
+#else
+#define ADK_TX_BUFFER_SIZE 512
+#endif
+#endif
+
+// Default time in ms data written with write() may wait in the buffer before it is sent from Usb.Task().
+#ifndef ADK_TX_LATENCY
+#define ADK_TX_LATENCY 2
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Set to 1 to use the faster spi4teensy3 driver on Teensy 3.x
 ////////////////////////////////////////////////////////////////////////////////
@@ -119,6 +235,10 @@ e-mail   :  support@circuitsathome.com
 #define DEBUG_USB_HOST
 #endif
 
+#if !defined(UHS_DEFERRED_LOG) && defined(DEBUG_USB_HOST) && ENABLE_UHS_DEFERRED_LOG
+#define UHS_DEFERRED_LOG
+#endif
+
 #if !defined(WIICAMERA) && ENABLE_WII_IR_CAMERA
 #define WIICAMERA
 #endif
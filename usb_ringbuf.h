@@ -0,0 +1,151 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+
+#if !defined(_usb_h_) || defined(__USB_RINGBUF_H__)
+#error "Never include usb_ringbuf.h directly; include Usb.h instead"
+#else
+#define __USB_RINGBUF_H__
+
+/**
+ * Byte FIFO used by the drivers to hold data received in the background.
+ * It is filled from Poll() and drained by the sketch, both from the main loop, so no locking is done.
+ */
+template <uint16_t SIZE>
+class USBRingBuffer {
+        uint8_t buf[SIZE];
+        uint16_t head; // Next byte to read
+        uint16_t count; // Number of bytes stored
+        uint16_t peak; // Most bytes stored at the same time
+
+public:
+
+        USBRingBuffer() : head(0), count(0), peak(0) {
+        };
+
+        void clear() {
+                head = 0;
+                count = 0;
+        };
+
+        uint16_t available() const {
+                return count;
+        };
+
+        uint16_t room() const {
+                return SIZE - count;
+        };
+
+        /** @return Capacity, current and peak occupancy of the buffer. The peak is kept by clear(). */
+        USBBufferUsage usage() const {
+                USBBufferUsage u = {SIZE, count, peak};
+                return u;
+        };
+
+        void clearPeak() {
+                peak = count;
+        };
+
+        /**
+         * Append data to the buffer.
+         * @param  data Data to store.
+         * @param  len  Number of bytes.
+         * @return      Number of bytes stored, less than len if the buffer became full.
+         */
+        uint16_t write(const uint8_t *data, uint16_t len) {
+                if(len > room())
+                        len = room();
+                uint16_t tail = head + count;
+                if(tail >= SIZE)
+                        tail -= SIZE;
+                for(uint16_t i = 0; i < len; i++) {
+                        buf[tail] = data[i];
+                        if(++tail == SIZE)
+                                tail = 0;
+                }
+                count += len;
+                if(count > peak)
+                        peak = count;
+                return len;
+        };
+
+        /** @return The oldest byte or -1 if the buffer is empty. */
+        int peek() const {
+                return count ? buf[head] : -1;
+        };
+
+        /** @return The oldest byte, which is removed from the buffer, or -1 if the buffer is empty. */
+        int read() {
+                if(!count)
+                        return -1;
+                uint8_t c = buf[head];
+                if(++head == SIZE)
+                        head = 0;
+                count--;
+                return c;
+        };
+
+        /**
+         * Copy data from the buffer without removing it.
+         * @param  data Where to store the data.
+         * @param  len  Maximum number of bytes.
+         * @return      Number of bytes copied.
+         */
+        uint16_t peek(uint8_t *data, uint16_t len) const {
+                if(len > count)
+                        len = count;
+                uint16_t pos = head;
+                for(uint16_t i = 0; i < len; i++) {
+                        data[i] = buf[pos];
+                        if(++pos == SIZE)
+                                pos = 0;
+                }
+                return len;
+        };
+
+        /**
+         * Remove data from the buffer, used after peek().
+         * @param len Number of bytes to remove.
+         */
+        void skip(uint16_t len) {
+                if(len > count)
+                        len = count;
+                head += len;
+                if(head >= SIZE)
+                        head -= SIZE;
+                count -= len;
+        };
+
+        /**
+         * Remove data from the buffer.
+         * @param  data Where to store the data.
+         * @param  len  Maximum number of bytes.
+         * @return      Number of bytes copied.
+         */
+        uint16_t read(uint8_t *data, uint16_t len) {
+                if(len > count)
+                        len = count;
+                for(uint16_t i = 0; i < len; i++) {
+                        data[i] = buf[head];
+                        if(++head == SIZE)
+                                head = 0;
+                }
+                count -= len;
+                return len;
+        };
+};
+
+#endif // __USB_RINGBUF_H__
@@ -0,0 +1,196 @@
+/* Copyright (C) 2011 Circuits At Home, LTD. All rights reserved.
+
+This software may be distributed and modified under the terms of the GNU
+General Public License version 2 (GPL2) as published by the Free Software
+Foundation and appearing in the file GPL2.TXT included in the packaging of
+this file. Please note that GPL2 Section 2[b] requires that all works based
+on this software must also be made publicly available under the terms of
+the GPL2 ("Copyleft").
+
+Contact information
+-------------------
+
+Circuits At Home, LTD
+Web      :  http://www.circuitsathome.com
+e-mail   :  support@circuitsathome.com
+ */
+
+#if !defined(_usb_h_) || defined(__USB_SPI_H__)
+#error "Never include usb_spi.h directly; include Usb.h instead"
+#else
+#define __USB_SPI_H__
+
+/** Called when an asynchronous SPI transfer has finished. This may happen from an interrupt. */
+typedef void (*USBSpiCallback)(void *arg);
+
+/**
+ * Interface to the SPI bus the MAX3421E is connected to.
+ * By default the MAX3421e class drives the bus itself with blocking transfers.
+ * A backend attached with MAX3421e::setSpiBackend() takes over all accesses instead,
+ * which allows the FIFO transfers to run in the background, for instance using DMA.
+ * The chip select pin is always handled by the MAX3421e class.
+ */
+class USBSpiBackend {
+public:
+        /** Called by Init() after the SPI pins have been set up. */
+        virtual void begin() {
+        };
+
+        /** Called before the chip select pin is asserted and after it has been released. */
+        virtual void beginTransaction() {
+        };
+
+        virtual void endTransaction() {
+        };
+
+        /** Set the SPI clock in Hz, used from the next transaction. */
+        virtual void setClock(uint32_t hz __attribute__((unused))) {
+        };
+
+        /**
+         * Blocking transfer.
+         * @param tx  Data to send or NULL to send zeros.
+         * @param rx  Where to store the received data or NULL to discard it.
+         * @param len Number of bytes.
+         */
+        virtual void transfer(const uint8_t *tx, uint8_t *rx, uint16_t len) = 0;
+
+        /**
+         * Start a transfer and return before it has finished. The buffers must stay valid until the callback has been called.
+         * The default implementation does a blocking transfer and calls the callback before returning.
+         * @param  tx  Data to send or NULL to send zeros.
+         * @param  rx  Where to store the received data or NULL to discard it.
+         * @param  len Number of bytes.
+         * @param  cb  Called once the last byte has been clocked out.
+         * @param  arg Passed to the callback.
+         * @return     false if the transfer could not be started.
+         */
+        virtual bool transferAsync(const uint8_t *tx, uint8_t *rx, uint16_t len, USBSpiCallback cb, void *arg) {
+                transfer(tx, rx, len);
+                cb(arg);
+                return true;
+        };
+
+        /**
+         * Called while waiting for an asynchronous transfer. Backends without a completion interrupt finish the transfer here.
+         * @return true while a transfer is running.
+         */
+        virtual bool busy() {
+                return false;
+        };
+};
+
+#if defined(SPI_HAS_TRANSACTION) && !USING_SPI4TEENSY3
+/** Backend using the Arduino SPI library. The transfers are blocking, as the library has no portable asynchronous API. */
+class USBSpiArduino : public USBSpiBackend {
+        uint32_t clock;
+
+public:
+        USBSpiArduino() : clock(USB_SPI_CLOCK) {
+        };
+
+        void beginTransaction() {
+                USB_SPI.beginTransaction(SPISettings(clock, MSBFIRST, SPI_MODE0)); // Use MSB First and SPI mode 0
+        };
+
+        void setClock(uint32_t hz) {
+                clock = hz;
+        };
+
+        void endTransaction() {
+                USB_SPI.endTransaction();
+        };
+
+        void transfer(const uint8_t *tx, uint8_t *rx, uint16_t len) {
+#if !defined(ESP8266) && !defined(ESP32)
+                if(rx) {
+                        // The buffer is sent and overwritten with the received data
+                        if(tx)
+                                memcpy(rx, tx, len);
+                        else
+                                memset(rx, 0, len); // Make sure we send out empty bytes
+                        USB_SPI.transfer(rx, len);
+                        return;
+                }
+#endif
+                for(uint16_t i = 0; i < len; i++) {
+                        uint8_t c = USB_SPI.transfer(tx ? tx[i] : 0);
+                        if(rx)
+                                rx[i] = c;
+                }
+        };
+};
+#endif
+
+/**
+ * Backend for testing the asynchronous code paths.
+ * Every transfer is passed on to another backend, but it is only reported as finished once the latency has passed.
+ * Without a backend nothing is sent and zeros are received.
+ */
+class USBSpiMock : public USBSpiBackend {
+        USBSpiBackend *pBus;
+        uint32_t latency; // us
+        uint32_t started;
+        USBSpiCallback pFuncDone;
+        void *doneArg;
+
+public:
+        USBSpiMock(USBSpiBackend *bus = NULL, uint32_t latency_us = 0) :
+        pBus(bus),
+        latency(latency_us),
+        pFuncDone(NULL),
+        doneArg(NULL) {
+        };
+
+        void setLatency(uint32_t latency_us) {
+                latency = latency_us;
+        };
+
+        void begin() {
+                if(pBus)
+                        pBus->begin();
+        };
+
+        void beginTransaction() {
+                if(pBus)
+                        pBus->beginTransaction();
+        };
+
+        void endTransaction() {
+                if(pBus)
+                        pBus->endTransaction();
+        };
+
+        void setClock(uint32_t hz) {
+                if(pBus)
+                        pBus->setClock(hz);
+        };
+
+        void transfer(const uint8_t *tx, uint8_t *rx, uint16_t len) {
+                if(pBus)
+                        pBus->transfer(tx, rx, len);
+                else if(rx)
+                        memset(rx, 0, len);
+        };
+
+        bool transferAsync(const uint8_t *tx, uint8_t *rx, uint16_t len, USBSpiCallback cb, void *arg) {
+                if(pFuncDone)
+                        return false;
+                transfer(tx, rx, len);
+                started = (uint32_t)micros();
+                doneArg = arg;
+                pFuncDone = cb;
+                return true;
+        };
+
+        bool busy() {
+                if(pFuncDone && (uint32_t)micros() - started >= latency) {
+                        USBSpiCallback cb = pFuncDone;
+                        pFuncDone = NULL;
+                        cb(doneArg);
+                }
+                return pFuncDone != NULL;
+        };
+};
+
+#endif // __USB_SPI_H__
@@ -86,7 +86,17 @@ USBH_MIDI::USBH_MIDI(USB *p) :
 pUsb(p),
 bAddress(0),
 bPollEnable(false),
-readPtr(0) {
+readPtr(0),
+umpLen(0),
+rxPeak(0),
+bMidi2Enable(false),
+bIsMidi2(false),
+numGtb(0),
+sysexTxLen(0),
+sysexTxHoldLen(0),
+sysexTxCable(0),
+sysexTxDone(false),
+txPeak(0) {
         // initialize endpoint data structures
         for(uint8_t i=0; i<MIDI_MAX_ENDPOINTS; i++) {
                 epInfo[i].epAddr      = 0;
@@ -110,6 +120,8 @@ uint8_t USBH_MIDI::Init(uint8_t parent, uint8_t port, bool lowspeed)
         uint8_t    num_of_conf;  // number of configurations
         uint8_t  bConfNum = 0;    // configuration number
         uint8_t  bNumEP = 1;      // total number of EP in the configuration
+        uint8_t  bIface = 0;      // MIDI 2.0 interface number
+        uint8_t  bAlt = 0;        // MIDI 2.0 alternate setting
 
         USBTRACE("\rMIDI Init\r\n");
 #ifdef DEBUG_USB_HOST
@@ -210,20 +222,42 @@ uint8_t USBH_MIDI::Init(uint8_t parent, uint8_t port, bool lowspeed)
         bTransferTypeMask = bmUSB_TRANSFER_TYPE;
         setupDeviceSpecific();
         
+        // STEP0: Check if attached device has a USB MIDI 2.0 alternate setting
+        if( bMidi2Enable ) {
+                USBTRACE("\r\nSTEP0: MIDI 2.0 Start\r\n");
+                for(uint8_t i = 0; i < num_of_conf; i++) {
+                        MidiDescParser midiDescParser(this, true, true);
+                        rcode = pUsb->getConfDescr(bAddress, 0, i, &midiDescParser);
+                        if(rcode) // Check error code
+                                goto FailGetConfDescr;
+                        bNumEP += midiDescParser.getNumEPs();
+                        if(bNumEP > 1) {// All endpoints extracted
+                                bConfNum = midiDescParser.getConfValue();
+                                bIface = midiDescParser.getInterfaceNumber();
+                                bAlt = midiDescParser.getAltSetting();
+                                bIsMidi2 = true;
+                                break;
+                        }
+                }
+                USBTRACE2("STEP0: MIDI 2.0,NumEP:", bNumEP);
+        }
+
         // STEP1: Check if attached device is a MIDI device and fill endpoint data structure
-        USBTRACE("\r\nSTEP1: MIDI Start\r\n");
-        for(uint8_t i = 0; i < num_of_conf; i++) {
-                MidiDescParser midiDescParser(this, true);  // Check for MIDI device
-                rcode = pUsb->getConfDescr(bAddress, 0, i, &midiDescParser);
-                if(rcode) // Check error code
-                        goto FailGetConfDescr;
-                bNumEP += midiDescParser.getNumEPs();
-                if(bNumEP > 1) {// All endpoints extracted
-                        bConfNum = midiDescParser.getConfValue();
-                        break;
+        if( bNumEP == 1 ){
+                USBTRACE("\r\nSTEP1: MIDI Start\r\n");
+                for(uint8_t i = 0; i < num_of_conf; i++) {
+                        MidiDescParser midiDescParser(this, true);  // Check for MIDI device
+                        rcode = pUsb->getConfDescr(bAddress, 0, i, &midiDescParser);
+                        if(rcode) // Check error code
+                                goto FailGetConfDescr;
+                        bNumEP += midiDescParser.getNumEPs();
+                        if(bNumEP > 1) {// All endpoints extracted
+                                bConfNum = midiDescParser.getConfValue();
+                                break;
+                        }
                 }
+                USBTRACE2("STEP1: MIDI,NumEP:", bNumEP);
         }
-        USBTRACE2("STEP1: MIDI,NumEP:", bNumEP);
         //Found the MIDI device?
         if( bNumEP == 1 ){  //Device not found.
                 USBTRACE("MIDI not found.\r\nSTEP2: Attempts vendor specific bulk device\r\n");
@@ -258,6 +292,23 @@ uint8_t USBH_MIDI::Init(uint8_t parent, uint8_t port, bool lowspeed)
         if (rcode)
                 goto FailSetConfDescr;
 
+        if( bIsMidi2 ) {
+                // Select the MIDI 2.0 alternate setting
+                rcode = pUsb->ctrlReq(bAddress, 0, USB_SETUP_HOST_TO_DEVICE | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
+                        USB_REQUEST_SET_INTERFACE, bAlt, 0x00, bIface, 0x0000, 0x0000, NULL, NULL);
+                if (rcode)
+                        goto FailSetConfDescr;
+                USBTRACE2("MIDI 2.0 Alt:", bAlt);
+                rcode = getGroupTerminalBlocks(bIface, bAlt);
+                if (rcode == hrSTALL) {
+                        // Some devices do not implement the request, they are used without Group Terminal Blocks
+                        USBTRACE("No Group Terminal Blocks\r\n");
+                        numGtb = 0;
+                        memset(recvBuf, 0, MIDI_EVENT_PACKET_SIZE);
+                } else if (rcode)
+                        goto FailGetConfDescr;
+        }
+
         if(pFuncOnInit)
                 pFuncOnInit(); // Call the user function
 
@@ -279,6 +330,19 @@ uint8_t USBH_MIDI::Release()
         bAddress     = 0;
         bPollEnable  = false;
         readPtr      = 0;
+        umpLen       = 0;
+        bIsMidi2     = false;
+        numGtb       = 0;
+        pFuncSysExProducer = nullptr;
+        sysexTxLen   = 0;
+        return 0;
+}
+
+/* Services the SysEx stream, see SendSysExStream() */
+uint8_t USBH_MIDI::Poll()
+{
+        if( bPollEnable && pFuncSysExProducer )
+                return sendSysExStreamTask();
         return 0;
 }
 
@@ -328,6 +392,28 @@ uint8_t USBH_MIDI::RecvData(uint8_t *outBuf, bool isRaw)
 
         if( bPollEnable == false ) return 0;
 
+        if( bIsMidi2 ) {
+                uint32_t *ump;
+                uint8_t ev[4];
+                while( RecvUMP(&ump) ) {
+                        if( (ump[0] >> 28) == 0x3 ) { // 7-bit SysEx data
+                                recvSysExUMP(ump);
+                                continue;
+                        }
+                        uint8_t size = translateUMP(ump, ev);
+                        if( size == 0 )
+                                continue; // No MIDI 1.0 equivalent
+                        if( isRaw == true ) {
+                                *(outBuf++) = ev[0];
+                        }
+                        *(outBuf++) = ev[1];
+                        *(outBuf++) = ev[2];
+                        *(outBuf++) = ev[3];
+                        return size;
+                }
+                return 0;
+        }
+
         //Checking unprocessed message in buffer.
         if( readPtr != 0 && readPtr < MIDI_EVENT_PACKET_SIZE ){
                 if(recvBuf[readPtr] == 0 && recvBuf[readPtr+1] == 0) {
@@ -342,6 +428,8 @@ uint8_t USBH_MIDI::RecvData(uint8_t *outBuf, bool isRaw)
         if( rcode != 0 ) {
                 return 0;
         }
+        if( rcvd > rxPeak )
+                rxPeak = rcvd;
 
         //if all data is zero, no valid data received.
         if( recvBuf[0] == 0 && recvBuf[1] == 0 && recvBuf[2] == 0 && recvBuf[3] == 0 ) {
@@ -349,6 +437,13 @@ uint8_t USBH_MIDI::RecvData(uint8_t *outBuf, bool isRaw)
         }
 
 RecvData_return_from_buffer:
+        // Hand SysEx events to the receiver, so only the other messages are returned
+        while( pFuncSysExReceiver && isSysExEvent(&recvBuf[readPtr]) ) {
+                recvSysExChunk();
+                if( readPtr >= MIDI_EVENT_PACKET_SIZE || (recvBuf[readPtr] == 0 && recvBuf[readPtr+1] == 0) )
+                        return 0; // Nothing but SysEx data in this packet
+        }
+
         uint8_t m;
         uint8_t cin = recvBuf[readPtr];
         if( isRaw == true ) {
@@ -374,6 +469,17 @@ uint8_t USBH_MIDI::SendData(uint8_t *dataptr, uint8_t nCable)
                 return SendSysEx(dataptr, countSysExDataSize(dataptr), nCable);
         }
 
+        if( bIsMidi2 ) {
+                // MIDI 1.0 Channel Voice or System message as a single UMP word, the cable number is used as group
+                uint8_t msglen = getMsgSizeFromCin(cin);
+                uint32_t ump = ((uint32_t)((status < 0xf0) ? 0x2 : 0x1) << 28) | ((uint32_t)(nCable & 0x0f) << 24) | ((uint32_t)status << 16);
+                if( msglen > 1 )
+                        ump |= (uint32_t)dataptr[1] << 8;
+                if( msglen > 2 )
+                        ump |= dataptr[2];
+                return SendUMP(&ump, 1);
+        }
+
         //Building USB-MIDI Event Packets
         buf[0] = (uint8_t)(nCable << 4) | cin;
         buf[1] = dataptr[0];
@@ -464,6 +570,9 @@ uint8_t USBH_MIDI::SendSysEx(uint8_t *dataptr, uint16_t datasize, uint8_t nCable
         uint8_t wptr = 0;
         uint8_t maxpkt = epInfo[epDataInIndex].maxPktSize;
 
+        if( bIsMidi2 )
+                return sendSysExUMP(dataptr, datasize, nCable);
+
         USBTRACE("SendSysEx:\r\t");
         USBTRACE2(" Length:\t", datasize);
 #ifdef EXTRADEBUG
@@ -544,15 +653,371 @@ uint8_t USBH_MIDI::extractSysExData(uint8_t *p, uint8_t *buf)
         return(rc);
 }
 
+/* Pass consecutive SysEx events of one cable in recvBuf to the receiver as a single chunk.      */
+/* The data bytes are packed in place over the event headers already consumed, so no extra buffer */
+/* is needed. Returns the length of the chunk.                                                      */
+uint8_t USBH_MIDI::recvSysExChunk()
+{
+        uint8_t cable = recvBuf[readPtr] >> 4;
+        uint8_t *chunk = &recvBuf[readPtr];
+        uint8_t len = 0;
+        uint8_t flags = (recvBuf[readPtr+1] == 0xf0) ? MIDI_SYSEX_START : MIDI_SYSEX_CONTINUE;
+
+        while( readPtr < MIDI_EVENT_PACKET_SIZE && (recvBuf[readPtr] >> 4) == cable && isSysExEvent(&recvBuf[readPtr]) ) {
+                uint8_t cin = recvBuf[readPtr] & 0x0f;
+                // The write position never passes the read position, as 3 bytes are kept for every 4 bytes consumed
+                len += extractSysExData(&recvBuf[readPtr], chunk + len);
+                readPtr += 4;
+                if( cin != 0x4 ) { // 0x5-0x7: SysEx ends
+                        flags |= MIDI_SYSEX_END;
+                        break;
+                }
+        }
+        pFuncSysExReceiver(cable, chunk, len, flags);
+        return len;
+}
+
+/* Start sending a SysEx message supplied by a producer function */
+uint8_t USBH_MIDI::SendSysExStream(uint8_t (*producer)(uint8_t *buf, uint8_t len), uint8_t nCable)
+{
+        if( !producer )
+                return USB_ERROR_INVALID_ARGUMENT;
+        if( pFuncSysExProducer )
+                return USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE;
+        if( bIsMidi2 )
+                return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED; // The stream is packed as USB-MIDI 1.0 events
+
+        sysexTxLen = 0;
+        sysexTxHoldLen = 0;
+        sysexTxCable = nCable;
+        sysexTxDone = false;
+        pFuncSysExProducer = producer;
+        return 0;
+}
+
+/* Terminate the SysEx stream in progress */
+void USBH_MIDI::abortSysExStream()
+{
+        if( !pFuncSysExProducer )
+                return;
+
+        if( !sysexTxDone && bPollEnable ) {
+                // Send the pending events followed by an End of Exclusive, so the device does not wait for the rest
+                if( (uint8_t)(sysexTxLen + 4) > epInfo[epDataOutIndex].maxPktSize ) {
+                        pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, sysexTxLen, sysexTxBuf);
+                        sysexTxLen = 0;
+                }
+                uint8_t *buf = &sysexTxBuf[sysexTxLen];
+                buf[0] = (sysexTxCable << 4) | 0x5;
+                buf[1] = 0xf7;
+                buf[2] = 0x00;
+                buf[3] = 0x00;
+                sysexTxLen += 4;
+                pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, sysexTxLen, sysexTxBuf);
+        }
+        sysexTxLen = 0;
+        pFuncSysExProducer = nullptr;
+}
+
+/* Pack data from the SysEx producer into USB-MIDI event packets and send them when the OUT endpoint is ready. */
+/* Only a single packet is buffered, so the RAM needed does not depend on the size of the SysEx message.      */
+uint8_t USBH_MIDI::sendSysExStreamTask()
+{
+        uint8_t rcode;
+        uint8_t maxpkt = epInfo[epDataOutIndex].maxPktSize;
+
+        while( !sysexTxDone && (uint8_t)(sysexTxLen + 4) <= maxpkt ) {
+                if( sysexTxHoldLen < 3 ) {
+                        uint8_t n = pFuncSysExProducer(&sysexTxHold[sysexTxHoldLen], 3 - sysexTxHoldLen);
+                        if( n == 0 )
+                                break; // No data available right now
+                        sysexTxHoldLen += n;
+                }
+
+                uint8_t *buf = &sysexTxBuf[sysexTxLen];
+                uint8_t i;
+                for(i = 0; i < sysexTxHoldLen; i++) {
+                        if( sysexTxHold[i] == 0xf7 )
+                                break;
+                }
+                if( i < sysexTxHoldLen ) {
+                        buf[0] = (sysexTxCable << 4) | (0x5 + i);  //x5-x7 SysEx ends with following 1-3 bytes.
+                        sysexTxDone = true;
+                } else if( sysexTxHoldLen == 3 ) {
+                        buf[0] = (sysexTxCable << 4) | 0x4;        //x4 SysEx starts or continues
+                        i = 2;
+                } else {
+                        continue; // Ask the producer for the rest of the event
+                }
+                for(uint8_t j = 0; j < 3; j++)
+                        buf[j + 1] = (j <= i) ? sysexTxHold[j] : 0x00;
+                sysexTxHoldLen = 0;
+                sysexTxLen += 4;
+        }
+        if( (uint8_t)(sysexTxLen + sysexTxHoldLen) > txPeak )
+                txPeak = sysexTxLen + sysexTxHoldLen;
+
+        if( sysexTxLen == 0 )
+                return 0;
+
+        rcode = pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, sysexTxLen, sysexTxBuf);
+        if( rcode == hrNAK )
+                return 0; // The device is busy, the packet is sent again on the next poll
+        if( rcode ) {
+                USBTRACE2("SysEx stream failed:", rcode);
+                pFuncSysExProducer = nullptr;
+                sysexTxLen = 0;
+                return rcode;
+        }
+        sysexTxLen = 0;
+        if( sysexTxDone )
+                pFuncSysExProducer = nullptr;
+        return 0;
+}
+
+/* Read the Group Terminal Block descriptors of a USB MIDI 2.0 alternate setting. recvBuf is used as scratch buffer */
+uint8_t USBH_MIDI::getGroupTerminalBlocks(uint8_t iface, uint8_t alt)
+{
+        uint8_t rcode;
+        uint16_t total;
+
+        numGtb = 0;
+        // Header first to get the total length
+        rcode = pUsb->ctrlReq(bAddress, 0, USB_SETUP_DEVICE_TO_HOST | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
+                USB_REQUEST_GET_DESCRIPTOR, alt, USB_DESCRIPTOR_CS_GR_TRM_BLOCK, iface, 5, 5, recvBuf, NULL);
+        if( rcode )
+                return rcode;
+
+        total = (uint16_t)recvBuf[3] | ((uint16_t)recvBuf[4] << 8);
+        if( total > MIDI_EVENT_PACKET_SIZE )
+                total = MIDI_EVENT_PACKET_SIZE; // Enough for four blocks, the rest are ignored
+        rcode = pUsb->ctrlReq(bAddress, 0, USB_SETUP_DEVICE_TO_HOST | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
+                USB_REQUEST_GET_DESCRIPTOR, alt, USB_DESCRIPTOR_CS_GR_TRM_BLOCK, iface, total, total, recvBuf, NULL);
+        if( rcode )
+                return rcode;
+
+        for(uint8_t i = recvBuf[0]; i + 13 <= total && numGtb < MIDI_MAX_GROUP_TERMINAL_BLOCKS; i += recvBuf[i]) {
+                uint8_t *d = &recvBuf[i];
+                if( d[0] == 0 )
+                        break;
+                if( d[1] != USB_DESCRIPTOR_CS_GR_TRM_BLOCK || d[2] != MIDI_GR_TRM_BLOCK )
+                        continue;
+                gtb[numGtb].id         = d[3];
+                gtb[numGtb].type       = d[4];
+                gtb[numGtb].firstGroup = d[5];
+                gtb[numGtb].numGroups  = d[6];
+                gtb[numGtb].protocol   = d[8];
+                USBTRACE2("GTB id:", d[3]);
+                USBTRACE2(" Group:", d[5]);
+                USBTRACE2(" Protocol:", d[8]);
+                numGtb++;
+        }
+        memset(recvBuf, 0, MIDI_EVENT_PACKET_SIZE);
+        return 0;
+}
+
+/* Receive a Universal MIDI Packet, returned in place in the receive buffer */
+uint8_t USBH_MIDI::RecvUMP(uint32_t **ump)
+{
+        if( !bPollEnable || !bIsMidi2 )
+                return 0;
+
+        for(;;) {
+                if( readPtr >= umpLen ) {
+                        uint16_t rcvd;
+                        readPtr = 0;
+                        umpLen = 0;
+                        if( RecvData(&rcvd, recvBuf) != 0 )
+                                return 0;
+                        umpLen = rcvd & ~0x03;
+                        if( umpLen == 0 )
+                                return 0;
+                        if( umpLen > rxPeak )
+                                rxPeak = umpLen;
+                }
+                uint32_t *p = reinterpret_cast<uint32_t *>(&recvBuf[readPtr]); // UMP words are little-endian on the bus, like all supported MCUs
+                uint8_t n = getWordsFromMT(*p >> 28);
+                if( readPtr + n * 4 > umpLen ) { // Truncated message
+                        readPtr = umpLen;
+                        return 0;
+                }
+                readPtr += n * 4;
+                if( *p == 0 )
+                        continue; // NOOP
+                *ump = p;
+                return n;
+        }
+}
+
+/* Send Universal MIDI Packets without copying them */
+uint8_t USBH_MIDI::SendUMP(uint32_t *ump, uint8_t nWords)
+{
+        if( !bIsMidi2 )
+                return USB_DEV_CONFIG_ERROR_DEVICE_NOT_SUPPORTED;
+        return pUsb->outTransfer(bAddress, epInfo[epDataOutIndex].epAddr, nWords * 4, reinterpret_cast<uint8_t *>(ump));
+}
+
+/* Occupancy of recvBuf. In MIDI 1.0 mode the events left end at the first empty one, like in RecvData() */
+USBBufferUsage USBH_MIDI::getRxUsage()
+{
+        USBBufferUsage u = {sizeof (recvBuf), 0, rxPeak};
+
+        if( bIsMidi2 ) {
+                if( readPtr < umpLen )
+                        u.used = umpLen - readPtr;
+        } else if( readPtr != 0 ) {
+                for(uint8_t i = readPtr; i < MIDI_EVENT_PACKET_SIZE && (recvBuf[i] != 0 || recvBuf[i+1] != 0); i += 4)
+                        u.used += 4;
+        }
+        return u;
+}
+
+/* Translate a UMP message into a USB-MIDI 1.0 event packet. Returns the MIDI message size or 0 if there is no equivalent */
+uint8_t USBH_MIDI::translateUMP(const uint32_t *ump, uint8_t *ev)
+{
+        uint8_t mt     = ump[0] >> 28;
+        uint8_t group  = (ump[0] >> 24) & 0x0f;
+        uint8_t status = (ump[0] >> 16) & 0xff;
+        uint8_t cin;
+
+        switch( mt ) {
+                case 0x1: // System Real Time and System Common
+                case 0x2: // MIDI 1.0 Channel Voice
+                        ev[1] = status;
+                        ev[2] = (ump[0] >> 8) & 0x7f;
+                        ev[3] = ump[0] & 0x7f;
+                        cin = convertStatus2Cin(status);
+                        break;
+                case 0x4: // MIDI 2.0 Channel Voice, scale down the values
+                        cin = status >> 4;
+                        ev[1] = status;
+                        ev[2] = (ump[0] >> 8) & 0x7f;
+                        switch( status & 0xf0 ) {
+                                case 0x90:
+                                        ev[3] = ump[1] >> 25;
+                                        if( ev[3] == 0 && (ump[1] >> 16) != 0 )
+                                                ev[3] = 1; // Velocity 0 would be a Note Off
+                                        break;
+                                case 0x80: // Note Off
+                                case 0xa0: // Poly Pressure
+                                case 0xb0: // Control Change
+                                        ev[3] = ump[1] >> 25;
+                                        break;
+                                case 0xc0: // Program Change
+                                        ev[2] = (ump[1] >> 24) & 0x7f;
+                                        ev[3] = 0;
+                                        break;
+                                case 0xd0: // Channel Pressure
+                                        ev[2] = ump[1] >> 25;
+                                        ev[3] = 0;
+                                        break;
+                                case 0xe0: // Pitch Bend
+                                        ev[2] = (ump[1] >> 18) & 0x7f;
+                                        ev[3] = ump[1] >> 25;
+                                        break;
+                                default: // Registered/Assignable Controllers, Per-Note messages
+                                        return 0;
+                        }
+                        break;
+                default:
+                        return 0;
+        }
+        ev[0] = (group << 4) | cin;
+        return getMsgSizeFromCin(cin);
+}
+
+/* Pass a UMP 7-bit SysEx packet to the SysEx receiver, with 0xF0 and 0xF7 added like in USB-MIDI 1.0 */
+void USBH_MIDI::recvSysExUMP(const uint32_t *ump)
+{
+        uint8_t buf[8];
+        uint8_t len = 0;
+        uint8_t flags = MIDI_SYSEX_CONTINUE;
+        uint8_t status = (ump[0] >> 20) & 0x0f;
+        uint8_t n = (ump[0] >> 16) & 0x0f;
+
+        if( !pFuncSysExReceiver )
+                return; // Complete SysEx messages can not be returned by RecvData() in MIDI 2.0 mode
+
+        if( status == 0x0 || status == 0x1 ) { // Complete or start
+                buf[len++] = 0xf0;
+                flags |= MIDI_SYSEX_START;
+        }
+        if( n > 6 )
+                n = 6;
+        for(uint8_t i = 0; i < n; i++) {
+                // Data bytes start at bits 15-8 of the first word
+                buf[len++] = (i < 2) ? (uint8_t)(ump[0] >> (8 - 8 * i)) : (uint8_t)(ump[1] >> (24 - 8 * (i - 2)));
+        }
+        if( status == 0x0 || status == 0x3 ) { // Complete or end
+                buf[len++] = 0xf7;
+                flags |= MIDI_SYSEX_END;
+        }
+        pFuncSysExReceiver((ump[0] >> 24) & 0x0f, buf, len, flags);
+}
+
+/* Send SysEx message as UMP 7-bit SysEx packets */
+uint8_t USBH_MIDI::sendSysExUMP(uint8_t *dataptr, uint16_t datasize, uint8_t group)
+{
+        uint32_t buf[MIDI_EVENT_PACKET_SIZE / 4];
+        uint8_t wptr = 0;
+        uint8_t rc = 0;
+        uint8_t maxwords = epInfo[epDataOutIndex].maxPktSize / 4;
+        bool first = true;
+
+        // 0xF0 and 0xF7 are not part of the UMP data
+        if( datasize && dataptr[0] == 0xf0 ) {
+                dataptr++;
+                datasize--;
+        }
+        if( datasize && dataptr[datasize - 1] == 0xf7 )
+                datasize--;
+
+        do {
+                uint8_t n = (datasize > 6) ? 6 : datasize;
+                uint8_t status;
+                datasize -= n;
+                if( first )
+                        status = datasize ? 0x1 : 0x0; // Start or complete
+                else
+                        status = datasize ? 0x2 : 0x3; // Continue or end
+                first = false;
+
+                uint32_t w0 = (0x3UL << 28) | ((uint32_t)(group & 0x0f) << 24) | ((uint32_t)status << 20) | ((uint32_t)n << 16);
+                uint32_t w1 = 0;
+                for(uint8_t i = 0; i < n; i++) {
+                        if( i < 2 )
+                                w0 |= (uint32_t)dataptr[i] << (8 - 8 * i);
+                        else
+                                w1 |= (uint32_t)dataptr[i] << (24 - 8 * (i - 2));
+                }
+                dataptr += n;
+                buf[wptr++] = w0;
+                buf[wptr++] = w1;
+
+                if( wptr + 2 > maxwords || datasize == 0 ) { //Reach a maxPktSize or data end.
+                        if( (rc = SendUMP(buf, wptr)) != 0 )
+                                break;
+                        wptr = 0;
+                }
+        } while( datasize > 0 );
+        return(rc);
+}
+
 // Configuration Descriptor Parser
 // Copied from confdescparser.h and modifiy.
-MidiDescParser::MidiDescParser(UsbMidiConfigXtracter *xtractor, bool modeMidi) :
+MidiDescParser::MidiDescParser(UsbMidiConfigXtracter *xtractor, bool modeMidi, bool modeMidi2) :
 theXtractor(xtractor),
 stateParseDescr(0),
 dscrLen(0),
 dscrType(0),
 nEPs(0),
-isMidiSearch(modeMidi){
+isMidiSearch(modeMidi),
+isMidi2Search(modeMidi2),
+isMidiStreaming(false),
+ifaceNum(0),
+altSetting(0),
+goodIfaceNum(0),
+goodAltSetting(0){
         theBuffer.pValue = varBuffer;
         valParser.Initialize(&theBuffer);
         theSkipper.Initialize(&theBuffer);
@@ -615,6 +1080,9 @@ bool MidiDescParser::ParseDescriptor(uint8_t **pp, uint16_t *pcntdn) {
                                 case USB_DESCRIPTOR_INTERFACE:
                                         if(!valParser.Parse(pp, pcntdn))
                                                 return false;
+                                        ifaceNum = uid->bInterfaceNumber;
+                                        altSetting = uid->bAlternateSetting;
+                                        isMidiStreaming = (uid->bInterfaceClass == USB_CLASS_AUDIO && uid->bInterfaceSubClass == USB_SUBCLASS_MIDISTREAMING);
                                         USBTRACE("Interface descriptor:\r\n");
                                         USBTRACE2(" Inf#:\t\t", uid->bInterfaceNumber);
                                         USBTRACE2(" Alt:\t\t", uid->bAlternateSetting);
@@ -632,7 +1100,8 @@ bool MidiDescParser::ParseDescriptor(uint8_t **pp, uint16_t *pcntdn) {
                                                         break;
                                                 }
                                         }
-                                        isGoodInterface = true;
+                                        // A MIDI 2.0 interface is only known from the MS Interface Header that follows
+                                        isGoodInterface = !isMidi2Search;
                                         // Initialize the counter if no two endpoints can be found in one interface.
                                         if(nEPs < 2)
                                                 // reset endpoint counter
@@ -645,6 +1114,23 @@ bool MidiDescParser::ParseDescriptor(uint8_t **pp, uint16_t *pcntdn) {
                                                 USBTRACE(">Extracting endpoint\r\n");
                                                 if( theXtractor->EndpointXtract(confValue, 0, 0, 0, (USB_ENDPOINT_DESCRIPTOR*)varBuffer) ) 
                                                         nEPs++;
+                                                goodIfaceNum = ifaceNum;
+                                                goodAltSetting = altSetting;
+                                        }
+                                        break;
+                                case USB_DESCRIPTOR_CS_INTERFACE:
+                                        // Only the MS Interface Header is needed, it fits in varBuffer. Longer descriptors are skipped
+                                        if(!isMidi2Search || dscrLen < 3 || dscrLen > sizeof(varBuffer)) {
+                                                if(!theSkipper.Skip(pp, pcntdn, dscrLen - 2))
+                                                        return false;
+                                                break;
+                                        }
+                                        if(!valParser.Parse(pp, pcntdn))
+                                                return false;
+                                        // bcdMSC of 0x0200 marks the USB MIDI 2.0 alternate setting
+                                        if(isMidiStreaming && varBuffer[2] == MIDI_MS_HEADER && dscrLen >= 7 && varBuffer[4] >= 0x02) {
+                                                USBTRACE("+MIDI 2.0 found\r\n");
+                                                isGoodInterface = true;
                                         }
                                         break;
 
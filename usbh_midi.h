@@ -34,11 +34,34 @@
 #define MIDI_EVENT_PACKET_SIZE 64
 #define MIDI_MAX_SYSEX_SIZE   256
 
+// SysEx chunk flags passed to the receive callback, see attachSysExReceiver()
+#define MIDI_SYSEX_CONTINUE   0x00 // Chunk is in the middle of a SysEx message
+#define MIDI_SYSEX_START      0x01 // Chunk begins with 0xF0
+#define MIDI_SYSEX_END        0x02 // Chunk ends with 0xF7
+
+// USB MIDI 2.0
+#define USB_DESCRIPTOR_CS_INTERFACE      0x24 // Class-specific interface descriptor
+#define USB_DESCRIPTOR_CS_GR_TRM_BLOCK   0x26 // Group Terminal Block descriptor
+#define MIDI_MS_HEADER                   0x01 // MS Interface Header descriptor subtype
+#define MIDI_GR_TRM_BLOCK_HEADER         0x01
+#define MIDI_GR_TRM_BLOCK                0x02
+#define MIDI_MAX_GROUP_TERMINAL_BLOCKS   4
+
 namespace _ns_USBH_MIDI {
 const uint8_t cin2len[] PROGMEM =  {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
 const uint8_t sys2cin[] PROGMEM =  {0, 2, 3, 2, 0, 0, 5, 0, 0xf, 0, 0xf, 0xf, 0xf, 0, 0xf, 0xf};
+const uint8_t mt2words[] PROGMEM = {1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4}; // Universal MIDI Packet size in 32-bit words
 }
 
+/** Group Terminal Block of a USB MIDI 2.0 interface. */
+struct MidiGroupTerminalBlock {
+        uint8_t id;         // bGrpTrmBlkID
+        uint8_t type;       // 0: bidirectional, 1: input only, 2: output only
+        uint8_t firstGroup; // First group, 0-15
+        uint8_t numGroups;  // Number of groups spanned
+        uint8_t protocol;   // bMIDIProtocol, 0x01-0x04: MIDI 1.0, 0x11-0x12: MIDI 2.0, 0 if unknown
+};
+
 // Endpoint Descriptor extracter Class
 class UsbMidiConfigXtracter {
 public:
@@ -63,17 +86,25 @@ class MidiDescParser : public USBReadParser {
         uint8_t dscrType; // Descriptor type
         uint8_t nEPs; // number of valid endpoint
         bool isMidiSearch; //Configuration mode true: MIDI, false: Vendor specific
+        bool isMidi2Search; //Only accept USB MIDI 2.0 alternate settings
+        bool isMidiStreaming; // Current interface is MIDI Streaming
 
         bool isGoodInterface; // Apropriate interface flag
         uint8_t confValue; // Configuration value
+        uint8_t ifaceNum;  // Interface number of the current interface
+        uint8_t altSetting; // Alternate setting of the current interface
+        uint8_t goodIfaceNum; // Interface the endpoints were extracted from
+        uint8_t goodAltSetting;
 
         bool ParseDescriptor(uint8_t **pp, uint16_t *pcntdn);
 
 public:
-        MidiDescParser(UsbMidiConfigXtracter *xtractor, bool modeMidi);
+        MidiDescParser(UsbMidiConfigXtracter *xtractor, bool modeMidi, bool modeMidi2=false);
         void Parse(const uint16_t len, const uint8_t *pbuf, const uint16_t &offset);
         inline uint8_t getConfValue() { return confValue; };
         inline uint8_t getNumEPs() { return nEPs; };
+        inline uint8_t getInterfaceNumber() { return goodIfaceNum; };
+        inline uint8_t getAltSetting() { return goodAltSetting; };
 };
 
 /** This class implements support for a MIDI device. */
@@ -92,10 +123,39 @@ protected:
         /* Endpoint data structure */
         EpInfo  epInfo[MIDI_MAX_ENDPOINTS];
         /* MIDI Event packet buffer */
-        uint8_t recvBuf[MIDI_EVENT_PACKET_SIZE];
+        uint8_t recvBuf[MIDI_EVENT_PACKET_SIZE] __attribute__((aligned(4))); // Aligned so UMP words can be read in place
         uint8_t readPtr;
+        uint8_t umpLen;   // Number of valid bytes in recvBuf when using UMP
+        uint8_t rxPeak;   // Most bytes received into recvBuf at once
+        /* USB MIDI 2.0 */
+        bool    bMidi2Enable; // Select the MIDI 2.0 alternate setting if available
+        bool    bIsMidi2;     // The MIDI 2.0 alternate setting is active, data is sent as UMP
+        uint8_t numGtb;
+        MidiGroupTerminalBlock gtb[MIDI_MAX_GROUP_TERMINAL_BLOCKS];
+        /* Streaming SysEx transmit state */
+        uint8_t sysexTxBuf[MIDI_EVENT_PACKET_SIZE]; // USB-MIDI event packets waiting for the OUT endpoint
+        uint8_t sysexTxLen;     // Number of bytes in sysexTxBuf
+        uint8_t sysexTxHold[3]; // SysEx bytes not yet packed into an event
+        uint8_t sysexTxHoldLen;
+        uint8_t sysexTxCable;
+        bool    sysexTxDone;    // 0xF7 has been packed, no more data is requested from the producer
+        uint8_t txPeak;         // Most bytes held in sysexTxBuf and sysexTxHold together
 
         uint16_t countSysExDataSize(uint8_t *dataptr);
+        uint8_t recvSysExChunk();
+        uint8_t getGroupTerminalBlocks(uint8_t iface, uint8_t alt);
+        uint8_t translateUMP(const uint32_t *ump, uint8_t *ev);
+        void recvSysExUMP(const uint32_t *ump);
+        uint8_t sendSysExUMP(uint8_t *dataptr, uint16_t datasize, uint8_t group);
+        inline uint8_t getWordsFromMT(uint8_t mt) {
+                return pgm_read_byte_near(_ns_USBH_MIDI::mt2words + mt);
+        };
+        uint8_t sendSysExStreamTask();
+        inline bool isSysExEvent(uint8_t *p) {
+                uint8_t cin = *p & 0x0f;
+                // CIN 0x5 is also used by single byte System Common messages, in that case it is not 0xF7
+                return (cin == 0x4 || cin == 0x6 || cin == 0x7 || (cin == 0x5 && *(p+1) == 0xf7));
+        };
         void setupDeviceSpecific();
         inline uint8_t convertStatus2Cin(uint8_t status) {
                 return ((status < 0xf0) ? ((status & 0xF0) >> 4) : pgm_read_byte_near(_ns_USBH_MIDI::sys2cin + (status & 0x0F)));
@@ -125,6 +185,51 @@ public:
         uint8_t lookupMsgSize(uint8_t midiMsg, uint8_t cin=0);
         uint8_t SendSysEx(uint8_t *dataptr, uint16_t datasize, uint8_t nCable=0);
         uint8_t extractSysExData(uint8_t *p, uint8_t *buf);
+        /**
+         * Start sending a SysEx message of any size without buffering it.
+         * The data is pulled from the producer while Usb.Task() is running, whenever the OUT endpoint accepts another packet.
+         * @param  producer Called with a buffer and the maximum number of bytes wanted, returns the number of bytes written.
+         *                  The first byte must be 0xF0 and the message ends when 0xF7 is returned.
+         *                  Return 0 if no data is available yet; it will be asked again later.
+         * @param  nCable   Cable number.
+         * @return          0 on success, USB_ERROR_CLASS_INSTANCE_ALREADY_IN_USE if a stream is already in progress.
+         */
+        uint8_t SendSysExStream(uint8_t (*producer)(uint8_t *buf, uint8_t len), uint8_t nCable=0);
+        /** Returns true while a SysEx stream started with SendSysExStream() is still being sent. */
+        inline bool isSysExStreamBusy() { return (pFuncSysExProducer != nullptr); };
+        /** Abort the SysEx stream in progress, the message is terminated with 0xF7 so the device does not hang. */
+        void abortSysExStream();
+        /** @return Capacity, current and peak occupancy of the receive buffer, which holds the events not yet returned by RecvData() or RecvUMP(). */
+        USBBufferUsage getRxUsage();
+        /** @return Capacity, current and peak occupancy of the buffers holding SysEx stream data not yet sent. */
+        USBBufferUsage getTxUsage() {
+                USBBufferUsage u = {sizeof (sysexTxBuf) + sizeof (sysexTxHold), (uint16_t)(sysexTxLen + sysexTxHoldLen), txPeak};
+                return u;
+        };
+        /* USB MIDI 2.0 */
+        /**
+         * Select the MIDI 2.0 alternate setting on devices which support it. Must be called before the device is connected.
+         * RecvData() and SendData() keep working with MIDI 1.0 messages, they are translated to and from UMP.
+         * @param enable Set to true to use MIDI 2.0.
+         */
+        inline void setMidi2Enable(bool enable) { bMidi2Enable = enable; };
+        /** Returns true if the MIDI 2.0 alternate setting is active. */
+        inline bool isMidi2() { return bIsMidi2; };
+        inline uint8_t getNumGroupTerminalBlocks() { return numGtb; };
+        inline const MidiGroupTerminalBlock *getGroupTerminalBlock(uint8_t i) { return (i < numGtb) ? &gtb[i] : NULL; };
+        /**
+         * Receive a single Universal MIDI Packet without copying it.
+         * @param  ump Set to point to the words of the message inside the receive buffer. It stays valid until the next call.
+         * @return     Number of 32-bit words in the message, 0 if nothing was received.
+         */
+        uint8_t RecvUMP(uint32_t **ump);
+        /**
+         * Send one or more Universal MIDI Packets straight from the buffer of the caller.
+         * @param  ump    Pointer to the words to send.
+         * @param  nWords Number of 32-bit words.
+         * @return        0 on success.
+         */
+        uint8_t SendUMP(uint32_t *ump, uint8_t nWords);
         // backward compatibility functions
         inline uint8_t RcvData(uint16_t *bytes_rcvd, uint8_t *dataptr) { return RecvData(bytes_rcvd, dataptr); };
         inline uint8_t RcvData(uint8_t *outBuf) { return RecvData(outBuf); };
@@ -133,12 +238,26 @@ public:
         virtual uint8_t Init(uint8_t parent, uint8_t port, bool lowspeed);
         virtual uint8_t Release();
         virtual uint8_t GetAddress() { return bAddress; };
+        USB_DEVICE_MEMORY_USAGE();
+
+        virtual uint8_t Poll();
 
         void attachOnInit(void (*funcOnInit)(void)) {
                 pFuncOnInit = funcOnInit;
         };
+        /**
+         * Used to receive SysEx messages as chunks instead of single events.
+         * When attached, RecvData() hands all consecutive SysEx events in a packet to this function
+         * and only returns the other messages.
+         * @param funcSysEx Called with the cable number, the data, the length and the MIDI_SYSEX_* flags.
+         */
+        void attachSysExReceiver(void (*funcSysEx)(uint8_t nCable, uint8_t *data, uint8_t len, uint8_t flags)) {
+                pFuncSysExReceiver = funcSysEx;
+        };
 private:
         void (*pFuncOnInit)(void) = nullptr; // Pointer to function called in onInit()
+        uint8_t (*pFuncSysExProducer)(uint8_t *buf, uint8_t len) = nullptr; // Pointer to function supplying the outgoing SysEx stream
+        void (*pFuncSysExReceiver)(uint8_t nCable, uint8_t *data, uint8_t len, uint8_t flags) = nullptr; // Pointer to function receiving SysEx chunks
 };
 
 #endif //_USBH_MIDI_H_
@@ -0,0 +1,180 @@
+/*
+ *******************************************************************************
+ * USB-MIDI router for USB Host Shield 2.0 Library
+ *
+ * Moves USB-MIDI event packets between several USBH_MIDI instances
+ * according to a cable/channel aware routing table.
+ *******************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *******************************************************************************
+ */
+
+#include "usbh_midi_router.h"
+
+USBH_MIDI_Router::USBH_MIDI_Router() :
+numPorts(0) {
+        for(uint8_t i = 0; i < MIDI_ROUTER_MAX_PORTS; i++) {
+                ports[i] = NULL;
+                out[i].len = 0;
+        }
+        clearRoutes();
+}
+
+uint8_t USBH_MIDI_Router::addPort(USBH_MIDI *pMidi) {
+        if(!pMidi || numPorts >= MIDI_ROUTER_MAX_PORTS)
+                return MIDI_ROUTE_UNUSED;
+        ports[numPorts] = pMidi;
+        return numPorts++;
+}
+
+uint8_t USBH_MIDI_Router::addRoute(uint8_t srcPort, uint8_t dstPort, uint8_t srcCable, uint8_t dstCable, uint16_t channelMask, uint16_t typeMask) {
+        if(srcPort >= numPorts || dstPort >= numPorts)
+                return MIDI_ROUTE_UNUSED;
+
+        for(uint8_t i = 0; i < MIDI_ROUTER_MAX_ROUTES; i++) {
+                if(routes[i].srcPort != MIDI_ROUTE_UNUSED)
+                        continue;
+                routes[i].srcPort = srcPort;
+                routes[i].srcCable = srcCable;
+                routes[i].dstPort = dstPort;
+                routes[i].dstCable = dstCable;
+                routes[i].channelMask = channelMask;
+                routes[i].typeMask = typeMask;
+                memset(&stats[i], 0, sizeof(MidiRouteStats));
+                return i;
+        }
+        return MIDI_ROUTE_UNUSED;
+}
+
+void USBH_MIDI_Router::removeRoute(uint8_t route) {
+        if(route < MIDI_ROUTER_MAX_ROUTES)
+                routes[route].srcPort = MIDI_ROUTE_UNUSED;
+}
+
+void USBH_MIDI_Router::clearRoutes() {
+        for(uint8_t i = 0; i < MIDI_ROUTER_MAX_ROUTES; i++)
+                routes[i].srcPort = MIDI_ROUTE_UNUSED;
+        resetStats();
+}
+
+void USBH_MIDI_Router::resetStats() {
+        memset(stats, 0, sizeof(stats));
+}
+
+bool USBH_MIDI_Router::routeMatches(const MidiRoute &r, uint8_t port, const uint8_t *event) {
+        uint8_t cin = event[0] & 0x0F;
+
+        if(cin == 0x5 && event[1] != 0xF7)
+                cin = 0x2; // Tune Request, not the end of a SysEx message
+        if(r.srcPort != port)
+                return false;
+        if(r.srcCable != MIDI_ROUTE_ANY_CABLE && r.srcCable != (event[0] >> 4))
+                return false;
+        if(!(r.typeMask & MIDI_ROUTE_TYPE(cin)))
+                return false;
+        if(cin >= 0x8 && cin <= 0xE) // Channel Voice messages
+                return (r.channelMask & ((uint16_t)1 << (event[1] & 0x0F)));
+        return true;
+}
+
+void USBH_MIDI_Router::queueEvent(uint8_t route, const uint8_t *event, uint32_t timestamp) {
+        const MidiRoute &r = routes[route];
+        OutBuffer &o = out[r.dstPort];
+
+        if(!*ports[r.dstPort] || ports[r.dstPort]->isMidi2()) {
+                stats[route].dropped++;
+                return;
+        }
+        if(o.len + 4 > MIDI_ROUTER_BUFFER_SIZE) {
+                flush(r.dstPort); // Buffer is full, send it now
+                if(o.len + 4 > MIDI_ROUTER_BUFFER_SIZE) {
+                        stats[route].dropped++; // The device is still busy
+                        return;
+                }
+        }
+        uint8_t *p = &o.data[o.len];
+        p[0] = (r.dstCable == MIDI_ROUTE_SAME_CABLE) ? event[0] : (uint8_t)((r.dstCable << 4) | (event[0] & 0x0F));
+        p[1] = event[1];
+        p[2] = event[2];
+        p[3] = event[3];
+        o.route[o.len / 4] = route;
+        o.timestamp[o.len / 4] = timestamp;
+        o.len += 4;
+}
+
+/* Send the buffered events of a port in a single transfer */
+void USBH_MIDI_Router::flush(uint8_t port) {
+        OutBuffer &o = out[port];
+
+        if(o.len == 0)
+                return;
+        if(!*ports[port] || ports[port]->isMidi2()) {
+                drop(port);
+                return;
+        }
+
+        uint8_t rcode = ports[port]->SendRawData(o.len, o.data);
+        if(rcode == hrNAK)
+                return; // Try again on the next call
+        if(rcode) {
+                drop(port);
+                return;
+        }
+
+        uint32_t now = (uint32_t)micros();
+        for(uint8_t i = 0; i < o.len / 4; i++) {
+                MidiRouteStats &s = stats[o.route[i]];
+                uint32_t latency = now - o.timestamp[i];
+                s.events++;
+                s.latencySum += latency;
+                if(latency > s.latencyMax)
+                        s.latencyMax = latency;
+        }
+        o.len = 0;
+}
+
+void USBH_MIDI_Router::drop(uint8_t port) {
+        OutBuffer &o = out[port];
+
+        for(uint8_t i = 0; i < o.len / 4; i++)
+                stats[o.route[i]].dropped++;
+        o.len = 0;
+}
+
+void USBH_MIDI_Router::Task() {
+        uint8_t buf[MIDI_EVENT_PACKET_SIZE];
+        uint16_t rcvd;
+
+        for(uint8_t port = 0; port < numPorts; port++) {
+                if(!*ports[port] || ports[port]->isMidi2())
+                        continue; // Not attached or it sends Universal MIDI Packets, which are not USB-MIDI 1.0 events
+                if(ports[port]->RecvData(&rcvd, buf) != 0)
+                        continue; // Nothing received or an error occurred
+
+                uint32_t timestamp = (uint32_t)micros();
+                for(uint8_t i = 0; i + 4 <= rcvd; i += 4) {
+                        const uint8_t *event = &buf[i];
+                        if(event[0] == 0 && event[1] == 0)
+                                break; // End of data
+                        for(uint8_t route = 0; route < MIDI_ROUTER_MAX_ROUTES; route++) {
+                                if(routeMatches(routes[route], port, event))
+                                        queueEvent(route, event, timestamp);
+                        }
+                }
+        }
+
+        // Every destination gets a single packet per call
+        for(uint8_t port = 0; port < numPorts; port++)
+                flush(port);
+}
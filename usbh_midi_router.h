@@ -0,0 +1,139 @@
+/*
+ *******************************************************************************
+ * USB-MIDI router for USB Host Shield 2.0 Library
+ *
+ * Moves USB-MIDI event packets between several USBH_MIDI instances
+ * according to a cable/channel aware routing table.
+ *******************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *******************************************************************************
+ */
+
+#if !defined(_USBH_MIDI_ROUTER_H_)
+#define _USBH_MIDI_ROUTER_H_
+#include "usbh_midi.h"
+
+#ifndef MIDI_ROUTER_MAX_PORTS
+#define MIDI_ROUTER_MAX_PORTS   8  // Maximum number of USBH_MIDI instances
+#endif
+#ifndef MIDI_ROUTER_MAX_ROUTES
+#define MIDI_ROUTER_MAX_ROUTES  16 // Maximum number of entries in the routing table
+#endif
+#ifndef MIDI_ROUTER_BUFFER_SIZE
+#define MIDI_ROUTER_BUFFER_SIZE 32 // Output buffer per port in bytes, a multiple of 4. It is sent in one transfer, which is split into packets of the endpoint size
+#endif
+
+#define MIDI_ROUTE_ANY_CABLE    0xFF   // Source: match all cables
+#define MIDI_ROUTE_SAME_CABLE   0xFF   // Destination: keep the cable number of the source
+#define MIDI_ROUTE_ALL_CHANNELS 0xFFFF
+#define MIDI_ROUTE_UNUSED       0xFF
+
+// Message type filter, one bit per Code Index Number.
+// CIN 0x5 is used both for the end of a SysEx message and for the single-byte System Common message Tune Request,
+// so only the former is matched by MIDI_ROUTE_TYPE(0x5), while Tune Request is matched by MIDI_ROUTE_TYPE(0x2) like the other System Common messages
+#define MIDI_ROUTE_TYPE(cin)        ((uint16_t)1 << (cin))
+#define MIDI_ROUTE_NOTES            (MIDI_ROUTE_TYPE(0x8) | MIDI_ROUTE_TYPE(0x9) | MIDI_ROUTE_TYPE(0xA))
+#define MIDI_ROUTE_CONTROL_CHANGE   MIDI_ROUTE_TYPE(0xB)
+#define MIDI_ROUTE_PROGRAM_CHANGE   MIDI_ROUTE_TYPE(0xC)
+#define MIDI_ROUTE_CHANNEL_PRESSURE MIDI_ROUTE_TYPE(0xD)
+#define MIDI_ROUTE_PITCH_BEND       MIDI_ROUTE_TYPE(0xE)
+#define MIDI_ROUTE_CHANNEL_MESSAGES (MIDI_ROUTE_NOTES | MIDI_ROUTE_CONTROL_CHANGE | MIDI_ROUTE_PROGRAM_CHANGE | MIDI_ROUTE_CHANNEL_PRESSURE | MIDI_ROUTE_PITCH_BEND)
+#define MIDI_ROUTE_SYSEX            (MIDI_ROUTE_TYPE(0x4) | MIDI_ROUTE_TYPE(0x5) | MIDI_ROUTE_TYPE(0x6) | MIDI_ROUTE_TYPE(0x7))
+#define MIDI_ROUTE_SYSTEM           (MIDI_ROUTE_TYPE(0x2) | MIDI_ROUTE_TYPE(0x3) | MIDI_ROUTE_TYPE(0xF))
+#define MIDI_ROUTE_ALL_TYPES        0xFFFF
+
+/** Entry in the routing table. */
+struct MidiRoute {
+        uint8_t srcPort;      // Port the events are read from, MIDI_ROUTE_UNUSED if the entry is free
+        uint8_t srcCable;     // Cable number to match or MIDI_ROUTE_ANY_CABLE
+        uint8_t dstPort;      // Port the events are sent to
+        uint8_t dstCable;     // Cable number on the destination or MIDI_ROUTE_SAME_CABLE
+        uint16_t channelMask; // Bit n set passes channel n+1. System messages are not affected
+        uint16_t typeMask;    // Bit n set passes events with Code Index Number n
+};
+
+/** Statistics kept for every route. Latency is measured from reception of the packet until it has been sent. */
+struct MidiRouteStats {
+        uint32_t events;     // Events forwarded
+        uint32_t dropped;    // Events which could not be delivered
+        uint32_t latencySum; // Sum of the latency of all forwarded events in us, divide by events to get the average
+        uint32_t latencyMax; // Worst case latency in us
+};
+
+/**
+ * This class routes MIDI events between several USBH_MIDI devices.
+ * All events read from a port during one call to Task() are batched into a single packet per destination.
+ */
+class USBH_MIDI_Router {
+public:
+        USBH_MIDI_Router();
+
+        /**
+         * Add a MIDI device to the router. Events are routed as USB-MIDI 1.0 packets, so MIDI 2.0 must not be enabled on it.
+         * While the device uses MIDI 2.0 nothing is read from it and events routed to it are dropped.
+         * @param  pMidi Pointer to the USBH_MIDI instance.
+         * @return       Port number used in the routing table or MIDI_ROUTE_UNUSED if there is no room.
+         */
+        uint8_t addPort(USBH_MIDI *pMidi);
+
+        /**
+         * Add an entry to the routing table. Several routes to one destination merge the sources,
+         * several routes from one source split it. Note that SysEx messages from two sources should not be merged onto the same cable.
+         * @param  srcPort     Port to read from.
+         * @param  dstPort     Port to write to.
+         * @param  srcCable    Cable to match or MIDI_ROUTE_ANY_CABLE.
+         * @param  dstCable    Cable on the destination or MIDI_ROUTE_SAME_CABLE.
+         * @param  channelMask Channels to pass, bit 0 is channel 1.
+         * @param  typeMask    Messages to pass, see MIDI_ROUTE_TYPE().
+         * @return             Index of the route or MIDI_ROUTE_UNUSED if the table is full or a port is invalid.
+         */
+        uint8_t addRoute(uint8_t srcPort, uint8_t dstPort, uint8_t srcCable = MIDI_ROUTE_ANY_CABLE, uint8_t dstCable = MIDI_ROUTE_SAME_CABLE,
+                uint16_t channelMask = MIDI_ROUTE_ALL_CHANNELS, uint16_t typeMask = MIDI_ROUTE_ALL_TYPES);
+        void removeRoute(uint8_t route);
+        void clearRoutes();
+
+        /** Must be called in the loop after Usb.Task(). Reads one packet from every port, routes it and flushes the output buffers. */
+        void Task();
+
+        /**
+         * Get the statistics of a route.
+         * @param  route Index returned by addRoute().
+         * @return       Pointer to the statistics or NULL if the route is invalid.
+         */
+        const MidiRouteStats *getRouteStats(uint8_t route) {
+                return (route < MIDI_ROUTER_MAX_ROUTES) ? &stats[route] : NULL;
+        };
+        void resetStats();
+
+private:
+        struct OutBuffer {
+                uint8_t data[MIDI_ROUTER_BUFFER_SIZE];
+                uint8_t route[MIDI_ROUTER_BUFFER_SIZE / 4]; // Route of each buffered event, used for the statistics
+                uint32_t timestamp[MIDI_ROUTER_BUFFER_SIZE / 4]; // Reception time of each buffered event
+                uint8_t len;
+        };
+
+        USBH_MIDI *ports[MIDI_ROUTER_MAX_PORTS];
+        uint8_t numPorts;
+        MidiRoute routes[MIDI_ROUTER_MAX_ROUTES];
+        MidiRouteStats stats[MIDI_ROUTER_MAX_ROUTES];
+        OutBuffer out[MIDI_ROUTER_MAX_PORTS];
+
+        bool routeMatches(const MidiRoute &r, uint8_t port, const uint8_t *event);
+        void queueEvent(uint8_t route, const uint8_t *event, uint32_t timestamp);
+        void flush(uint8_t port);
+        void drop(uint8_t port);
+};
+
+#endif //_USBH_MIDI_ROUTER_H_
@@ -152,6 +152,9 @@ protected:
         static const uint8_t maxHidInterfaces = 5;
         static const uint8_t maxEpPerInterface = 2;
         static const uint8_t totalEndpoints = (maxHidInterfaces * maxEpPerInterface + 1); // We need to make room for the control endpoint
+        static const uint8_t maxReportLen = 64; // Most bytes read from the interrupt IN endpoint at once
+
+        uint8_t rptPeak; // Longest report received
 
         void PrintEndpointDescriptor(const USB_ENDPOINT_DESCRIPTOR* ep_ptr);
         void PrintHidDescriptor(const USB_HID_DESCRIPTOR *pDesc);
@@ -162,7 +165,13 @@ protected:
 
 public:
 
-        USBHID(USB *pusb) : pUsb(pusb) {
+        USBHID(USB *pusb) : pUsb(pusb), rptPeak(0) {
+        };
+
+        /** @return Capacity and peak occupancy of the report buffer. Reports are parsed within Poll(), so none is held in between. */
+        USBBufferUsage getRxUsage(void) {
+                USBBufferUsage u = {maxReportLen, 0, rptPeak};
+                return u;
         };
 
         const USB* GetUsb() {
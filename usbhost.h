@@ -128,6 +128,9 @@ typedef SPi< P26, P25, P24, P10 > spi; //These are D26, D25, D24 in variant.cpp
 #error "No SPI entry in usbhost.h"
 #endif
 
+/* SPI clocks tried by MAX3421e::tuneSpiClock(), fastest first. Only the ones below USB_SPI_CLOCK are used */
+static const uint32_t usbSpiClocks[] PROGMEM = {USB_SPI_CLOCK, 20000000, 16000000, 12000000, 8000000, 4000000, 2000000, 1000000};
+
 typedef enum {
         vbus_on = 0,
         vbus_off = GPX_VBDET
@@ -135,6 +138,22 @@ typedef enum {
 
 template< typename SPI_SS, typename INTR > class MAX3421e /* : public spi */ {
         static uint8_t vbusState;
+        static USBSpiBackend *spiBackend;
+        static volatile bool spiPending;
+        static USBSpiCallback pFuncSpiDone;
+        static void *spiDoneArg;
+
+        static void spiBegin();
+        static void spiComplete(void *arg);
+
+        static uint32_t spiClock;
+        static uint8_t spiStep; // Index in usbSpiClocks
+        static uint8_t spiFaults; // Corrupted transfers since the last successful check
+        static uint16_t spiFaultTotal;
+
+        static void setSpiStep(uint8_t step);
+        static bool spiSlower();
+        bool spiVerify();
 
 public:
         MAX3421e();
@@ -143,6 +162,85 @@ public:
         void gpioWr(uint8_t data);
         uint8_t regRd(uint8_t reg);
         uint8_t* bytesRd(uint8_t reg, uint8_t nbytes, uint8_t* data_p);
+
+        /**
+         * Start a multiple-byte write and return while the data is still being sent.
+         * Without a backend, or if the backend cannot transfer in the background, the data is written before this returns.
+         * The next register access waits for the transfer to finish.
+         * @param  reg    Register to write.
+         * @param  nbytes Number of bytes.
+         * @param  data_p Data to write, which must not be changed before the transfer has finished.
+         * @param  cb     Called when the transfer has finished, possibly from an interrupt.
+         * @param  arg    Passed to the callback.
+         * @return        Pointer to the memory position after the last byte written.
+         */
+        uint8_t* bytesWrAsync(uint8_t reg, uint8_t nbytes, uint8_t* data_p, USBSpiCallback cb = NULL, void *arg = NULL);
+
+        /**
+         * Start a multiple-byte read and return while the data is still being received.
+         * See bytesWrAsync(). The data must not be used before the transfer has finished.
+         */
+        uint8_t* bytesRdAsync(uint8_t reg, uint8_t nbytes, uint8_t* data_p, USBSpiCallback cb = NULL, void *arg = NULL);
+
+        /** Wait until an asynchronous transfer has finished. */
+        static void spiWait() {
+                while(spiPending) {
+                        if(spiBackend)
+                                spiBackend->busy();
+                }
+        };
+
+        /** @return true while an asynchronous transfer is running. */
+        static bool spiBusy() {
+                if(spiPending && spiBackend)
+                        spiBackend->busy();
+                return spiPending;
+        };
+
+        /**
+         * Use a different SPI backend. Call this before Init().
+         * @param backend The backend or NULL to drive the SPI bus directly.
+         */
+        void setSpiBackend(USBSpiBackend *backend) {
+                spiWait();
+                spiBackend = backend;
+                if(spiBackend)
+                        spiBackend->setClock(spiClock);
+        };
+
+        /** @return The SPI clock in Hz. */
+        static uint32_t getSpiClock() {
+                return spiClock;
+        };
+
+        /**
+         * Set the SPI clock. It is rounded down to one of the steps used by tuneSpiClock().
+         * @param hz Clock in Hz.
+         */
+        static void setSpiClock(uint32_t hz);
+
+        /**
+         * Find the fastest SPI clock at which test patterns written to a register are read back correctly.
+         * Init() calls this when ENABLE_USB_SPI_AUTOTUNE is set, before the MAX3421E is reset, so any register corrupted while testing is cleared.
+         * @param  pinctl Written to rPINCTL at every step, as the full duplex mode is needed to read the registers.
+         * @return        The selected clock in Hz or 0 if even the slowest clock failed.
+         */
+        uint32_t tuneSpiClock(uint8_t pinctl = bmFDUPSPI | bmINTLEVEL);
+
+        /**
+         * Check the SPI bus by writing test patterns to a register and reading them back. The clock is lowered one step if this fails.
+         * Usb.Task() calls this every USB_SPI_CHECK_INTERVAL ms when ENABLE_USB_SPI_AUTOTUNE is set.
+         * @return true if the bus works.
+         */
+        bool checkSpi();
+
+        /** Report a transfer corrupted on the SPI bus. With ENABLE_USB_SPI_AUTOTUNE the clock is lowered after USB_SPI_MAX_FAULTS of these. */
+        static void spiFault();
+
+        /** @return Number of corrupted transfers and failed checks since Init(). */
+        static uint16_t getSpiFaults() {
+                return spiFaultTotal;
+        };
         uint8_t gpioRd();
         uint8_t gpioRdOutput();
         uint16_t reset();
@@ -165,6 +263,30 @@ public:
 template< typename SPI_SS, typename INTR >
         uint8_t MAX3421e< SPI_SS, INTR >::vbusState = 0;
 
+template< typename SPI_SS, typename INTR >
+        USBSpiBackend *MAX3421e< SPI_SS, INTR >::spiBackend = NULL;
+
+template< typename SPI_SS, typename INTR >
+        volatile bool MAX3421e< SPI_SS, INTR >::spiPending = false;
+
+template< typename SPI_SS, typename INTR >
+        USBSpiCallback MAX3421e< SPI_SS, INTR >::pFuncSpiDone = NULL;
+
+template< typename SPI_SS, typename INTR >
+        void *MAX3421e< SPI_SS, INTR >::spiDoneArg = NULL;
+
+template< typename SPI_SS, typename INTR >
+        uint32_t MAX3421e< SPI_SS, INTR >::spiClock = USB_SPI_CLOCK;
+
+template< typename SPI_SS, typename INTR >
+        uint8_t MAX3421e< SPI_SS, INTR >::spiStep = 0;
+
+template< typename SPI_SS, typename INTR >
+        uint8_t MAX3421e< SPI_SS, INTR >::spiFaults = 0;
+
+template< typename SPI_SS, typename INTR >
+        uint16_t MAX3421e< SPI_SS, INTR >::spiFaultTotal = 0;
+
 /* constructor */
 template< typename SPI_SS, typename INTR >
 MAX3421e< SPI_SS, INTR >::MAX3421e() {
@@ -179,9 +301,19 @@ MAX3421e< SPI_SS, INTR >::MAX3421e() {
 /* write single byte into MAX3421 register */
 template< typename SPI_SS, typename INTR >
 void MAX3421e< SPI_SS, INTR >::regWr(uint8_t reg, uint8_t data) {
+        spiWait();
+        if(spiBackend) {
+                uint8_t c[2];
+                c[0] = reg | 0x02;
+                c[1] = data;
+                spiBegin();
+                spiBackend->transfer(c, NULL, 2);
+                spiComplete(NULL);
+                return;
+        }
         XMEM_ACQUIRE_SPI();
 #if defined(SPI_HAS_TRANSACTION)
-        USB_SPI.beginTransaction(SPISettings(26000000, MSBFIRST, SPI_MODE0)); // The MAX3421E can handle up to 26MHz, use MSB First and SPI mode 0
+        USB_SPI.beginTransaction(SPISettings(spiClock, MSBFIRST, SPI_MODE0)); // Use MSB First and SPI mode 0
 #endif
         SPI_SS::Clear();
 
@@ -222,9 +354,15 @@ void MAX3421e< SPI_SS, INTR >::regWr(uint8_t reg, uint8_t data) {
 /* returns a pointer to memory position after last written */
 template< typename SPI_SS, typename INTR >
 uint8_t* MAX3421e< SPI_SS, INTR >::bytesWr(uint8_t reg, uint8_t nbytes, uint8_t* data_p) {
+        spiWait();
+        if(spiBackend) {
+                data_p = bytesWrAsync(reg, nbytes, data_p);
+                spiWait();
+                return data_p;
+        }
         XMEM_ACQUIRE_SPI();
 #if defined(SPI_HAS_TRANSACTION)
-        USB_SPI.beginTransaction(SPISettings(26000000, MSBFIRST, SPI_MODE0)); // The MAX3421E can handle up to 26MHz, use MSB First and SPI mode 0
+        USB_SPI.beginTransaction(SPISettings(spiClock, MSBFIRST, SPI_MODE0)); // Use MSB First and SPI mode 0
 #endif
         SPI_SS::Clear();
 
@@ -280,9 +418,19 @@ void MAX3421e< SPI_SS, INTR >::gpioWr(uint8_t data) {
 /* single host register read    */
 template< typename SPI_SS, typename INTR >
 uint8_t MAX3421e< SPI_SS, INTR >::regRd(uint8_t reg) {
+        spiWait();
+        if(spiBackend) {
+                uint8_t c[2];
+                c[0] = reg;
+                c[1] = 0; // Send empty byte
+                spiBegin();
+                spiBackend->transfer(c, c, 2);
+                spiComplete(NULL);
+                return c[1];
+        }
         XMEM_ACQUIRE_SPI();
 #if defined(SPI_HAS_TRANSACTION)
-        USB_SPI.beginTransaction(SPISettings(26000000, MSBFIRST, SPI_MODE0)); // The MAX3421E can handle up to 26MHz, use MSB First and SPI mode 0
+        USB_SPI.beginTransaction(SPISettings(spiClock, MSBFIRST, SPI_MODE0)); // Use MSB First and SPI mode 0
 #endif
         SPI_SS::Clear();
 
@@ -319,9 +467,15 @@ uint8_t MAX3421e< SPI_SS, INTR >::regRd(uint8_t reg) {
 /* returns a pointer to a memory position after last read   */
 template< typename SPI_SS, typename INTR >
 uint8_t* MAX3421e< SPI_SS, INTR >::bytesRd(uint8_t reg, uint8_t nbytes, uint8_t* data_p) {
+        spiWait();
+        if(spiBackend) {
+                data_p = bytesRdAsync(reg, nbytes, data_p);
+                spiWait();
+                return data_p;
+        }
         XMEM_ACQUIRE_SPI();
 #if defined(SPI_HAS_TRANSACTION)
-        USB_SPI.beginTransaction(SPISettings(26000000, MSBFIRST, SPI_MODE0)); // The MAX3421E can handle up to 26MHz, use MSB First and SPI mode 0
+        USB_SPI.beginTransaction(SPISettings(spiClock, MSBFIRST, SPI_MODE0)); // Use MSB First and SPI mode 0
 #endif
         SPI_SS::Clear();
 
@@ -378,6 +532,152 @@ uint8_t* MAX3421e< SPI_SS, INTR >::bytesRd(uint8_t reg, uint8_t nbytes, uint8_t*
         XMEM_RELEASE_SPI();
         return ( data_p);
 }
+/* Select the chip through the backend. The transaction ends in spiComplete() */
+template< typename SPI_SS, typename INTR >
+void MAX3421e< SPI_SS, INTR >::spiBegin() {
+        XMEM_ACQUIRE_SPI();
+        spiBackend->beginTransaction();
+        SPI_SS::Clear();
+}
+
+/* End of a backend transfer, which may be called from an interrupt */
+template< typename SPI_SS, typename INTR >
+void MAX3421e< SPI_SS, INTR >::spiComplete(void *arg __attribute__((unused))) {
+        SPI_SS::Set();
+        spiBackend->endTransaction();
+        XMEM_RELEASE_SPI();
+        USBSpiCallback cb = pFuncSpiDone;
+        pFuncSpiDone = NULL;
+        spiPending = false;
+        if(cb)
+                cb(spiDoneArg);
+}
+
+template< typename SPI_SS, typename INTR >
+uint8_t* MAX3421e< SPI_SS, INTR >::bytesWrAsync(uint8_t reg, uint8_t nbytes, uint8_t* data_p, USBSpiCallback cb, void *arg) {
+        spiWait();
+        if(!spiBackend) {
+                data_p = bytesWr(reg, nbytes, data_p);
+                if(cb)
+                        cb(arg);
+                return data_p;
+        }
+        spiBegin();
+        reg |= 0x02; // Set WR bit
+        spiBackend->transfer(&reg, NULL, 1);
+        pFuncSpiDone = cb;
+        spiDoneArg = arg;
+        spiPending = true;
+        if(!spiBackend->transferAsync(data_p, NULL, nbytes, spiComplete, NULL)) {
+                spiBackend->transfer(data_p, NULL, nbytes);
+                spiComplete(NULL);
+        }
+        return ( data_p + nbytes);
+}
+
+template< typename SPI_SS, typename INTR >
+uint8_t* MAX3421e< SPI_SS, INTR >::bytesRdAsync(uint8_t reg, uint8_t nbytes, uint8_t* data_p, USBSpiCallback cb, void *arg) {
+        spiWait();
+        if(!spiBackend) {
+                data_p = bytesRd(reg, nbytes, data_p);
+                if(cb)
+                        cb(arg);
+                return data_p;
+        }
+        spiBegin();
+        spiBackend->transfer(&reg, NULL, 1);
+        pFuncSpiDone = cb;
+        spiDoneArg = arg;
+        spiPending = true;
+        if(!spiBackend->transferAsync(NULL, data_p, nbytes, spiComplete, NULL)) {
+                spiBackend->transfer(NULL, data_p, nbytes);
+                spiComplete(NULL);
+        }
+        return ( data_p + nbytes);
+}
+template< typename SPI_SS, typename INTR >
+void MAX3421e< SPI_SS, INTR >::setSpiStep(uint8_t step) {
+        spiWait();
+        spiStep = step;
+        spiClock = pgm_read_dword(&usbSpiClocks[step]);
+        if(spiBackend)
+                spiBackend->setClock(spiClock);
+}
+
+/* Go to the next slower clock. Returns false if the slowest clock is already used */
+template< typename SPI_SS, typename INTR >
+bool MAX3421e< SPI_SS, INTR >::spiSlower() {
+        for(uint8_t i = spiStep + 1; i < sizeof (usbSpiClocks) / sizeof (usbSpiClocks[0]); i++) {
+                if(pgm_read_dword(&usbSpiClocks[i]) < spiClock) {
+                        setSpiStep(i);
+                        return true;
+                }
+        }
+        return false;
+}
+
+template< typename SPI_SS, typename INTR >
+void MAX3421e< SPI_SS, INTR >::setSpiClock(uint32_t hz) {
+        setSpiStep(0);
+        while(spiClock > hz && spiSlower());
+}
+
+/* Write test patterns to the peripheral address register, which is set again before every transfer, and read them back */
+template< typename SPI_SS, typename INTR >
+bool MAX3421e< SPI_SS, INTR >::spiVerify() {
+        static const uint8_t patterns[] = {0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x01, 0x80};
+        uint8_t peraddr = regRd(rPERADDR);
+        bool ok = true;
+
+        for(uint8_t round = 0; round < 4 && ok; round++) {
+                for(uint8_t i = 0; i < sizeof (patterns); i++) {
+                        regWr(rPERADDR, patterns[i]);
+                        if(regRd(rPERADDR) != patterns[i]) {
+                                ok = false;
+                                break;
+                        }
+                }
+        }
+        regWr(rPERADDR, peraddr);
+        return ok;
+}
+
+template< typename SPI_SS, typename INTR >
+uint32_t MAX3421e< SPI_SS, INTR >::tuneSpiClock(uint8_t pinctl) {
+        setSpiStep(0);
+        for(;;) {
+                regWr(rPINCTL, pinctl);
+                if(spiVerify())
+                        break;
+                if(!spiSlower())
+                        return 0;
+        }
+        spiFaults = 0;
+        return spiClock;
+}
+
+template< typename SPI_SS, typename INTR >
+bool MAX3421e< SPI_SS, INTR >::checkSpi() {
+        if(spiVerify()) {
+                spiFaults = 0;
+                return true;
+        }
+        spiFaultTotal++;
+        spiSlower();
+        return false;
+}
+
+template< typename SPI_SS, typename INTR >
+void MAX3421e< SPI_SS, INTR >::spiFault() {
+        spiFaultTotal++;
+#if ENABLE_USB_SPI_AUTOTUNE
+        if(++spiFaults >= USB_SPI_MAX_FAULTS) {
+                spiFaults = 0;
+                spiSlower();
+        }
+#endif
+}
+
 /* GPIO read. See gpioWr for explanation */
 
 /** @brief  Reads the current GPI input values
@@ -432,11 +732,18 @@ int8_t MAX3421e< SPI_SS, INTR >::Init() {
         SPI_SS::SetDirWrite();
         SPI_SS::Set();
         spi::init();
+        if(spiBackend)
+                spiBackend->begin();
         INTR::SetDirRead();
         XMEM_RELEASE_SPI();
         /* MAX3421E - full-duplex SPI, level interrupt */
         // GPX pin on. Moved here, otherwise we flicker the vbus.
+        spiFaultTotal = 0;
+#if ENABLE_USB_SPI_AUTOTUNE
+        tuneSpiClock(bmFDUPSPI | bmINTLEVEL);
+#else
         regWr(rPINCTL, (bmFDUPSPI | bmINTLEVEL));
+#endif
 
         if(reset() == 0) { //OSCOKIRQ hasn't asserted in time
                 return ( -1);
@@ -469,10 +776,17 @@ int8_t MAX3421e< SPI_SS, INTR >::Init(int mseconds) {
         SPI_SS::SetDirWrite();
         SPI_SS::Set();
         spi::init();
+        if(spiBackend)
+                spiBackend->begin();
         INTR::SetDirRead();
         XMEM_RELEASE_SPI();
         /* MAX3421E - full-duplex SPI, level interrupt, vbus off */
+        spiFaultTotal = 0;
+#if ENABLE_USB_SPI_AUTOTUNE
+        tuneSpiClock(bmFDUPSPI | bmINTLEVEL | GPX_VBDET);
+#else
         regWr(rPINCTL, (bmFDUPSPI | bmINTLEVEL | GPX_VBDET));
+#endif
 
         if(reset() == 0) { //OSCOKIRQ hasn't asserted in time
                 return ( -1);
@@ -200,6 +200,8 @@ public:
                 return bAddress;
         };
 
+        USB_DEVICE_MEMORY_USAGE();
+
         virtual bool DEVCLASSOK(uint8_t klass) {
                 return (klass == 0x09);
         }